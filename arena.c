@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "arena.h"
+#include "efi-log.h"
+#include "util.h"
+
+/* Same alignment as the firmware pool allocator guarantees */
+#define ARENA_ALIGNMENT 8U
+
+static struct {
+        uint8_t *base;
+        size_t size;
+        size_t used;
+        size_t last;            /* Offset of the most recent allocation, SIZE_MAX if unknown */
+
+        size_t peak;
+        unsigned n_allocs;      /* Allocations served from the arena */
+        unsigned n_pool_allocs; /* Allocations that had to fall back to the firmware pool */
+        unsigned n_resets;
+} arena = {
+        .last = SIZE_MAX,
+};
+
+void arena_init(size_t size) {
+        EFI_PHYSICAL_ADDRESS addr;
+
+        assert(!arena.base);
+
+        size = ALIGN_TO(size, EFI_PAGE_SIZE);
+        if (BS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(size), &addr) != EFI_SUCCESS)
+                return; /* Not fatal, everything simply goes to the pool then. */
+
+        arena.base = PHYSICAL_ADDRESS_TO_POINTER(addr);
+        arena.size = size;
+        arena.used = 0;
+        arena.last = SIZE_MAX;
+}
+
+void arena_done(void) {
+        if (!arena.base)
+                return;
+
+        (void) BS->FreePages(POINTER_TO_PHYSICAL_ADDRESS(arena.base), EFI_SIZE_TO_PAGES(arena.size));
+        arena.base = NULL;
+        arena.size = arena.used = 0;
+        arena.last = SIZE_MAX;
+}
+
+bool arena_owns(const void *p) {
+        return arena.base && (const uint8_t *) p >= arena.base && (const uint8_t *) p < arena.base + arena.size;
+}
+
+void *arena_alloc(size_t size) {
+        size_t aligned = ALIGN_TO(size, ARENA_ALIGNMENT);
+
+        if (!arena.base || aligned > arena.size - arena.used) {
+                arena.n_pool_allocs++;
+                return NULL;
+        }
+
+        void *p = arena.base + arena.used;
+        arena.last = arena.used;
+        arena.used += aligned;
+        arena.peak = MAX(arena.peak, arena.used);
+        arena.n_allocs++;
+        return p;
+}
+
+bool arena_free(void *p) {
+        if (!arena_owns(p))
+                return false;
+
+        /* Only the top of the arena can be given back, everything else waits for the next reset. */
+        if ((uint8_t *) p == arena.base + arena.last) {
+                arena.used = arena.last;
+                arena.last = SIZE_MAX;
+        }
+
+        return true;
+}
+
+bool arena_extend(void *p, size_t new_size) {
+        if (!arena_owns(p) || (uint8_t *) p != arena.base + arena.last)
+                return false;
+
+        size_t aligned = ALIGN_TO(new_size, ARENA_ALIGNMENT);
+        if (aligned > arena.size - arena.last)
+                return false;
+
+        arena.used = arena.last + aligned;
+        arena.peak = MAX(arena.peak, arena.used);
+        return true;
+}
+
+ArenaMark arena_mark(void) {
+        return (ArenaMark) {
+                .used = arena.used,
+        };
+}
+
+void arena_reset(const ArenaMark *mark) {
+        assert(mark);
+
+        /* The arena might have been torn down in the meantime, or reset to an earlier mark already. */
+        if (!arena.base || mark->used > arena.used)
+                return;
+
+        arena.used = mark->used;
+        arena.last = SIZE_MAX;
+        arena.n_resets++;
+}
+
+void arena_log_stats(void) {
+        log_debug("Arena: %u allocations, %u pool fallbacks, %u resets, peak %zu of %zu bytes",
+                  arena.n_allocs, arena.n_pool_allocs, arena.n_resets, arena.peak, arena.size);
+}
@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "bench.h"
+#include "chid.h"
+#include "devicetree.h"
+#include "efi-log.h"
+#include "iovec-util-fundamental.h"
+#include "mp.h"
+#include "smbios.h"
+#include "ticks.h"
+#include "util.h"
+
+unsigned bench_iterations = 0;
+
+typedef struct BenchContext {
+        const uint8_t *base;
+        PeImage pe;
+        struct iovec hwids;
+        struct iovec dtb;
+        struct iovec kernel;
+        void *kernel_dest;      /* Where the kernel is copied to, allocated once for all runs */
+} BenchContext;
+
+typedef struct BenchPath {
+        const char *name;
+        EFI_STATUS (*run)(const BenchContext *ctx);
+        /* Where the path does not apply to this UKI, it is skipped */
+        bool (*applies)(const BenchContext *ctx);
+} BenchPath;
+
+static EFI_STATUS run_smbios(const BenchContext *ctx) {
+        RawSmbiosInfo info;
+        smbios_raw_info_populate(&info);
+        return EFI_SUCCESS;
+}
+
+static EFI_STATUS run_chid(const BenchContext *ctx) {
+        EFI_GUID chids[CHID_TYPES_MAX];
+        return chid_populate_board(chids);
+}
+
+static bool has_hwids(const BenchContext *ctx) {
+        return iovec_is_set(&ctx->hwids);
+}
+
+static EFI_STATUS run_chid_match(const BenchContext *ctx) {
+        const Device *device;
+        size_t chid_type;
+        EFI_STATUS err;
+
+        err = chid_match(ctx->hwids.iov_base, ctx->hwids.iov_len, DEVICE_TYPE_DEVICETREE, &device, &chid_type);
+        /* Not matching this machine is as much work as matching it */
+        return err == EFI_NOT_FOUND ? EFI_SUCCESS : err;
+}
+
+static EFI_STATUS run_dtbauto(const BenchContext *ctx) {
+        static const char *const section_names[] = { ".dtbauto", NULL };
+        PeSectionVector section[1] = {};
+        pe_locate_sections(ctx->pe.sections, ctx->pe.n_sections, section_names, PTR_TO_SIZE(ctx->base), section);
+        return EFI_SUCCESS;
+}
+
+static bool has_dtb(const BenchContext *ctx) {
+        return iovec_is_set(&ctx->dtb);
+}
+
+static EFI_STATUS run_devicetree(const BenchContext *ctx) {
+        struct devicetree_state state = {};
+        EFI_STATUS err;
+
+        err = devicetree_install_from_memory(&state, ctx->dtb.iov_base, ctx->dtb.iov_len);
+        devicetree_cleanup(&state);
+        return err;
+}
+
+static bool has_kernel(const BenchContext *ctx) {
+        return ctx->kernel_dest;
+}
+
+static EFI_STATUS run_kernel_copy(const BenchContext *ctx) {
+        mp_memcpy(ctx->kernel_dest, ctx->kernel.iov_base, ctx->kernel.iov_len);
+        return EFI_SUCCESS;
+}
+
+static const BenchPath paths[] = {
+        { "smbios",      run_smbios,      NULL       },
+        { "chid",        run_chid,        NULL       },
+        { "chid_match",  run_chid_match,  has_hwids  },
+        { "dtbauto",     run_dtbauto,     NULL       },
+        { "devicetree",  run_devicetree,  has_dtb    },
+        { "kernel_copy", run_kernel_copy, has_kernel },
+};
+
+static void sort_ticks(uint64_t *t, size_t n) {
+        /* Insertion sort, n is small and this runs once per path */
+        for (size_t i = 1; i < n; i++) {
+                uint64_t v = t[i];
+                size_t j = i;
+                for (; j > 0 && t[j - 1] > v; j--)
+                        t[j] = t[j - 1];
+                t[j] = v;
+        }
+}
+
+static struct iovec section_iovec(const uint8_t *base, const PeSectionVector *section) {
+        if (!PE_SECTION_VECTOR_IS_SET(section))
+                return (struct iovec) {};
+        return IOVEC_MAKE(base + section->memory_offset, section->memory_size);
+}
+
+void bench_run(EFI_LOADED_IMAGE_PROTOCOL *loaded_image, const PeSectionVector sections[static _UNIFIED_SECTION_MAX]) {
+        EFI_STATUS err;
+
+        assert(loaded_image);
+        assert(sections);
+
+        if (bench_iterations == 0)
+                return;
+
+        BenchContext ctx = {
+                .base = loaded_image->ImageBase,
+                .hwids = section_iovec(loaded_image->ImageBase, sections + UNIFIED_SECTION_HWIDS),
+                .dtb = section_iovec(loaded_image->ImageBase, sections + UNIFIED_SECTION_DTBAUTO),
+                .kernel = section_iovec(loaded_image->ImageBase, sections + UNIFIED_SECTION_LINUX),
+        };
+        if (!iovec_is_set(&ctx.dtb))
+                ctx.dtb = section_iovec(loaded_image->ImageBase, sections + UNIFIED_SECTION_DTB);
+
+        err = pe_image_parse(
+                        loaded_image->ImageBase,
+                        loaded_image->ImageSize,
+                        /* allow_compatibility= */ false,
+                        &ctx.pe);
+        if (err != EFI_SUCCESS) {
+                log_error_status(err, "Unable to parse own image for benchmark: %m");
+                return;
+        }
+
+        /* Only the copy is timed, not the firmware's page allocator */
+        _cleanup_pages_ Pages kernel_pages = {};
+        if (iovec_is_set(&ctx.kernel)) {
+                EFI_PHYSICAL_ADDRESS addr;
+                size_t n_pages = EFI_SIZE_TO_PAGES(ctx.kernel.iov_len);
+
+                err = BS->AllocatePages(AllocateAnyPages, EfiLoaderCode, n_pages, &addr);
+                if (err != EFI_SUCCESS)
+                        log_warning_status(err, "Unable to allocate memory to copy the kernel to, not timing it: %m");
+                else {
+                        kernel_pages = (Pages) { .addr = addr, .n_pages = n_pages };
+                        ctx.kernel_dest = PHYSICAL_ADDRESS_TO_POINTER(addr);
+                }
+        }
+
+        _cleanup_free_ uint64_t *ticks = xnew(uint64_t, bench_iterations);
+        uint64_t freq = ticks_freq();
+
+        log_info("Running each hot path %u times, ticks at %" PRIu64 " Hz:", bench_iterations, freq);
+
+        FOREACH_ELEMENT(path, paths) {
+                if (path->applies && !path->applies(&ctx)) {
+                        log_info("bench %s: not applicable", path->name);
+                        continue;
+                }
+
+                /* Once with logging, so that whatever goes wrong shows up once rather than on every run */
+                err = path->run(&ctx);
+                if (err != EFI_SUCCESS) {
+                        log_error_status(err, "bench %s: failed, skipping: %m", path->name);
+                        continue;
+                }
+
+                log_ismuted = true;
+                for (unsigned i = 0; i < bench_iterations; i++) {
+                        uint64_t start = ticks_read();
+                        (void) path->run(&ctx);
+                        ticks[i] = ticks_read() - start;
+                }
+                log_ismuted = false;
+
+                sort_ticks(ticks, bench_iterations);
+                uint64_t min = ticks[0], median = ticks[bench_iterations / 2], max = ticks[bench_iterations - 1];
+                log_info("bench %s: min %" PRIu64 " median %" PRIu64 " max %" PRIu64 " ticks, median %" PRIu64 " us",
+                         path->name, min, median, max, ticks_to_usec(median));
+        }
+}
@@ -0,0 +1,199 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "bs-stats.h"
+
+#if STUBBLE_BS_STATS
+
+#include "efi-efivars.h"
+#include "efi-log.h"
+#include "util.h"
+
+#define BS_STATS_ENTRIES_MAX 64U
+
+static const char *const call_names[_BS_STATS_CALL_MAX] = {
+        [BS_STATS_ALLOCATE_POOL]               = "AllocatePool",
+        [BS_STATS_ALLOCATE_PAGES]              = "AllocatePages",
+        [BS_STATS_COPY_MEM]                    = "CopyMem",
+        [BS_STATS_SET_MEM]                     = "SetMem",
+        [BS_STATS_LOCATE_PROTOCOL]             = "LocateProtocol",
+        [BS_STATS_HANDLE_PROTOCOL]             = "HandleProtocol",
+        [BS_STATS_INSTALL_CONFIGURATION_TABLE] = "InstallConfigurationTable",
+        [BS_STATS_CONFIGURATION_TABLE_HIT]     = "ConfigurationTable (cached)",
+        [BS_STATS_CONFIGURATION_TABLE_MISS]    = "ConfigurationTable (scan)",
+        [BS_STATS_TCG2_GET_CAPABILITY]         = "TCG2 GetCapability",
+        [BS_STATS_TCG2_GET_ACTIVE_PCR_BANKS]   = "TCG2 GetActivePcrBanks",
+        [BS_STATS_TCG2_HASH_LOG_EXTEND_EVENT]  = "TCG2 HashLogExtendEvent",
+        [BS_STATS_CC_GET_CAPABILITY]           = "CC GetCapability",
+        [BS_STATS_CC_MAP_PCR_TO_MR_INDEX]      = "CC MapPcrToMrIndex",
+        [BS_STATS_CC_HASH_LOG_EXTEND_EVENT]    = "CC HashLogExtendEvent",
+};
+
+static struct {
+        EFI_BOOT_SERVICES *orig;
+        EFI_BOOT_SERVICES table;
+        const void *pending_site;
+
+        BsStatsEntry entries[BS_STATS_ENTRIES_MAX];
+        size_t n_entries;
+        unsigned n_dropped;
+} stats;
+
+void bs_stats_set_site(const void *site) {
+        stats.pending_site = site;
+}
+
+static const void *take_site(const void *caller) {
+        const void *site = stats.pending_site ?: caller;
+        stats.pending_site = NULL;
+        return site;
+}
+
+void bs_stats_record(BsStatsCall call, const void *site, uint64_t bytes, uint64_t ticks) {
+        assert(call < _BS_STATS_CALL_MAX);
+
+        /* Note that this is called from the CopyMem/SetMem wrappers, so it must not end up in memcpy() or
+         * memset() itself. Hence no struct assignments below. */
+
+        uint32_t offset = (uint32_t) ((const uint8_t *) site - __executable_start);
+
+        BsStatsEntry *e = NULL;
+        for (size_t i = 0; i < stats.n_entries; i++)
+                if (stats.entries[i].call == call && stats.entries[i].site == offset) {
+                        e = stats.entries + i;
+                        break;
+                }
+
+        if (!e) {
+                if (stats.n_entries >= BS_STATS_ENTRIES_MAX) {
+                        stats.n_dropped++;
+                        return;
+                }
+
+                e = stats.entries + stats.n_entries++;
+                e->call = call;
+                e->site = offset;
+                e->count = e->bytes = e->ticks = 0;
+        }
+
+        e->count++;
+        e->bytes += bytes;
+        e->ticks += ticks;
+}
+
+static EFIAPI EFI_STATUS wrap_allocate_pages(
+                EFI_ALLOCATE_TYPE type, EFI_MEMORY_TYPE memory_type, size_t n_pages, EFI_PHYSICAL_ADDRESS *memory) {
+
+        const void *site = take_site(__builtin_return_address(0));
+        uint64_t start = ticks_read();
+        EFI_STATUS err = stats.orig->AllocatePages(type, memory_type, n_pages, memory);
+        bs_stats_record(BS_STATS_ALLOCATE_PAGES, site, (uint64_t) n_pages * EFI_PAGE_SIZE, ticks_read() - start);
+        return err;
+}
+
+static EFIAPI EFI_STATUS wrap_allocate_pool(EFI_MEMORY_TYPE pool_type, size_t size, void **buffer) {
+        const void *site = take_site(__builtin_return_address(0));
+        uint64_t start = ticks_read();
+        EFI_STATUS err = stats.orig->AllocatePool(pool_type, size, buffer);
+        bs_stats_record(BS_STATS_ALLOCATE_POOL, site, size, ticks_read() - start);
+        return err;
+}
+
+static EFIAPI void wrap_copy_mem(void *dest, void *src, size_t length) {
+        const void *site = take_site(__builtin_return_address(0));
+        uint64_t start = ticks_read();
+        stats.orig->CopyMem(dest, src, length);
+        bs_stats_record(BS_STATS_COPY_MEM, site, length, ticks_read() - start);
+}
+
+static EFIAPI void wrap_set_mem(void *buffer, size_t size, uint8_t value) {
+        const void *site = take_site(__builtin_return_address(0));
+        uint64_t start = ticks_read();
+        stats.orig->SetMem(buffer, size, value);
+        bs_stats_record(BS_STATS_SET_MEM, site, size, ticks_read() - start);
+}
+
+static EFIAPI EFI_STATUS wrap_locate_protocol(EFI_GUID *protocol, void *registration, void **interface) {
+        const void *site = take_site(__builtin_return_address(0));
+        uint64_t start = ticks_read();
+        EFI_STATUS err = stats.orig->LocateProtocol(protocol, registration, interface);
+        bs_stats_record(BS_STATS_LOCATE_PROTOCOL, site, 0, ticks_read() - start);
+        return err;
+}
+
+static EFIAPI EFI_STATUS wrap_handle_protocol(EFI_HANDLE handle, EFI_GUID *protocol, void **interface) {
+        const void *site = take_site(__builtin_return_address(0));
+        uint64_t start = ticks_read();
+        EFI_STATUS err = stats.orig->HandleProtocol(handle, protocol, interface);
+        bs_stats_record(BS_STATS_HANDLE_PROTOCOL, site, 0, ticks_read() - start);
+        return err;
+}
+
+static EFIAPI EFI_STATUS wrap_install_configuration_table(EFI_GUID *guid, void *table) {
+        const void *site = take_site(__builtin_return_address(0));
+        uint64_t start = ticks_read();
+        EFI_STATUS err = stats.orig->InstallConfigurationTable(guid, table);
+        bs_stats_record(BS_STATS_INSTALL_CONFIGURATION_TABLE, site, 0, ticks_read() - start);
+        return err;
+}
+
+void bs_stats_init(void) {
+        assert(BS);
+        assert(!stats.orig);
+
+        /* Only the stub itself goes through the global BS pointer, the firmware and the kernel we hand off
+         * to keep using the real table from the system table. */
+        stats.orig = BS;
+        stats.table = *BS;
+        stats.table.AllocatePages = wrap_allocate_pages;
+        stats.table.AllocatePool = wrap_allocate_pool;
+        stats.table.CopyMem = wrap_copy_mem;
+        stats.table.SetMem = wrap_set_mem;
+        stats.table.LocateProtocol = wrap_locate_protocol;
+        stats.table.HandleProtocol = wrap_handle_protocol;
+        stats.table.InstallConfigurationTable = wrap_install_configuration_table;
+        BS = &stats.table;
+}
+
+void bs_stats_done(void) {
+        if (!stats.orig)
+                return;
+
+        BS = stats.orig;
+        stats.orig = NULL;
+}
+
+void bs_stats_report(void) {
+        /* Logging and exporting calls into the firmware too, take a snapshot so that doesn't show up. */
+        size_t n_entries = stats.n_entries;
+        uint64_t freq = ticks_freq();
+
+        if (log_isdebug) {
+                log_debug("Boot services calls (%zu call sites, %u dropped, %" PRIu64 " ticks/s):",
+                          n_entries, stats.n_dropped, freq);
+                for (size_t i = 0; i < n_entries; i++) {
+                        const BsStatsEntry *e = stats.entries + i;
+                        log_debug("  %-28s @0x%05x: %4" PRIu64 " calls %9" PRIu64 " bytes %10" PRIu64 " ticks (%" PRIu64 " us)",
+                                  call_names[e->call], e->site, e->count, e->bytes, e->ticks,
+                                  ticks_to_usec(e->ticks));
+                }
+        }
+
+        size_t size = sizeof(BsStatsHeader) + n_entries * sizeof(BsStatsEntry);
+        _cleanup_free_ uint8_t *buf = xmalloc(size);
+
+        BsStatsHeader *h = (BsStatsHeader *) buf;
+        *h = (BsStatsHeader) {
+                .magic = BS_STATS_MAGIC,
+                .entry_size = sizeof(BsStatsEntry),
+                .n_entries = n_entries,
+                .n_dropped = stats.n_dropped,
+                .ticks_freq = freq,
+        };
+        memcpy(buf + sizeof(BsStatsHeader), stats.entries, n_entries * sizeof(BsStatsEntry));
+
+        EFI_STATUS err = efivar_set_raw(MAKE_GUID_PTR(LOADER), u"StubbleBootServicesStats", buf, size, 0);
+        if (err != EFI_SUCCESS)
+                log_warning_status(err, "Failed to export boot services statistics, ignoring: %m");
+}
+
+#endif
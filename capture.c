@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "capture.h"
+#include "chid.h"
+#include "devicetree.h"
+#include "edid.h"
+#include "efi-log.h"
+#include "proto/dt-fixup.h"
+#include "smbios.h"
+#include "string-util-fundamental.h"
+#include "util.h"
+
+char16_t *capture_path = NULL;
+
+typedef struct CaptureWriter {
+        EFI_FILE *handle;
+        uint32_t n_records;
+} CaptureWriter;
+
+static EFI_STATUS capture_add(CaptureWriter *w, CaptureRecordType type, const void *data, size_t size) {
+        static const uint8_t padding[CAPTURE_ALIGNMENT] = {};
+        EFI_STATUS err;
+
+        assert(w);
+        assert(data || size == 0);
+
+        if (size > UINT32_MAX)
+                return EFI_BAD_BUFFER_SIZE;
+
+        CaptureRecord record = {
+                .type = type,
+                .size = size,
+        };
+
+        err = file_write_all(w->handle, &record, sizeof(record));
+        if (err != EFI_SUCCESS)
+                return err;
+
+        err = file_write_all(w->handle, data, size);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        err = file_write_all(w->handle, padding, ALIGN_TO(size, CAPTURE_ALIGNMENT) - size);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        w->n_records++;
+        return EFI_SUCCESS;
+}
+
+static EFI_STATUS capture_records(CaptureWriter *w, const EFI_GUID chids[static CHID_TYPES_MAX]) {
+        EFI_STATUS err;
+
+        assert(w);
+        assert(chids);
+
+        const void *entry_point;
+        size_t entry_point_size;
+        uint64_t smbios_size;
+        const void *smbios = smbios_get_raw_table(&entry_point, &entry_point_size, &smbios_size);
+        if (smbios) {
+                err = capture_add(w, CAPTURE_RECORD_SMBIOS_ENTRY_POINT, entry_point, entry_point_size);
+                if (err != EFI_SUCCESS)
+                        return err;
+
+                err = capture_add(w, CAPTURE_RECORD_SMBIOS_TABLE, smbios, smbios_size);
+                if (err != EFI_SUCCESS)
+                        return err;
+        }
+
+        const void *edid;
+        size_t edid_size;
+        if (edid_get_discovered_blob(&edid, &edid_size) == EFI_SUCCESS) {
+                err = capture_add(w, CAPTURE_RECORD_EDID, edid, edid_size);
+                if (err != EFI_SUCCESS)
+                        return err;
+        }
+
+        const FdtHeader *dtb = find_configuration_table(MAKE_GUID_PTR(EFI_DTB_TABLE));
+        if (dtb && be32toh(dtb->magic) == FDT_MAGIC) {
+                err = capture_add(w, CAPTURE_RECORD_DTB, dtb, be32toh(dtb->total_size));
+                if (err != EFI_SUCCESS)
+                        return err;
+        }
+
+        _cleanup_free_ EFI_GUID *guids = xnew(EFI_GUID, ST->NumberOfTableEntries);
+        for (size_t i = 0; i < ST->NumberOfTableEntries; i++)
+                guids[i] = ST->ConfigurationTable[i].VendorGuid;
+        err = capture_add(w, CAPTURE_RECORD_CONFIG_TABLES, guids, ST->NumberOfTableEntries * sizeof(EFI_GUID));
+        if (err != EFI_SUCCESS)
+                return err;
+
+        return capture_add(w, CAPTURE_RECORD_CHIDS, chids, CHID_TYPES_MAX * sizeof(EFI_GUID));
+}
+
+EFI_STATUS capture_write(EFI_LOADED_IMAGE_PROTOCOL *loaded_image, const char16_t *path) {
+        EFI_STATUS err;
+
+        assert(loaded_image);
+        assert(path);
+
+        EFI_GUID chids[CHID_TYPES_MAX] = {};
+        err = chid_populate_board(chids);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Failed to calculate CHIDs for capture: %m");
+
+        /* CHID 3 covers manufacturer, family, product name, SKU and baseboard, i.e. identifies the model */
+        _cleanup_free_ char16_t *default_path = NULL;
+        if (isempty(path)) {
+                default_path = xasprintf("\\stubble-capture-" GUID_FORMAT_STR ".bin", GUID_FORMAT_VAL(chids[3]));
+                path = default_path;
+        }
+
+        _cleanup_file_close_ EFI_FILE *root = NULL, *handle = NULL;
+        err = open_volume(loaded_image->DeviceHandle, &root);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Unable to open root directory: %m");
+
+        /* Drop any previous capture, there is no way to truncate a file otherwise */
+        if (root->Open(root, &handle, (char16_t *) path, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0) == EFI_SUCCESS)
+                (void) handle->Delete(TAKE_PTR(handle));
+
+        err = root->Open(
+                        root,
+                        &handle,
+                        (char16_t *) path,
+                        EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+                        0);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Unable to create capture file %ls: %m", path);
+
+        /* The record count is only known at the end, the header is written again then. */
+        CaptureHeader header = {
+                .magic = CAPTURE_MAGIC,
+        };
+        err = file_write_all(handle, &header, sizeof(header));
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Unable to write capture file %ls: %m", path);
+
+        CaptureWriter w = {
+                .handle = handle,
+        };
+        err = capture_records(&w, chids);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Unable to write capture file %ls: %m", path);
+
+        header.n_records = w.n_records;
+        err = handle->SetPosition(handle, 0);
+        if (err == EFI_SUCCESS)
+                err = file_write_all(handle, &header, sizeof(header));
+        if (err == EFI_SUCCESS)
+                err = handle->Flush(handle);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Unable to write capture file %ls: %m", path);
+
+        log_debug("Wrote capture with %u records to %ls", w.n_records, path);
+        return EFI_SUCCESS;
+}
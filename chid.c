@@ -14,6 +14,7 @@
  * https://github.com/aarch64-laptops/edk2/blob/dtbloader-app/EmbeddedPkg/Application/ConfigTableLoader/CHID.c
  */
 
+#include "arena.h"
 #include "chid.h"
 #include "edid.h"
 #include "efi-log.h"
@@ -24,40 +25,55 @@
 #include "memory-util-fundamental.h"
 #include "sha1.h"
 
-static void get_chid(
-                const char16_t *const smbios_fields[static _CHID_SMBIOS_FIELDS_MAX],
-                uint32_t mask,
-                EFI_GUID *ret_chid) {
+/* A CHID is a name based UUID: the SHA1 of a namespace followed by the selected SMBIOS fields as UTF-16,
+ * separated by '&'. Returns the size of that message, or 0 if one of the fields is missing, in which case
+ * there is no CHID, as per spec. */
+static size_t chid_message_size(const char16_t *const smbios_fields[static _CHID_SMBIOS_FIELDS_MAX], uint32_t mask) {
+        size_t size = sizeof(EFI_GUID);
 
         assert(mask != 0);
-        assert(ret_chid);
 
-        struct sha1_ctx ctx = {};
-        sha1_init_ctx(&ctx);
+        for (ChidSmbiosFields i = 0; i < _CHID_SMBIOS_FIELDS_MAX; i++) {
+                if (!FLAGS_SET(mask, UINT32_C(1) << i))
+                        continue;
+
+                if (!smbios_fields[i])
+                        return 0;
+
+                if (i > 0)
+                        size += sizeof(char16_t);
+
+                size += strlen16(smbios_fields[i]) * sizeof(char16_t);
+        }
+
+        return size;
+}
+
+static void chid_message_write(
+                const char16_t *const smbios_fields[static _CHID_SMBIOS_FIELDS_MAX],
+                uint32_t mask,
+                uint8_t *buf) {
+
+        assert(buf);
 
         static const EFI_GUID namespace = { UINT32_C(0x12d8ff70), UINT16_C(0x7f4c), UINT16_C(0x7d4c), {} }; /* Swapped to BE */
-        sha1_process_bytes(&namespace, sizeof(namespace), &ctx);
+        buf = mempcpy(buf, &namespace, sizeof(namespace));
 
         for (ChidSmbiosFields i = 0; i < _CHID_SMBIOS_FIELDS_MAX; i++) {
                 if (!FLAGS_SET(mask, UINT32_C(1) << i))
                         continue;
 
-                if (!smbios_fields[i]) {
-                        /* If some SMBIOS field is missing, don't generate the CHID, as per spec */
-                        memzero(ret_chid, sizeof(EFI_GUID));
-                        return;
-                }
-
                 if (i > 0)
-                        sha1_process_bytes(L"&", 2, &ctx);
+                        buf = mempcpy(buf, L"&", sizeof(char16_t));
 
-                sha1_process_bytes(smbios_fields[i], strlen16(smbios_fields[i]) * sizeof(char16_t), &ctx);
+                buf = mempcpy(buf, smbios_fields[i], strlen16(smbios_fields[i]) * sizeof(char16_t));
         }
+}
 
-        uint8_t hash[SHA1_DIGEST_SIZE];
-        sha1_finish_ctx(&ctx, hash);
+static void chid_from_hash(const uint8_t hash[static SHA1_DIGEST_SIZE], EFI_GUID *ret_chid) {
+        assert(ret_chid);
 
-        assert_cc(sizeof(hash) >= sizeof(*ret_chid));
+        assert_cc(SHA1_DIGEST_SIZE >= sizeof(*ret_chid));
         memcpy(ret_chid, hash, sizeof(*ret_chid));
 
         /* Convert the resulting CHID back to little-endian: */
@@ -161,17 +177,43 @@ const uint32_t chid_smbios_table[CHID_TYPES_MAX] = {
 };
 
 void chid_calculate(const char16_t *const smbios_fields[static _CHID_SMBIOS_FIELDS_MAX], EFI_GUID ret_chids[static CHID_TYPES_MAX]) {
+        const uint8_t *messages[CHID_TYPES_MAX];
+        size_t sizes[CHID_TYPES_MAX], n_blocks[CHID_TYPES_MAX], types[CHID_TYPES_MAX], n = 0, total = 0;
+
         assert(smbios_fields);
         assert(ret_chids);
 
         for (size_t i = 0; i < CHID_TYPES_MAX; i++) {
-                if (chid_smbios_table[i] == 0) {
-                        memzero(&ret_chids[i], sizeof(EFI_GUID));
+                memzero(&ret_chids[i], sizeof(EFI_GUID));
+
+                if (chid_smbios_table[i] == 0)
                         continue;
-                }
 
-                get_chid(smbios_fields, chid_smbios_table[i], &ret_chids[i]);
+                sizes[n] = chid_message_size(smbios_fields, chid_smbios_table[i]);
+                if (sizes[n] == 0)
+                        continue;
+
+                types[n] = i;
+                total += SHA1_PADDED_SIZE(sizes[n]);
+                n++;
+        }
+
+        /* The messages are only one or two SHA1 blocks each, hash them all in one batch rather than one by
+         * one. */
+        _cleanup_free_ uint8_t *buf = xmalloc_scratch(total);
+        uint8_t *p = buf;
+        for (size_t k = 0; k < n; k++) {
+                chid_message_write(smbios_fields, chid_smbios_table[types[k]], p);
+                n_blocks[k] = sha1_pad(p, sizes[k]);
+                messages[k] = p;
+                p += SHA1_PADDED_SIZE(sizes[k]);
         }
+
+        uint8_t hashes[CHID_TYPES_MAX][SHA1_DIGEST_SIZE];
+        sha1_batch(messages, n_blocks, n, hashes);
+
+        for (size_t k = 0; k < n; k++)
+                chid_from_hash(hashes[k], &ret_chids[types[k]]);
 }
 
 /* Validate the descriptor macros a bit that they match our expectations */
@@ -188,7 +230,7 @@ assert_cc(DEVICE_TYPE_FROM_DESCRIPTOR(DEVICE_DESCRIPTOR_UEFI_FW) == DEVICE_TYPE_
 static char16_t *smbios_to_hashable_string(const char *str) {
         if (!str)
                 /* User of this function is expected to free the result. */
-                return xnew0(char16_t, 1);
+                return strn8_to_16(xnew_scratch(char16_t, 1), "", 0);
 
         /*
          * We need to strip leading and trailing spaces, leading zeroes.
@@ -205,10 +247,10 @@ static char16_t *smbios_to_hashable_string(const char *str) {
         while (len > 0 && str[len - 1] == ' ')
                 len--;
 
-        return xstrn8_to_16(str, len);
+        return strn8_to_16(xnew_scratch(char16_t, len + 1), str, len);
 }
 
-/* This has to be in a struct due to _cleanup_ in populate_board_chids */
+/* This has to be in a struct due to _cleanup_ in chid_populate_board */
 typedef struct SmbiosInfo {
         char16_t *smbios_fields[_CHID_SMBIOS_FIELDS_MAX];
 } SmbiosInfo;
@@ -234,7 +276,9 @@ static void smbios_info_done(SmbiosInfo *info) {
                 free(*i);
 }
 
-static EFI_STATUS populate_board_chids(EFI_GUID ret_chids[static CHID_TYPES_MAX]) {
+EFI_STATUS chid_populate_board(EFI_GUID ret_chids[static CHID_TYPES_MAX]) {
+        /* The hashable strings are only needed until the CHIDs are calculated, drop them all at once. */
+        ARENA_SCOPE();
         _cleanup_(smbios_info_done) SmbiosInfo info = {};
 
         if (!ret_chids)
@@ -246,7 +290,56 @@ static EFI_STATUS populate_board_chids(EFI_GUID ret_chids[static CHID_TYPES_MAX]
         return EFI_SUCCESS;
 }
 
-EFI_STATUS chid_match(const void *hwid_buffer, size_t hwid_length, uint32_t match_type, const Device **ret_device) {
+static int device_chid_compare(const Device *device, const EFI_GUID *chid) {
+        /* Can't take a pointer to a packed struct member, hence compare the bytes */
+        return memcmp((const uint8_t *) device + offsetof(Device, chid), chid, sizeof(EFI_GUID));
+}
+
+static const Device *devices_find(
+                const Device *devices,
+                size_t n_devices,
+                bool sorted,
+                uint32_t match_type,
+                const EFI_GUID *chid) {
+
+        size_t first = 0;
+
+        assert(devices);
+        assert(chid);
+
+        if (sorted) {
+                /* Find the first entry with this CHID, then only look at those with the same one */
+                size_t hi = n_devices;
+                while (first < hi) {
+                        size_t mid = first + (hi - first) / 2;
+                        if (device_chid_compare(devices + mid, chid) < 0)
+                                first = mid + 1;
+                        else
+                                hi = mid;
+                }
+        }
+
+        const Device *candidates = devices + first;
+        FOREACH_ARRAY(dev, candidates, n_devices - first) {
+                if (device_chid_compare(dev, chid) != 0) {
+                        if (sorted)
+                                break;
+                        continue;
+                }
+                if (DEVICE_TYPE_FROM_DESCRIPTOR(dev->descriptor) == match_type)
+                        return dev;
+        }
+
+        return NULL;
+}
+
+EFI_STATUS chid_match(
+                const void *hwid_buffer,
+                size_t hwid_length,
+                uint32_t match_type,
+                const Device **ret_device,
+                size_t *ret_chid_type) {
+
         EFI_STATUS status;
 
         if ((uintptr_t) hwid_buffer % alignof(Device) != 0)
@@ -258,13 +351,15 @@ EFI_STATUS chid_match(const void *hwid_buffer, size_t hwid_length, uint32_t matc
         static const size_t priority[] = { EXTRA_CHID_BASE + 2, EXTRA_CHID_BASE + 1, EXTRA_CHID_BASE + 0,
                                            3, 6, 8, 10, 4, 5, 7, 9 }; /* From most to least specific. */
 
-        status = populate_board_chids(chids);
+        status = chid_populate_board(chids);
         if (EFI_STATUS_IS_ERROR(status))
                 return log_error_status(status, "Failed to populate board CHIDs: %m");
 
         size_t n_devices = 0;
+        bool sorted = true;
 
-        /* Count devices and check validity */
+        /* Count devices and check validity. Tables built by hwids/hwid2section.py are sorted by CHID, which
+         * we notice on the way, so that they can be binary searched below. */
         for (; (n_devices + 1) * sizeof(*devices) < hwid_length;) {
 
                 if (devices[n_devices].descriptor == DEVICE_DESCRIPTOR_EOL)
@@ -272,23 +367,26 @@ EFI_STATUS chid_match(const void *hwid_buffer, size_t hwid_length, uint32_t matc
                 if (!IN_SET(DEVICE_TYPE_FROM_DESCRIPTOR(devices[n_devices].descriptor),
                             DEVICE_TYPE_UEFI_FW, DEVICE_TYPE_DEVICETREE))
                         return EFI_UNSUPPORTED;
+                if (sorted && n_devices > 0) {
+                        EFI_GUID chid = devices[n_devices].chid;
+                        sorted = device_chid_compare(devices + n_devices - 1, &chid) <= 0;
+                }
                 n_devices++;
         }
 
         if (n_devices == 0)
                 return EFI_NOT_FOUND;
 
-        FOREACH_ELEMENT(i, priority)
-                FOREACH_ARRAY(dev, devices, n_devices) {
-                        /* Can't take a pointer to a packed struct member, so copy to a local variable */
-                        EFI_GUID chid = dev->chid;
-                        if (DEVICE_TYPE_FROM_DESCRIPTOR(dev->descriptor) != match_type)
-                                continue;
-                        if (efi_guid_equal(&chids[*i], &chid)) {
-                                *ret_device = dev;
-                                return EFI_SUCCESS;
-                        }
-                }
+        FOREACH_ELEMENT(i, priority) {
+                const Device *dev = devices_find(devices, n_devices, sorted, match_type, &chids[*i]);
+                if (!dev)
+                        continue;
+
+                *ret_device = dev;
+                if (ret_chid_type)
+                        *ret_chid_type = *i;
+                return EFI_SUCCESS;
+        }
 
         return EFI_NOT_FOUND;
 }
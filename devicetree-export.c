@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "chid.h"
+#include "devicetree-export.h"
+#include "efi-log.h"
+#include "efi-efivars.h"
+#include "util.h"
+#include "proto/dt-fixup.h"
+
+static struct {
+        bool recorded;
+        DevicetreeMatchSource source;
+        size_t section_nb;
+        size_t chid_type;
+        char *device;
+} match;
+
+static const char *const origin_table[_DEVICETREE_ORIGIN_MAX] = {
+        [DEVICETREE_ORIGIN_NONE]     = "none",
+        [DEVICETREE_ORIGIN_FIRMWARE] = "firmware",
+        [DEVICETREE_ORIGIN_DTB]      = "dtb",
+        [DEVICETREE_ORIGIN_DTBAUTO]  = "dtbauto",
+        [DEVICETREE_ORIGIN_SIDECAR]  = "sidecar",
+};
+
+void devicetree_export_record_match(const DevicetreeMatchContext *dt_match, size_t section_nb) {
+        assert(dt_match);
+
+        /* The device name lives in the .hwids table, which may be gone by the time we export, e.g. for a
+         * sidecar. Hence copy it. */
+        free(match.device);
+        match.device = NULL;
+        if (dt_match->source == DEVICETREE_MATCH_HWID) {
+                const char *name = device_get_name(dt_match->hwids, dt_match->device);
+                if (name)
+                        match.device = xstrdup8(name);
+        }
+
+        match.recorded = true;
+        match.source = dt_match->source;
+        match.section_nb = section_nb;
+        match.chid_type = dt_match->chid_type;
+}
+
+void devicetree_export(DevicetreeOrigin origin) {
+        assert(origin >= 0 && origin < _DEVICETREE_ORIGIN_MAX);
+
+        /* The match only describes the installed DT if it was picked from a .dtbauto section */
+        bool matched = match.recorded && IN_SET(origin, DEVICETREE_ORIGIN_DTBAUTO, DEVICETREE_ORIGIN_SIDECAR);
+
+        const void *dtb = origin != DEVICETREE_ORIGIN_NONE ? find_configuration_table(MAKE_GUID_PTR(EFI_DTB_TABLE)) : NULL;
+        const char *compatible = dtb ? devicetree_get_compatible(dtb) : NULL;
+
+        _cleanup_free_ char16_t *s = xasprintf("devicetree=%s\n", origin_table[origin]);
+        if (compatible) {
+                _cleanup_free_ char16_t *old = TAKE_PTR(s);
+                s = xasprintf("%lscompatible=%s\n", old, compatible);
+        }
+        if (matched) {
+                _cleanup_free_ char16_t *old = TAKE_PTR(s);
+                s = xasprintf("%lssection=%zu\nmatch=%s\n",
+                              old, match.section_nb, match.source == DEVICETREE_MATCH_HWID ? "hwid" : "firmware");
+        }
+        if (matched && match.source == DEVICETREE_MATCH_HWID) {
+                _cleanup_free_ char16_t *old = TAKE_PTR(s);
+                s = xasprintf("%lschid_type=%zu\n", old, match.chid_type);
+        }
+        if (matched && match.device) {
+                _cleanup_free_ char16_t *old = TAKE_PTR(s);
+                s = xasprintf("%lsdevice=%s\n", old, match.device);
+        }
+
+        EFI_STATUS err = efivar_set_str16(MAKE_GUID_PTR(LOADER), u"StubbleDevicetreeMatch", s, 0);
+        if (err != EFI_SUCCESS)
+                log_warning_status(err, "Failed to export devicetree match, ignoring: %m");
+}
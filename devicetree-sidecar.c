@@ -0,0 +1,274 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "chid.h"
+#include "devicetree-export.h"
+#include "devicetree-sidecar.h"
+#include "efi-log.h"
+#include "measure.h"
+#include "pe.h"
+#include "secure-boot.h"
+#include "tpm2-pcr.h"
+#include "util.h"
+
+/* The compatible property of the root node follows a handful of small properties at the very beginning of
+ * the structure block, so reading this much of it is nearly always enough. If not, the whole block is
+ * read. */
+#define STRUCT_PREFIX_SIZE (4U * 1024U)
+
+/* Refuse DTs larger than this, we'd have to read all of it after all */
+#define DT_SIZE_MAX (64U * 1024U * 1024U)
+
+char16_t *dtb_sidecar_path = NULL;
+
+static EFI_STATUS file_read_at(EFI_FILE *handle, uint64_t offset, size_t size, void *buf) {
+        EFI_STATUS err;
+
+        assert(handle);
+        assert(buf || size == 0);
+
+        err = handle->SetPosition(handle, offset);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        /* Ask for everything at once so that the firmware can issue reads as large as it likes, but cope
+         * with short reads. */
+        for (uint8_t *p = buf; size > 0;) {
+                size_t n = size;
+
+                err = handle->Read(handle, &n, p);
+                if (err != EFI_SUCCESS)
+                        return err;
+                if (n == 0)
+                        return EFI_END_OF_FILE;
+
+                p += n;
+                size -= n;
+        }
+
+        return EFI_SUCCESS;
+}
+
+static EFI_STATUS sidecar_score_dtb(
+                EFI_FILE *handle,
+                const PeSectionVector *section,
+                const DevicetreeMatchContext *ctx,
+                uint32_t *ret_score,
+                size_t *ret_dt_size) {
+
+        EFI_STATUS err;
+        FdtHeader dt_header;
+
+        assert(handle);
+        assert(section);
+        assert(ctx);
+        assert(ret_score);
+        assert(ret_dt_size);
+
+        if (section->file_size < sizeof(dt_header))
+                return EFI_INVALID_PARAMETER;
+
+        err = file_read_at(handle, section->file_offset, sizeof(dt_header), &dt_header);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        if (be32toh(dt_header.magic) != FDT_MAGIC)
+                return EFI_INVALID_PARAMETER;
+
+        uint32_t dt_size = be32toh(dt_header.total_size);
+        uint32_t struct_off = be32toh(dt_header.off_dt_struct);
+        uint32_t struct_size = be32toh(dt_header.size_dt_struct);
+        uint32_t strings_off = be32toh(dt_header.off_dt_strings);
+        uint32_t strings_size = be32toh(dt_header.size_dt_strings);
+        uint32_t end;
+
+        if (dt_size < sizeof(dt_header) || dt_size > section->file_size || dt_size > DT_SIZE_MAX)
+                return EFI_INVALID_PARAMETER;
+
+        if (!ADD_SAFE(&end, strings_off, strings_size) || end > dt_size)
+                return EFI_INVALID_PARAMETER;
+
+        if (struct_off % sizeof(uint32_t) != 0 ||
+            !ADD_SAFE(&end, struct_off, struct_size) ||
+            end > strings_off)
+                return EFI_INVALID_PARAMETER;
+
+        _cleanup_free_ char *strings = xmalloc(strings_size);
+        err = file_read_at(handle, section->file_offset + strings_off, strings_size, strings);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        size_t struct_read = MIN(struct_size, STRUCT_PREFIX_SIZE);
+        _cleanup_free_ void *structure = xmalloc(struct_read);
+        err = file_read_at(handle, section->file_offset + struct_off, struct_read, structure);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        size_t compat_size;
+        const char *compat = devicetree_find_compatible(structure, struct_read, strings, strings_size, &compat_size);
+        if (!compat && struct_read < struct_size) {
+                free(structure);
+                struct_read = struct_size;
+                structure = xmalloc(struct_read);
+
+                err = file_read_at(handle, section->file_offset + struct_off, struct_read, structure);
+                if (err != EFI_SUCCESS)
+                        return err;
+
+                compat = devicetree_find_compatible(structure, struct_read, strings, strings_size, &compat_size);
+        }
+        if (!compat)
+                return EFI_INVALID_PARAMETER;
+
+        err = devicetree_match_score_compatible(ctx, compat, compat_size, ret_score);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        *ret_dt_size = dt_size;
+        return EFI_SUCCESS;
+}
+
+EFI_STATUS devicetree_sidecar_install(
+                EFI_LOADED_IMAGE_PROTOCOL *loaded_image,
+                const char16_t *path,
+                const void *hwids,
+                size_t hwids_size,
+                struct devicetree_state *state) {
+
+        EFI_STATUS err;
+
+        assert(loaded_image);
+        assert(path);
+        assert(hwids || hwids_size == 0);
+        assert(state);
+
+        /* Unlike the UKI itself nothing vouches for the sidecar, so don't let it undermine Secure Boot. */
+        if (secure_boot_enabled())
+                return log_error_status(
+                                EFI_SECURITY_VIOLATION,
+                                "Secure Boot is enabled, refusing to load devicetree from unverified sidecar %ls.",
+                                path);
+
+        DevicetreeMatchContext dt_match;
+        devicetree_match_context_init(&dt_match);
+
+        _cleanup_file_close_ EFI_FILE *root = NULL, *handle = NULL;
+        err = open_volume(loaded_image->DeviceHandle, &root);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Unable to open root directory: %m");
+
+        err = root->Open(root, &handle, (char16_t *) path, EFI_FILE_MODE_READ, 0);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Unable to open devicetree sidecar %ls: %m", path);
+
+        _cleanup_free_ PeSectionHeader *section_table = NULL;
+        size_t n_section_table;
+        err = pe_section_table_from_file(handle, &section_table, &n_section_table);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Unable to read section table of %ls: %m", path);
+
+        /* The sidecar may bring its own .hwids, so that new devices can be added without touching the UKI */
+        _cleanup_free_ void *sidecar_hwids = NULL;
+        if (!dt_match.fw_dtb) {
+                static const char *const hwid_section_names[] = { ".hwids", NULL };
+                PeSectionVector hwids_section[1] = {};
+
+                pe_locate_sections(
+                                section_table,
+                                n_section_table,
+                                hwid_section_names,
+                                /* validate_base= */ 0,
+                                hwids_section);
+
+                if (PE_SECTION_VECTOR_IS_SET(hwids_section) && hwids_section[0].file_size > 0) {
+                        sidecar_hwids = xmalloc(hwids_section[0].file_size);
+                        err = file_read_at(
+                                        handle,
+                                        hwids_section[0].file_offset,
+                                        hwids_section[0].file_size,
+                                        sidecar_hwids);
+                        if (err != EFI_SUCCESS)
+                                return log_error_status(err, "Unable to read .hwids section of %ls: %m", path);
+
+                        hwids = sidecar_hwids;
+                        hwids_size = hwids_section[0].file_size;
+                }
+
+                if (hwids) {
+                        const Device *device = NULL;
+                        size_t chid_type = SIZE_MAX;
+
+                        err = chid_match(hwids, hwids_size, DEVICE_TYPE_DEVICETREE, &device, &chid_type);
+                        if (err != EFI_SUCCESS)
+                                log_debug("No HWID match for devicetree sidecar %ls: %m", path);
+                        else
+                                devicetree_match_context_set_device(&dt_match, hwids, device, chid_type);
+                }
+        }
+
+        if (dt_match.source == DEVICETREE_MATCH_NONE)
+                return EFI_NOT_FOUND;
+
+        const PeSectionHeader *best = NULL;
+        PeSectionVector best_section = {};
+        uint32_t best_score = 0;
+        size_t best_dt_size = 0;
+
+        FOREACH_ARRAY(h, section_table, n_section_table) {
+                PeSectionVector section;
+                uint32_t score;
+                size_t dt_size;
+
+                if (!pe_section_name_equal((const char *) h->Name, ".dtbauto") ||
+                    !pe_section_vector_from_header(h, /* validate_base= */ 0, &section))
+                        continue;
+
+                err = sidecar_score_dtb(handle, &section, &dt_match, &score, &dt_size);
+                if (err == EFI_INVALID_PARAMETER)
+                        log_error_status(err, "Found bad DT blob in PE section %zu of %ls", (size_t) (h - section_table), path);
+                else if (err != EFI_SUCCESS && err != EFI_NOT_FOUND)
+                        log_error_status(err, "Unable to read PE section %zu of %ls: %m", (size_t) (h - section_table), path);
+                if (err != EFI_SUCCESS)
+                        continue;
+
+                /* Same as for embedded .dtbauto sections: the best score wins, the earlier one on a tie */
+                if (best && score <= best_score)
+                        continue;
+
+                best = h;
+                best_section = section;
+                best_score = score;
+                best_dt_size = dt_size;
+        }
+
+        if (!best)
+                return EFI_NOT_FOUND;
+
+        /* Only now read the DT we picked, in one go and into page aligned memory */
+        _cleanup_pages_ Pages dtb_pages = xmalloc_pages(
+                        AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(best_dt_size), 0);
+        void *dtb = PHYSICAL_ADDRESS_TO_POINTER(dtb_pages.addr);
+
+        err = file_read_at(handle, best_section.file_offset, best_dt_size, dtb);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Unable to read devicetree from %ls: %m", path);
+
+        log_debug("found device-tree in PE section %zu of sidecar %ls: %s (score 0x%x)",
+                  (size_t) (best - section_table), path, devicetree_get_compatible(dtb), best_score);
+
+        /* The DT comes from outside the signed UKI, hence make it show up in the measurements */
+        bool measured;
+        (void) tpm_log_tagged_event(
+                        TPM2_PCR_KERNEL_CONFIG,
+                        POINTER_TO_PHYSICAL_ADDRESS(dtb),
+                        best_dt_size,
+                        DEVICETREE_ADDON_EVENT_TAG_ID,
+                        path,
+                        &measured);
+
+        err = devicetree_install_from_memory(state, dtb, best_dt_size);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Error loading devicetree from sidecar %ls: %m", path);
+
+        devicetree_export_record_match(&dt_match, best - section_table);
+        return EFI_SUCCESS;
+}
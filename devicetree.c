@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
 #include "devicetree.h"
+#include "pe.h"
 #include "proto/dt-fixup.h"
 #include "util.h"
 
@@ -62,45 +63,28 @@ static EFI_STATUS devicetree_fixup(struct devicetree_state *state, size_t len) {
         return err;
 }
 
-const char* devicetree_get_compatible(const void *dtb) {
-        if ((uintptr_t) dtb % alignof(FdtHeader) != 0)
-                return NULL;
-
-        const FdtHeader *dt_header = ASSERT_PTR(dtb);
-
-        if (be32toh(dt_header->magic) != UINT32_C(0xd00dfeed))
-                return NULL;
-
-        uint32_t dt_size = be32toh(dt_header->total_size);
-        uint32_t struct_off = be32toh(dt_header->off_dt_struct);
-        uint32_t struct_size = be32toh(dt_header->size_dt_struct);
-        uint32_t strings_off = be32toh(dt_header->off_dt_strings);
-        uint32_t strings_size = be32toh(dt_header->size_dt_strings);
-        uint32_t end;
-
-        if (PTR_TO_SIZE(dtb) > SIZE_MAX - dt_size)
-                return NULL;
-
-        if (!ADD_SAFE(&end, strings_off, strings_size) || end > dt_size)
-                return NULL;
-        const char *strings_block = (const char *) ((const uint8_t *) dt_header + strings_off);
+const char* devicetree_find_compatible(
+                const void *struct_block,
+                size_t struct_size,
+                const char *strings_block,
+                size_t strings_size,
+                size_t *ret_size) {
 
-        if (struct_off % sizeof(uint32_t) != 0)
-                return NULL;
+        assert(struct_block || struct_size == 0);
+        assert(strings_block || strings_size == 0);
+        assert(ret_size);
 
-        if (struct_size % sizeof(uint32_t) != 0 ||
-            !ADD_SAFE(&end, struct_off, struct_size) ||
-            end > strings_off)
+        if ((uintptr_t) struct_block % sizeof(uint32_t) != 0 || struct_size % sizeof(uint32_t) != 0)
                 return NULL;
-        const uint32_t *cursor = (const uint32_t *) ((const uint8_t *) dt_header + struct_off);
 
+        const uint32_t *cursor = struct_block;
         size_t size_words = struct_size / sizeof(uint32_t);
         size_t len, name_off, len_words, s;
 
-        for (size_t i = 0; i < end; i++) {
+        for (size_t i = 0; i < size_words; i++) {
                 switch (be32toh(cursor[i])) {
                 case FDT_BEGIN_NODE:
-                        if (i >= size_words || cursor[++i] != 0)
+                        if (i + 1 >= size_words || cursor[++i] != 0)
                                 return NULL;
                         break;
                 case FDT_NOP:
@@ -117,8 +101,9 @@ const char* devicetree_get_compatible(const void *dtb) {
                             s < strings_size && streq8(strings_block + name_off, "compatible")) {
                                 const char *c = (const char *) &cursor[++i];
                                 if (len == 0 || i + len_words > size_words || c[len - 1] != '\0')
-                                        c = NULL;
+                                        return NULL;
 
+                                *ret_size = len;
                                 return c;
                         }
                         i += len_words;
@@ -131,41 +116,150 @@ const char* devicetree_get_compatible(const void *dtb) {
         return NULL;
 }
 
-bool firmware_devicetree_exists(void) {
-        return !!find_configuration_table(MAKE_GUID_PTR(EFI_DTB_TABLE));
+const char* devicetree_get_compatible_list(const void *dtb, size_t *ret_size) {
+        assert(ret_size);
+
+        if ((uintptr_t) dtb % alignof(FdtHeader) != 0)
+                return NULL;
+
+        const FdtHeader *dt_header = ASSERT_PTR(dtb);
+
+        if (be32toh(dt_header->magic) != FDT_MAGIC)
+                return NULL;
+
+        uint32_t dt_size = be32toh(dt_header->total_size);
+        uint32_t struct_off = be32toh(dt_header->off_dt_struct);
+        uint32_t struct_size = be32toh(dt_header->size_dt_struct);
+        uint32_t strings_off = be32toh(dt_header->off_dt_strings);
+        uint32_t strings_size = be32toh(dt_header->size_dt_strings);
+        uint32_t end;
+
+        if (PTR_TO_SIZE(dtb) > SIZE_MAX - dt_size)
+                return NULL;
+
+        if (!ADD_SAFE(&end, strings_off, strings_size) || end > dt_size)
+                return NULL;
+
+        if (!ADD_SAFE(&end, struct_off, struct_size) || end > strings_off)
+                return NULL;
+
+        return devicetree_find_compatible(
+                        (const uint8_t *) dt_header + struct_off,
+                        struct_size,
+                        (const char *) dt_header + strings_off,
+                        strings_size,
+                        ret_size);
+}
+
+const char* devicetree_get_compatible(const void *dtb) {
+        size_t size;
+        return devicetree_get_compatible_list(dtb, &size);
 }
 
-/* This function checks if the firmware provided DeviceTree
- * and a UKI provided DeviceTree contain the same first entry
- * on their respective "compatible" fields (which usually defines
- * the actual device model). More specifically, given the FW/UKI
- * "compatible" property pair:
- *
- *      compatible = "string1", "string2";
- *      compatible = "string1", "string3";
- *
- * the function reports a match, while for
- *
- *      compatible = "string1", "string3";
- *      compatible = "string2", "string1";
- *
- * it reports a mismatch.
- *
- * Other entries might refer to SoC and therefore can't be used for matching
- */
-EFI_STATUS devicetree_match(const void *uki_dtb, size_t uki_dtb_length) {
-        const void *fw_dtb = find_configuration_table(MAKE_GUID_PTR(EFI_DTB_TABLE));
-        if (!fw_dtb)
-                return EFI_UNSUPPORTED;
+/* Returns the position of 'needle' in the NUL-separated string list 'list', or SIZE_MAX if not found. */
+static size_t compatible_list_find(const char *list, size_t list_size, const char *needle) {
+        size_t index = 0;
+
+        assert(list || list_size == 0);
+        assert(needle);
+
+        for (const char *p = list, *end = list + list_size; p < end; index++) {
+                size_t len = strnlen8(p, end - p);
+                if (strneq8(p, needle, len) && needle[len] == '\0')
+                        return index;
+                p += len + 1;
+        }
+
+        return SIZE_MAX;
+}
+
+void devicetree_match_context_init(DevicetreeMatchContext *ctx) {
+        assert(ctx);
+
+        *ctx = (DevicetreeMatchContext) {
+                .fw_dtb = find_configuration_table(MAKE_GUID_PTR(EFI_DTB_TABLE)),
+                .chid_type = SIZE_MAX,
+        };
+
+        /* A firmware provided DT is only ever replaced by one for the same device, and only if we are
+         * allowed to override it at all. */
+        if (!ctx->fw_dtb || !dtb_override)
+                return;
+
+        ctx->compatible = devicetree_get_compatible_list(ctx->fw_dtb, &ctx->compatible_size);
+        if (ctx->compatible)
+                ctx->source = DEVICETREE_MATCH_FIRMWARE;
+}
+
+void devicetree_match_context_set_device(
+                DevicetreeMatchContext *ctx,
+                const void *hwids,
+                const Device *device,
+                size_t chid_type) {
+
+        assert(ctx);
+        assert(hwids);
+        assert(device);
 
-        const char *fw_compat = devicetree_get_compatible(fw_dtb);
-        if (!fw_compat)
+        /* HWIDs are only consulted if the firmware didn't provide a DT at all */
+        if (ctx->fw_dtb)
+                return;
+
+        const char *compatible = device_get_compatible(hwids, device);
+        if (!compatible)
+                return;
+
+        ctx->hwids = hwids;
+        ctx->device = device;
+        ctx->chid_type = chid_type;
+        ctx->compatible = compatible;
+        ctx->compatible_size = strsize8(compatible);
+        ctx->source = DEVICETREE_MATCH_HWID;
+}
+
+/* The first entry of a DT's "compatible" property names the device model, later entries get less specific
+ * and usually end with the SoC. A candidate DT is only considered if its model appears in the list we match
+ * against, since two boards sharing an SoC can't use each other's DT. Among those we prefer candidates whose
+ * model comes earlier in the list, i.e. is more specific, and then those sharing more entries with it. */
+EFI_STATUS devicetree_match_score_compatible(
+                const DevicetreeMatchContext *ctx,
+                const char *dt_compat,
+                size_t dt_compat_size,
+                uint32_t *ret_score) {
+
+        assert(ctx);
+        assert(dt_compat);
+        assert(ret_score);
+
+        if (ctx->source == DEVICETREE_MATCH_NONE)
                 return EFI_UNSUPPORTED;
 
-        return devicetree_match_by_compatible(uki_dtb, uki_dtb_length, fw_compat);
+        size_t model = compatible_list_find(ctx->compatible, ctx->compatible_size, dt_compat);
+        if (model == SIZE_MAX)
+                return EFI_NOT_FOUND;
+
+        size_t shared = 0;
+        for (const char *p = dt_compat, *end = dt_compat + dt_compat_size; p < end; p += strnlen8(p, end - p) + 1)
+                if (compatible_list_find(ctx->compatible, ctx->compatible_size, p) != SIZE_MAX)
+                        shared++;
+
+        *ret_score = ((uint32_t) (UINT16_MAX - MIN(model, (size_t) UINT16_MAX)) << 16) |
+                (uint32_t) MIN(shared, (size_t) UINT16_MAX);
+        return EFI_SUCCESS;
 }
 
-EFI_STATUS devicetree_match_by_compatible(const void *uki_dtb, size_t uki_dtb_length, const char *compat) {
+EFI_STATUS devicetree_match_score(
+                const DevicetreeMatchContext *ctx,
+                const void *uki_dtb,
+                size_t uki_dtb_length,
+                uint32_t *ret_score) {
+
+        assert(ctx);
+        assert(ret_score);
+
+        if (ctx->source == DEVICETREE_MATCH_NONE)
+                return EFI_UNSUPPORTED;
+
         if ((uintptr_t) uki_dtb % alignof(FdtHeader) != 0)
                 return EFI_INVALID_PARAMETER;
 
@@ -175,15 +269,12 @@ EFI_STATUS devicetree_match_by_compatible(const void *uki_dtb, size_t uki_dtb_le
             uki_dtb_length < be32toh(dt_header->total_size))
                 return EFI_INVALID_PARAMETER;
 
-        if (!compat)
-                return EFI_INVALID_PARAMETER;
-
-        const char *dt_compat = devicetree_get_compatible(uki_dtb);
+        size_t dt_compat_size;
+        const char *dt_compat = devicetree_get_compatible_list(uki_dtb, &dt_compat_size);
         if (!dt_compat)
                 return EFI_INVALID_PARAMETER;
 
-        /* Only matches the first compatible string from each DT */
-        return streq8(dt_compat, compat) ? EFI_SUCCESS : EFI_NOT_FOUND;
+        return devicetree_match_score_compatible(ctx, dt_compat, dt_compat_size, ret_score);
 }
 
 EFI_STATUS devicetree_install_from_memory(
@@ -209,7 +300,7 @@ EFI_STATUS devicetree_install_from_memory(
         if (err != EFI_SUCCESS)
                 return err;
 
-        return BS->InstallConfigurationTable(
+        return install_configuration_table(
                         MAKE_GUID_PTR(EFI_DTB_TABLE), PHYSICAL_ADDRESS_TO_POINTER(state->addr));
 }
 
@@ -219,7 +310,7 @@ void devicetree_cleanup(struct devicetree_state *state) {
         if (!state->pages)
                 return;
 
-        err = BS->InstallConfigurationTable(MAKE_GUID_PTR(EFI_DTB_TABLE), state->orig);
+        err = install_configuration_table(MAKE_GUID_PTR(EFI_DTB_TABLE), state->orig);
         /* don't free the current device tree if we can't reinstate the old one */
         if (err != EFI_SUCCESS)
                 return;
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "dtbidx.h"
+#include "util.h"
+
+typedef struct DtbIndex {
+        const DtbIndexGroup *groups;
+        size_t n_groups;
+        const DtbIndexEntry *entries;
+        size_t n_entries;
+        const char *strings;
+        size_t strings_size;
+} DtbIndex;
+
+static bool dtbidx_string_valid(const DtbIndex *idx, uint32_t offset, uint32_t size) {
+        assert(idx);
+
+        /* Non-empty, within the strings and NUL-terminated */
+        return size > 0 && offset < idx->strings_size && size <= idx->strings_size - offset &&
+                idx->strings[offset + size - 1] == '\0';
+}
+
+static EFI_STATUS dtbidx_parse(const uint8_t *index, size_t index_size, DtbIndex *ret) {
+        assert(index);
+        assert(ret);
+
+        const DtbIndexHeader *h = (const DtbIndexHeader *) index;
+        if (index_size < sizeof(DtbIndexHeader) || h->magic != DTBIDX_MAGIC)
+                return EFI_INVALID_PARAMETER;
+
+        /* In 64 bits, which can't overflow with 32-bit counts. Once it is within index_size so is everything
+         * computed from it below. */
+        uint64_t tables_end = (uint64_t) h->header_size +
+                (uint64_t) h->n_groups * sizeof(DtbIndexGroup) +
+                (uint64_t) h->n_entries * sizeof(DtbIndexEntry);
+        if (h->header_size < sizeof(DtbIndexHeader) || tables_end > index_size ||
+            h->strings_offset > index_size || h->strings_size > index_size - h->strings_offset)
+                return EFI_INVALID_PARAMETER;
+
+        DtbIndex idx = {
+                .groups = (const DtbIndexGroup *) (index + h->header_size),
+                .n_groups = h->n_groups,
+                .entries = (const DtbIndexEntry *) (index + h->header_size + h->n_groups * sizeof(DtbIndexGroup)),
+                .n_entries = h->n_entries,
+                .strings = (const char *) index + h->strings_offset,
+                .strings_size = h->strings_size,
+        };
+
+        /* Check everything once here, rather than on every access. The groups have to cover every entry
+         * exactly once, in order, or some would never be scored. */
+        size_t covered = 0;
+        FOREACH_ARRAY(g, idx.groups, idx.n_groups) {
+                if (g->first_entry != covered || g->n_entries > idx.n_entries - covered ||
+                    g->soc >= idx.strings_size ||
+                    strnlen8(idx.strings + g->soc, idx.strings_size - g->soc) == idx.strings_size - g->soc)
+                        return EFI_INVALID_PARAMETER;
+                covered += g->n_entries;
+        }
+        if (covered != idx.n_entries)
+                return EFI_INVALID_PARAMETER;
+
+        FOREACH_ARRAY(e, idx.entries, idx.n_entries)
+                if (!dtbidx_string_valid(&idx, e->compatible, e->compatible_size))
+                        return EFI_INVALID_PARAMETER;
+
+        *ret = idx;
+        return EFI_SUCCESS;
+}
+
+static void dtbidx_select_group(
+                const DtbIndex *idx,
+                const DtbIndexGroup *group,
+                const DevicetreeMatchContext *dt_match,
+                const DtbIndexEntry **best,
+                uint32_t *best_score) {
+
+        assert(idx);
+        assert(group);
+        assert(dt_match);
+        assert(best);
+        assert(best_score);
+
+        const DtbIndexEntry *entries = idx->entries + group->first_entry;
+        FOREACH_ARRAY(e, entries, group->n_entries) {
+                uint32_t score;
+                if (devicetree_match_score_compatible(
+                                    dt_match,
+                                    idx->strings + e->compatible,
+                                    e->compatible_size,
+                                    &score) != EFI_SUCCESS)
+                        continue;
+
+                /* As when scanning the sections: the best score wins, the earlier section on a tie */
+                if (*best && (score < *best_score || (score == *best_score && e->dtbauto > (*best)->dtbauto)))
+                        continue;
+
+                *best = e;
+                *best_score = score;
+        }
+}
+
+EFI_STATUS dtbidx_select(
+                const void *index,
+                size_t index_size,
+                const PeSectionHeader section_table[],
+                size_t n_section_table,
+                const DevicetreeMatchContext *dt_match,
+                size_t *ret_section_nb,
+                uint32_t *ret_score) {
+
+        EFI_STATUS err;
+
+        assert(index);
+        assert(section_table || n_section_table == 0);
+        assert(dt_match);
+        assert(ret_section_nb);
+        assert(ret_score);
+
+        DtbIndex idx;
+        err = dtbidx_parse(index, index_size, &idx);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        /* The index has to describe exactly the .dtbauto sections there are, each once. An index built for
+         * other DTBs, e.g. before one was added, could miss the only match or pick a worse one, and checking
+         * the DT it picks wouldn't notice the latter. */
+        size_t n_dtbauto = 0;
+        FOREACH_ARRAY(s, section_table, n_section_table)
+                if (pe_section_name_equal((const char *) s->Name, ".dtbauto"))
+                        n_dtbauto++;
+        if (n_dtbauto != idx.n_entries)
+                return EFI_INVALID_PARAMETER;
+        if (idx.n_entries == 0)
+                return EFI_NOT_FOUND;
+
+        _cleanup_free_ bool *seen = xnew0(bool, idx.n_entries);
+        FOREACH_ARRAY(e, idx.entries, idx.n_entries) {
+                if (e->dtbauto >= idx.n_entries || seen[e->dtbauto])
+                        return EFI_INVALID_PARAMETER;
+                seen[e->dtbauto] = true;
+        }
+
+        const DtbIndexEntry *best = NULL;
+        uint32_t best_score = 0;
+
+        /* Every entry is scored, that's only string compares against the index. Skipping the groups of
+         * other SoCs could miss a board DT whose SoC entry the list we match against lacks, and a tie with an
+         * earlier section, so the result would differ from scanning all sections. */
+        FOREACH_ARRAY(g, idx.groups, idx.n_groups)
+                dtbidx_select_group(&idx, g, dt_match, &best, &best_score);
+
+        if (!best)
+                return EFI_NOT_FOUND;
+
+        /* Only the winner is mapped to its section, by counting the .dtbauto sections */
+        uint32_t n = 0;
+        FOREACH_ARRAY(s, section_table, n_section_table) {
+                if (!pe_section_name_equal((const char *) s->Name, ".dtbauto"))
+                        continue;
+
+                if (n++ == best->dtbauto) {
+                        *ret_section_nb = s - section_table;
+                        *ret_score = best_score;
+                        return EFI_SUCCESS;
+                }
+        }
+
+        return EFI_INVALID_PARAMETER;
+}
@@ -50,8 +50,9 @@ int edid_get_panel_id(const EdidHeader *edid_header, char16_t ret_panel[static 8
         return 0;
 }
 
-EFI_STATUS edid_get_discovered_panel_id(char16_t **ret_panel) {
-        assert(ret_panel);
+EFI_STATUS edid_get_discovered_blob(const void **ret_blob, size_t *ret_size) {
+        assert(ret_blob);
+        assert(ret_size);
 
         EFI_EDID_DISCOVERED_PROTOCOL *edid_discovered = NULL;
         EFI_STATUS status = BS->LocateProtocol(MAKE_GUID_PTR(EFI_EDID_DISCOVERED_PROTOCOL), NULL, (void **) &edid_discovered);
@@ -65,8 +66,22 @@ EFI_STATUS edid_get_discovered_panel_id(char16_t **ret_panel) {
         if (edid_discovered->SizeOfEdid == 0)
                 return EFI_UNSUPPORTED;
 
+        *ret_blob = edid_discovered->Edid;
+        *ret_size = edid_discovered->SizeOfEdid;
+        return EFI_SUCCESS;
+}
+
+EFI_STATUS edid_get_discovered_panel_id(char16_t **ret_panel) {
+        assert(ret_panel);
+
+        const void *blob;
+        size_t size;
+        EFI_STATUS status = edid_get_discovered_blob(&blob, &size);
+        if (EFI_STATUS_IS_ERROR(status))
+                return status;
+
         EdidHeader header;
-        if (edid_parse_blob(edid_discovered->Edid, edid_discovered->SizeOfEdid, &header) < 0)
+        if (edid_parse_blob(blob, size, &header) < 0)
                 return EFI_INCOMPATIBLE_VERSION;
 
         _cleanup_free_ char16_t *panel = xnew0(char16_t, 8);
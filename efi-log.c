@@ -7,8 +7,11 @@
 #include "util.h"
 #endif
 
+/* Messages that make log_wait() pause */
 static unsigned log_count = 0;
 bool log_isdebug = false;
+bool log_ismuted = false;
+uint64_t log_pause_usec = UINT64_MAX;
 
 void freeze(void) {
         for (;;)
@@ -35,16 +38,36 @@ void efi_assert(const char *expr, const char *file, unsigned line, const char *f
         freeze();
 }
 
-EFI_STATUS log_internal(EFI_STATUS status, uint8_t text_color, const char *format, ...) {
+EFI_STATUS log_internal(EFI_STATUS status, LogLevel level, const char *format, ...) {
+        static const uint8_t colors[] = {
+                [LOG_ERROR]   = EFI_LIGHTRED,
+                [LOG_WARNING] = EFI_YELLOW,
+                [LOG_INFO]    = EFI_WHITE,
+                [LOG_DEBUG]   = EFI_LIGHTGRAY,
+        };
+        va_list ap;
+
         assert(format);
+        assert((size_t) level < ELEMENTSOF(colors));
+
+        if (log_ismuted)
+                return status;
+
+        if (log_istrace) {
+                va_start(ap, format);
+                trace_record(status, format, ap);
+                va_end(ap);
+        }
+
+        if (level == LOG_DEBUG && !log_isdebug)
+                return status;
 
         int32_t attr = ST->ConOut->Mode->Attribute;
 
         if (ST->ConOut->Mode->CursorColumn > 0)
                 ST->ConOut->OutputString(ST->ConOut, (char16_t *) u"\r\n");
-        ST->ConOut->SetAttribute(ST->ConOut, EFI_TEXT_ATTR(text_color, EFI_BLACK));
+        ST->ConOut->SetAttribute(ST->ConOut, EFI_TEXT_ATTR(colors[level], EFI_BLACK));
 
-        va_list ap;
         va_start(ap, format);
         vprintf_status(status, format, ap);
         va_end(ap);
@@ -52,16 +75,48 @@ EFI_STATUS log_internal(EFI_STATUS status, uint8_t text_color, const char *forma
         ST->ConOut->OutputString(ST->ConOut, (char16_t *) u"\r\n");
         ST->ConOut->SetAttribute(ST->ConOut, attr);
 
-        log_count++;
+        /* Errors should be read before they scroll away with the kernel's output. Warnings are about
+         * something the stub got over, they don't hold up the boot. In debug mode everything is worth
+         * reading. */
+        if (level == LOG_ERROR || log_isdebug)
+                log_count++;
         return status;
 }
 
 void log_wait(void) {
-        if (log_count == 0)
+        EFI_STATUS err;
+
+        if (log_count == 0 || log_pause_usec == 0)
                 return;
 
-        BS->Stall(MIN(4u, log_count) * 2500 * 1000);
+        uint64_t usec = log_pause_usec != UINT64_MAX ? log_pause_usec : MIN(4u, log_count) * 2500 * 1000;
         log_count = 0;
+
+        /* Wait for the time to run out or for a key press, whichever comes first. Without a timer fall back
+         * to just waiting. */
+        EFI_EVENT timer = NULL;
+        err = BS->CreateEvent(EVT_TIMER, 0, NULL, NULL, &timer);
+        if (err == EFI_SUCCESS)
+                err = BS->SetTimer(timer, TimerRelative, usec * 10 /* 100 ns units */);
+        if (err != EFI_SUCCESS || !ST->ConIn) {
+                if (timer)
+                        (void) BS->CloseEvent(timer);
+                BS->Stall(usec);
+                return;
+        }
+
+        EFI_EVENT events[] = { timer, ST->ConIn->WaitForKey };
+        size_t index;
+        err = BS->WaitForEvent(ELEMENTSOF(events), events, &index);
+        if (err != EFI_SUCCESS)
+                BS->Stall(usec);
+        else if (index == 1) {
+                /* Don't leave the key for whoever reads the console next */
+                EFI_INPUT_KEY key;
+                (void) ST->ConIn->ReadKeyStroke(ST->ConIn, &key);
+        }
+
+        (void) BS->CloseEvent(timer);
 }
 
 _used_ intptr_t __stack_chk_guard = (intptr_t) 0x70f6967de78acae3;
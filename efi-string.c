@@ -1,8 +1,10 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include "arena.h"
 #include "efi-string.h"
 
 #include "proto/simple-text-io.h"
+#include "unaligned-fundamental.h"
 #include "util.h"
 
 /* String functions for both char and char16_t that should behave the same way as their respective
@@ -11,18 +13,40 @@
  * easier to tell in code which kind of string they work on, we use 8/16 suffixes. This also makes is easier
  * to unit test them. */
 
-#define DEFINE_STRNLEN(type, name)             \
-        size_t name(const type *s, size_t n) { \
-                if (!s)                        \
-                        return 0;              \
-                                               \
-                size_t len = 0;                \
-                while (len < n && *s) {        \
-                        s++;                   \
-                        len++;                 \
-                }                              \
-                                               \
-                return len;                    \
+/* The hot functions below go a word at a time where they can, scanning for the terminator (or another
+ * character) in all code units of a word at once. Words are only ever read from addresses aligned to their
+ * size, hence such a read never crosses into the next page and can't fault, even where it reaches past the
+ * end of the string. The code units in a word that lie before the first one found are the same for little
+ * and big endian, so this is endian agnostic, except for the widening in xstrn8_to_16(). */
+typedef uint64_t __attribute__((__may_alias__)) word_t;
+
+#define WORD_UNITS(type) (sizeof(word_t) / sizeof(type))
+#define UNIT_MASK(type) ((UINT64_C(1) << (8U * sizeof(type))) - 1U)
+/* 0x0101…01 for char, 0x0001…0001 for char16_t */
+#define WORD_ONES(type) (UINT64_MAX / UNIT_MASK(type))
+#define WORD_HIGHS(type) (WORD_ONES(type) << (8U * sizeof(type) - 1U))
+/* True if any code unit of w is 0. Exact, unlike the position of the first one it would suggest. */
+#define WORD_HAS_ZERO(w, type) ((((w) - WORD_ONES(type)) & ~(w) & WORD_HIGHS(type)) != 0)
+#define IS_WORD_ALIGNED(p) ((uintptr_t) (p) % sizeof(word_t) == 0)
+
+#define DEFINE_STRNLEN(type, name)                                                     \
+        size_t name(const type *s, size_t n) {                                         \
+                if (!s)                                                                \
+                        return 0;                                                      \
+                                                                                       \
+                size_t len = 0;                                                        \
+                while (len < n && s[len] && !IS_WORD_ALIGNED(s + len))                 \
+                        len++;                                                         \
+                                                                                       \
+                if (IS_WORD_ALIGNED(s + len))                                          \
+                        while (n - len >= WORD_UNITS(type) &&                          \
+                               !WORD_HAS_ZERO(*(const word_t *) (s + len), type))      \
+                                len += WORD_UNITS(type);                               \
+                                                                                       \
+                while (len < n && s[len])                                              \
+                        len++;                                                         \
+                                                                                       \
+                return len;                                                            \
         }
 
 DEFINE_STRNLEN(char, strnlen8);
@@ -46,26 +70,44 @@ DEFINE_STRNLEN(char16_t, strnlen16);
 DEFINE_STRTOLOWER(char, strtolower8);
 DEFINE_STRTOLOWER(char16_t, strtolower16);
 
-#define DEFINE_STRNCASECMP(type, name, tolower)              \
-        int name(const type *s1, const type *s2, size_t n) { \
-                if (!s1 || !s2)                              \
-                        return CMP(s1, s2);                  \
-                                                             \
-                while (n > 0) {                              \
-                        type c1 = *s1, c2 = *s2;             \
-                        if (tolower) {                       \
-                                c1 = TOLOWER(c1);            \
-                                c2 = TOLOWER(c2);            \
-                        }                                    \
-                        if (!c1 || c1 != c2)                 \
-                                return CMP(c1, c2);          \
-                                                             \
-                        s1++;                                \
-                        s2++;                                \
-                        n--;                                 \
-                }                                            \
-                                                             \
-                return 0;                                    \
+/* Words that are equal and free of the terminator are equal case insensitively too, so skipping those works for
+ * both. That only works if both strings can be word aligned at once, though. */
+#define DEFINE_STRNCASECMP(type, name, tolower)                                                \
+        int name(const type *s1, const type *s2, size_t n) {                                   \
+                if (!s1 || !s2)                                                                \
+                        return CMP(s1, s2);                                                    \
+                                                                                               \
+                bool words = ((uintptr_t) s1 - (uintptr_t) s2) % sizeof(word_t) == 0;          \
+                                                                                               \
+                while (n > 0) {                                                                \
+                        if (words && IS_WORD_ALIGNED(s1)) {                                    \
+                                words = false;                                                 \
+                                for (; n >= WORD_UNITS(type); n -= WORD_UNITS(type)) {         \
+                                        word_t w1 = *(const word_t *) s1;                      \
+                                        if (w1 != *(const word_t *) s2 ||                      \
+                                            WORD_HAS_ZERO(w1, type))                           \
+                                                break;                                         \
+                                        s1 += WORD_UNITS(type);                                \
+                                        s2 += WORD_UNITS(type);                                \
+                                }                                                              \
+                                if (n == 0)                                                    \
+                                        break;                                                 \
+                        }                                                                      \
+                                                                                               \
+                        type c1 = *s1, c2 = *s2;                                               \
+                        if (tolower) {                                                         \
+                                c1 = TOLOWER(c1);                                              \
+                                c2 = TOLOWER(c2);                                              \
+                        }                                                                      \
+                        if (!c1 || c1 != c2)                                                   \
+                                return CMP(c1, c2);                                            \
+                                                                                               \
+                        s1++;                                                                  \
+                        s2++;                                                                  \
+                        n--;                                                                   \
+                }                                                                              \
+                                                                                               \
+                return 0;                                                                      \
         }
 
 DEFINE_STRNCASECMP(char, strncmp8, false);
@@ -95,18 +137,27 @@ DEFINE_STRNCASECMP(char16_t, strncasecmp16, true);
 DEFINE_STRCPY(char, strcpy8);
 DEFINE_STRCPY(char16_t, strcpy16);
 
-#define DEFINE_STRCHR(type, name)                  \
-        type *name(const type *s, type c) {        \
-                if (!s)                            \
-                        return NULL;               \
-                                                   \
-                while (*s) {                       \
-                        if (*s == c)               \
-                                return (type *) s; \
-                        s++;                       \
-                }                                  \
-                                                   \
-                return c ? NULL : (type *) s;      \
+#define DEFINE_STRCHR(type, name)                                                              \
+        type *name(const type *s, type c) {                                                    \
+                if (!s)                                                                        \
+                        return NULL;                                                           \
+                                                                                               \
+                const word_t pattern = WORD_ONES(type) * ((word_t) c & UNIT_MASK(type));      \
+                                                                                               \
+                for (;; s++) {                                                                 \
+                        if (IS_WORD_ALIGNED(s))                                                \
+                                for (;; s += WORD_UNITS(type)) {                               \
+                                        word_t w = *(const word_t *) s;                        \
+                                        if (WORD_HAS_ZERO(w, type) ||                          \
+                                            WORD_HAS_ZERO(w ^ pattern, type))                  \
+                                                break;                                         \
+                                }                                                              \
+                                                                                               \
+                        if (*s == c)                                                           \
+                                return (type *) s;                                             \
+                        if (!*s)                                                               \
+                                return NULL;                                                   \
+                }                                                                              \
         }
 
 DEFINE_STRCHR(char, strchr8);
@@ -179,19 +230,40 @@ static unsigned utf8_to_unichar(const char *utf8, size_t n, char32_t *c) {
         return len;
 }
 
+/* Spreads the four bytes in the low half of w out to four char16_t, in the order they are in memory on a
+ * little endian machine, as UEFI ones are. */
+static inline uint64_t widen_ascii(uint64_t w) {
+        w &= UINT32_MAX;
+        w = (w | (w << 16)) & UINT64_C(0x0000ffff0000ffff);
+        w = (w | (w << 8)) & UINT64_C(0x00ff00ff00ff00ff);
+        return w;
+}
+
+assert_cc(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+
 /* Convert UTF-8 to UCS-2, skipping any invalid or short byte sequences. */
-char16_t *xstrn8_to_16(const char *str8, size_t n) {
+char16_t *strn8_to_16(char16_t *str16, const char *str8, size_t n) {
+        assert(str16);
         assert(str8 || n == 0);
 
-        if (n == SIZE_MAX)
-                n = strlen8(str8);
-
         size_t i = 0;
-        char16_t *str16 = xnew(char16_t, n + 1);
 
         while (n > 0 && *str8 != '\0') {
                 char32_t unichar;
 
+                /* Widen runs of ASCII 8 bytes at a time: no byte with the high bit set, none that is 0. */
+                if (n >= sizeof(word_t) && IS_WORD_ALIGNED(str8)) {
+                        word_t w = *(const word_t *) str8;
+                        if ((w & WORD_HIGHS(char)) == 0 && !WORD_HAS_ZERO(w, char)) {
+                                unaligned_write_ne64(str16 + i, widen_ascii(w));
+                                unaligned_write_ne64(str16 + i + 4, widen_ascii(w >> 32));
+                                str8 += sizeof(word_t);
+                                n -= sizeof(word_t);
+                                i += sizeof(word_t);
+                                continue;
+                        }
+                }
+
                 size_t utf8len = utf8_to_unichar(str8, n, &unichar);
                 str8 += utf8len;
                 n = LESS_BY(n, utf8len);
@@ -208,6 +280,15 @@ char16_t *xstrn8_to_16(const char *str8, size_t n) {
         return str16;
 }
 
+char16_t *xstrn8_to_16(const char *str8, size_t n) {
+        assert(str8 || n == 0);
+
+        if (n == SIZE_MAX)
+                n = strlen8(str8);
+
+        return strn8_to_16(xnew(char16_t, n + 1), str8, n);
+}
+
 char *xstrn16_to_ascii(const char16_t *str16, size_t n) {
         assert(str16 || n == 0);
 
@@ -622,8 +703,12 @@ static void grow_buf(FormatContext *ctx, size_t need) {
         if (!MUL_SAFE(&ctx->n_buf, need, 2))
                 ctx->n_buf = need;
 
+        /* If nothing else was allocated since the last time we grew, just grow in place. */
+        if (ctx->dyn_buf && arena_extend(ctx->dyn_buf, ctx->n_buf * sizeof(*ctx->buf)))
+                return;
+
         /* We cannot use realloc here as ctx->buf may be ctx->stack_buf, which we cannot free. */
-        char16_t *new_buf = xnew(char16_t, ctx->n_buf);
+        char16_t *new_buf = xnew_scratch(char16_t, ctx->n_buf);
         memcpy(new_buf, ctx->buf, ctx->n * sizeof(*ctx->buf));
 
         free(ctx->dyn_buf);
@@ -962,11 +1047,13 @@ _printf_(2, 0) static char16_t *printf_internal(EFI_STATUS status, const char *f
         ctx.buf[ctx.n++] = '\0';
 
         if (ret) {
-                if (ctx.dyn_buf)
+                /* The caller may keep the result around, so it must not stay in the arena. */
+                if (ctx.dyn_buf && !arena_owns(ctx.dyn_buf))
                         return TAKE_PTR(ctx.dyn_buf);
 
                 char16_t *ret_buf = xnew(char16_t, ctx.n);
                 memcpy(ret_buf, ctx.buf, ctx.n * sizeof(*ctx.buf));
+                free(ctx.dyn_buf);
                 return ret_buf;
         }
 
@@ -1048,6 +1135,7 @@ void *memcpy(void * restrict dest, const void * restrict src, size_t n) {
          * available by the UEFI spec. We still make it depend on the boot services pointer being set just in
          * case the compiler emits a call before it is available. */
         if (_likely_(BS)) {
+                BS_STATS_FORWARD_CALLER();
                 BS->CopyMem(dest, (void *) src, n);
                 return dest;
         }
@@ -1071,6 +1159,7 @@ void *memset(void *p, int c, size_t n) {
 
         /* See comment in efi_memcpy. Note that the signature has c and n swapped! */
         if (_likely_(BS)) {
+                BS_STATS_FORWARD_CALLER();
                 BS->SetMem(p, n, c);
                 return p;
         }
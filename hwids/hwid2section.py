@@ -0,0 +1,148 @@
+#!/usr/bin/python3
+# SPDX-License-Identifier: 0BSD
+
+# Compiles the JSON files written by hwid2json.py into the binary layout of a .hwids PE section, see
+# struct Device in include/chid.h. Identical strings are stored once and the devices are sorted by CHID,
+# which lets the stub binary search the table instead of scanning it once per CHID type.
+
+from uuid import UUID
+from pathlib import Path
+from typing import *
+import argparse
+import json
+import struct
+import sys
+
+DEVICE_TYPE_DEVICETREE = 0x1
+DEVICE_TYPE_UEFI_FW = 0x2
+
+DEVICE_FORMAT = '<I16sII'
+DEVICE_SIZE = struct.calcsize(DEVICE_FORMAT)
+assert DEVICE_SIZE == 28
+
+# JSON type -> (descriptor type, key of the second string)
+DEVICE_TYPES = {
+    'devicetree': (DEVICE_TYPE_DEVICETREE, 'compatible'),
+    'uefi-fw': (DEVICE_TYPE_UEFI_FW, 'fwid'),
+}
+
+class Device(NamedTuple):
+    chid: UUID
+    type: int
+    name: str
+    extra: str
+    source: Path
+
+def descriptor(device_type: int) -> int:
+    return (device_type << 28) | DEVICE_SIZE
+
+def parse_json_file(path: Path) -> list[Device]:
+    with path.open(encoding='utf-8') as f:
+        j = json.load(f)
+
+    t = j.get('type')
+    if t not in DEVICE_TYPES:
+        raise ValueError(f'{path}: unknown device type "{t}"')
+    device_type, extra_key = DEVICE_TYPES[t]
+
+    name = j.get('name')
+    extra = j.get(extra_key)
+    if not name or not extra:
+        raise ValueError(f'{path}: "name" and "{extra_key}" must be set')
+    if extra == 'FIXME!':
+        raise ValueError(f'{path}: "{extra_key}" has not been filled in')
+
+    return [Device(UUID(h), device_type, name, extra, path) for h in j.get('hwids', [])]
+
+def collect(paths: list[Path], strict: bool) -> tuple[list[Device], int]:
+    devices: list[Device] = []
+
+    for p in paths:
+        files = sorted(p.rglob('*.json')) if p.is_dir() else [p]
+        for f in files:
+            devices += parse_json_file(f)
+
+    # A CHID must lead to exactly one resource of each type, otherwise which one the stub picks depends on
+    # the order of the table. Exact duplicates are harmless and dropped. Conflicting ones are ambiguous, so
+    # rather than guessing they are dropped too, the more specific CHIDs of the devices still tell them
+    # apart.
+    seen: dict[tuple[UUID, int], list[Device]] = {}
+    for d in devices:
+        seen.setdefault((d.chid, d.type), []).append(d)
+
+    unique: list[Device] = []
+    n_ambiguous = 0
+    for (chid, _), ds in seen.items():
+        if any((o.name, o.extra) != (ds[0].name, ds[0].extra) for o in ds):
+            sources = ', '.join(str(o.source) for o in ds)
+            if strict:
+                raise ValueError(f'CHID {chid} used by {sources}')
+            print(f'warning: CHID {chid} used by {sources}, dropping it', file=sys.stderr)
+            n_ambiguous += 1
+            continue
+        unique.append(ds[0])
+
+    # Sort the way the stub compares them: by the bytes of the EFI_GUID as stored in the table
+    unique.sort(key=lambda d: (d.chid.bytes_le, d.type))
+    return unique, n_ambiguous
+
+def compile_section(devices: list[Device]) -> tuple[bytes, dict[str, int]]:
+    # The strings follow the device table and its terminating entry, so no offset ends up as 0
+    strings_base = (len(devices) + 1) * DEVICE_SIZE
+    strings = bytearray()
+    offsets: dict[str, int] = {}
+
+    def intern(s: str) -> int:
+        off = offsets.get(s)
+        if off is None:
+            off = offsets[s] = strings_base + len(strings)
+            strings.extend(s.encode('utf-8') + b'\0')
+        return off
+
+    table = bytearray()
+    for d in devices:
+        table += struct.pack(DEVICE_FORMAT, descriptor(d.type), d.chid.bytes_le, intern(d.name), intern(d.extra))
+    table += struct.pack(DEVICE_FORMAT, 0, bytes(16), 0, 0)
+
+    stats = {
+        'devices': len(devices),
+        'strings': len(offsets),
+        'table_size': len(table),
+        'strings_size': len(strings),
+        'strings_size_naive': sum(len(d.name.encode('utf-8')) + len(d.extra.encode('utf-8')) + 2 for d in devices),
+    }
+    return bytes(table + strings), stats
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description='Compile hwids JSON files into a .hwids PE section')
+    parser.add_argument('-o', '--output', type=Path, required=True,
+                        help='where to write the section')
+    parser.add_argument('--strict', action='store_true',
+                        help='fail instead of dropping CHIDs used by more than one device')
+    parser.add_argument('inputs', type=Path, nargs='*', default=[Path('./json')],
+                        help='JSON files or directories of them (default: ./json)')
+    args = parser.parse_args()
+
+    try:
+        devices, n_ambiguous = collect(args.inputs, args.strict)
+    except (ValueError, OSError, json.JSONDecodeError) as e:
+        print(f'error: {e}', file=sys.stderr)
+        return 1
+
+    if not devices:
+        print('error: no hwids found', file=sys.stderr)
+        return 1
+
+    section, stats = compile_section(devices)
+    args.output.write_bytes(section)
+
+    saved = stats['strings_size_naive'] - stats['strings_size']
+    print(f'{stats["devices"]} devices, {stats["strings"]} distinct strings, '
+          f'{n_ambiguous} ambiguous CHIDs dropped', file=sys.stderr)
+    print(f'device table: {stats["table_size"]} bytes, strings: {stats["strings_size"]} bytes '
+          f'({saved} bytes saved by sharing strings)', file=sys.stderr)
+    print(f'{args.output}: {len(section)} bytes', file=sys.stderr)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
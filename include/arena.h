@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "efi.h"
+
+/* A bump allocator backed by a single page allocation that serves the short-lived allocations of the stub.
+ * xmalloc_scratch() hands out arena memory while there is room left and falls back to the firmware pool
+ * otherwise, plain xmalloc() always goes to the pool. free() of the most recent arena allocation gives the
+ * memory back, any other arena free() is a no-op. Memory is reclaimed in bulk by resetting to a mark taken
+ * earlier, see ARENA_SCOPE(). */
+
+#define ARENA_SIZE (64U * 1024U)
+
+typedef struct ArenaMark {
+        size_t used;
+} ArenaMark;
+
+void arena_init(size_t size);
+void arena_done(void);
+
+/* Returns NULL if the arena is not set up or has no room left. */
+void *arena_alloc(size_t size);
+/* Returns true if p belongs to the arena, in which case it must not be passed to FreePool(). */
+bool arena_owns(const void *p);
+/* Returns true if p belongs to the arena, having given it back if it was the most recent allocation. */
+bool arena_free(void *p);
+/* Grows the most recent allocation in place. Returns false if p is not the most recent allocation or if
+ * there is not enough room left. */
+bool arena_extend(void *p, size_t new_size);
+
+ArenaMark arena_mark(void);
+void arena_reset(const ArenaMark *mark);
+
+/* Everything allocated from the arena after this point is released at the end of the enclosing scope.
+ * Pointers into it must not escape the scope. */
+#define ARENA_SCOPE() \
+        _cleanup_(arena_reset) _unused_ const ArenaMark CONCATENATE(_arena_mark_, UNIQ) = arena_mark()
+
+void arena_log_stats(void);
@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "efi.h"
+#include "pe.h"
+#include "proto/loaded-image.h"
+#include "uki.h"
+
+/* Set with stubble.bench=N on the command line, 0 if off */
+extern unsigned bench_iterations;
+#define BENCH_ITERATIONS_MAX 1000U
+
+/* Runs the hot paths of a boot bench_iterations times each on the firmware we are running on, and logs the
+ * minimum, median and maximum ticks they took. Nothing is left behind: the devicetree is installed and
+ * uninstalled again, the kernel is copied into memory that is freed afterwards. Each path is run once with
+ * logging on first, and skipped if that fails. The timed runs are muted entirely, so that the console
+ * doesn't end up in the numbers. */
+void bench_run(EFI_LOADED_IMAGE_PROTOCOL *loaded_image, const PeSectionVector sections[static _UNIFIED_SECTION_MAX]);
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "efi.h"
+#include "ticks.h"
+
+/* Optional accounting of the firmware services the stub calls into. When built with BS_STATS=1 the boot
+ * services table is swapped for a copy whose entries record the number of calls, the bytes involved and
+ * the ticks spent per call site before forwarding to the firmware. Protocol calls made directly by the stub
+ * (TCG2, CC) are accounted with BS_STATS_TRACK(). The table is logged in debug mode and exported as the
+ * StubbleBootServicesStats variable. Call sites are addresses in the stubble ELF, see addr2line(1). */
+
+#ifndef STUBBLE_BS_STATS
+#  define STUBBLE_BS_STATS 0
+#endif
+
+typedef enum BsStatsCall {
+        BS_STATS_ALLOCATE_POOL,
+        BS_STATS_ALLOCATE_PAGES,
+        BS_STATS_COPY_MEM,
+        BS_STATS_SET_MEM,
+        BS_STATS_LOCATE_PROTOCOL,
+        BS_STATS_HANDLE_PROTOCOL,
+        BS_STATS_INSTALL_CONFIGURATION_TABLE,
+        BS_STATS_CONFIGURATION_TABLE_HIT,
+        BS_STATS_CONFIGURATION_TABLE_MISS,
+        BS_STATS_TCG2_GET_CAPABILITY,
+        BS_STATS_TCG2_GET_ACTIVE_PCR_BANKS,
+        BS_STATS_TCG2_HASH_LOG_EXTEND_EVENT,
+        BS_STATS_CC_GET_CAPABILITY,
+        BS_STATS_CC_MAP_PCR_TO_MR_INDEX,
+        BS_STATS_CC_HASH_LOG_EXTEND_EVENT,
+        _BS_STATS_CALL_MAX,
+} BsStatsCall;
+
+/* Layout of the exported variable: a header followed by n_entries entries of entry_size bytes each. */
+#define BS_STATS_MAGIC UINT32_C(0x53534253) /* "BSSS" */
+
+typedef struct BsStatsHeader {
+        uint32_t magic;
+        uint32_t entry_size;
+        uint32_t n_entries;
+        uint32_t n_dropped;     /* Records lost because the table was full */
+        uint64_t ticks_freq;    /* 0 if unknown */
+} _packed_ BsStatsHeader;
+
+typedef struct BsStatsEntry {
+        uint32_t call;          /* BsStatsCall */
+        uint32_t site;          /* Offset of the call site from the start of the image */
+        uint64_t count;
+        uint64_t bytes;
+        uint64_t ticks;
+} _packed_ BsStatsEntry;
+
+#if STUBBLE_BS_STATS
+
+void bs_stats_init(void);
+void bs_stats_done(void);
+void bs_stats_record(BsStatsCall call, const void *site, uint64_t bytes, uint64_t ticks);
+/* Attributes the next wrapped boot services call to 'site' instead of its immediate caller. For helpers
+ * like xmalloc() and memcpy() that merely forward to the firmware. */
+void bs_stats_set_site(const void *site);
+void bs_stats_report(void);
+
+/* Runs the statement(s) and accounts the time they took to the caller of the current function. */
+#  define BS_STATS_TRACK(call, bytes, ...)                                                       \
+        do {                                                                                     \
+                uint64_t _bs_stats_start = ticks_read();                                         \
+                __VA_ARGS__;                                                                     \
+                bs_stats_record((call), __builtin_return_address(0), (bytes),                   \
+                                ticks_read() - _bs_stats_start);                                 \
+        } while (false)
+
+#  define BS_STATS_FORWARD_CALLER() bs_stats_set_site(__builtin_return_address(0))
+
+#else
+
+static inline void bs_stats_init(void) {}
+static inline void bs_stats_done(void) {}
+static inline void bs_stats_report(void) {}
+
+#  define BS_STATS_TRACK(call, bytes, ...) do { __VA_ARGS__; } while (false)
+#  define BS_STATS_FORWARD_CALLER() do {} while (false)
+
+#endif
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "efi.h"
+#include "proto/loaded-image.h"
+
+/* A capture file holds the firmware provided inputs of the devicetree matching, so that matching can be
+ * replayed on a host without the machine at hand. The file starts with a CaptureHeader, followed by
+ * n_records records. Each record is a CaptureRecord header followed by 'size' bytes of payload, padded with
+ * zeroes to a multiple of CAPTURE_ALIGNMENT. All integers are little endian. Readers must skip records of
+ * unknown type. */
+
+#define CAPTURE_MAGIC "STBLCAP1"
+#define CAPTURE_ALIGNMENT 8U
+
+typedef struct CaptureHeader {
+        char magic[8];
+        uint32_t n_records;
+        uint32_t reserved;
+} _packed_ CaptureHeader;
+
+typedef enum CaptureRecordType {
+        CAPTURE_RECORD_SMBIOS_ENTRY_POINT = 1, /* "_SM_" or "_SM3_" entry point, as found by the stub */
+        CAPTURE_RECORD_SMBIOS_TABLE       = 2, /* SMBIOS structure table */
+        CAPTURE_RECORD_EDID               = 3, /* From EFI_EDID_DISCOVERED_PROTOCOL */
+        CAPTURE_RECORD_DTB                = 4, /* The DT installed by the firmware */
+        CAPTURE_RECORD_CONFIG_TABLES      = 5, /* EFI_GUID of each configuration table, in table order */
+        CAPTURE_RECORD_CHIDS              = 6, /* CHID_TYPES_MAX CHIDs as EFI_GUIDs, as computed by the stub */
+} CaptureRecordType;
+
+typedef struct CaptureRecord {
+        uint32_t type;
+        uint32_t size;
+} _packed_ CaptureRecord;
+
+/* Set with stubble.capture or stubble.capture=<path> */
+extern char16_t *capture_path;
+
+/* Writes a capture file to 'path' on the volume the stub was loaded from. If 'path' is the empty string a
+ * file name derived from the CHIDs of the machine is used, so that captures of different models don't
+ * overwrite each other. */
+EFI_STATUS capture_write(EFI_LOADED_IMAGE_PROTOCOL *loaded_image, const char16_t *path);
@@ -27,6 +27,8 @@ extern const uint32_t chid_smbios_table[CHID_TYPES_MAX];
 
 /* CHID (also called HWID by fwupd) is described at https://github.com/fwupd/fwupd/blob/main/docs/hwids.md */
 void chid_calculate(const char16_t *const smbios_fields[static _CHID_SMBIOS_FIELDS_MAX], EFI_GUID ret_chids[static CHID_TYPES_MAX]);
+/* Calculates the CHIDs of the machine we are running on from its SMBIOS tables and EDID */
+EFI_STATUS chid_populate_board(EFI_GUID ret_chids[static CHID_TYPES_MAX]);
 
 /* A .hwids PE section consists of a series of 'Device' structures. A 'Device' structure binds a CHID to some
  * resource, for now only Devicetree blobs. Designed to be extensible to other types of resources, should the
@@ -122,4 +124,9 @@ static inline const char* device_get_fwid(const void *base, const Device *device
         return off == 0 ? NULL : (const char *) ((const uint8_t *) base + off);
 }
 
-EFI_STATUS chid_match(const void *chids_buffer, size_t chids_length, uint32_t match_type, const Device **ret_device);
+EFI_STATUS chid_match(
+                const void *chids_buffer,
+                size_t chids_length,
+                uint32_t match_type,
+                const Device **ret_device,
+                size_t *ret_chid_type);
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "devicetree.h"
+#include "efi.h"
+
+/* Where the devicetree handed to the kernel came from */
+typedef enum DevicetreeOrigin {
+        DEVICETREE_ORIGIN_NONE,     /* There is none */
+        DEVICETREE_ORIGIN_FIRMWARE, /* The firmware provided one was kept */
+        DEVICETREE_ORIGIN_DTB,      /* The .dtb section of the UKI */
+        DEVICETREE_ORIGIN_DTBAUTO,  /* A .dtbauto section of the UKI */
+        DEVICETREE_ORIGIN_SIDECAR,  /* A .dtbauto section of the sidecar */
+        _DEVICETREE_ORIGIN_MAX,
+} DevicetreeOrigin;
+
+/* Remembers why .dtbauto section 'section_nb' was picked, replacing whatever was recorded before. Called
+ * wherever a .dtbauto section wins, the last call describes the DT that ends up installed. */
+void devicetree_export_record_match(const DevicetreeMatchContext *dt_match, size_t section_nb);
+
+/* Exports the devicetree decision of this boot as the StubbleDevicetreeMatch EFI variable, so that the OS
+ * can reuse it rather than redo the CHID and compatible matching. The variable is volatile and holds
+ * UTF-16 "key=value" lines:
+ *
+ *   devicetree=  none, firmware, dtb, dtbauto or sidecar
+ *   compatible=  first compatible string of the installed DT, if any
+ *   section=     index of the picked .dtbauto section in the PE section table of the UKI or the sidecar
+ *   match=       firmware or hwid, what the .dtbauto section was matched against
+ *   chid_type=   CHID type of the matching .hwids entry, for match=hwid
+ *   device=      name of the matching .hwids entry, for match=hwid
+ *
+ * Lines that don't apply are left out. The variable is rewritten as a whole on every boot. */
+void devicetree_export(DevicetreeOrigin origin);
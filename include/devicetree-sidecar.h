@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "devicetree.h"
+#include "efi.h"
+#include "proto/loaded-image.h"
+
+/* Set with stubble.dtb_sidecar=<path>. Path of a PE addon on the volume the stub was loaded from, carrying
+ * .dtbauto sections and optionally its own .hwids section. */
+extern char16_t *dtb_sidecar_path;
+
+/* Picks the .dtbauto section of the sidecar matching this machine and installs it. Only the section table,
+ * the headers of the candidate DTs and the selected DT itself are read from disk. Refuses to do anything
+ * with Secure Boot enabled, as the sidecar isn't verified. 'hwids' is the .hwids table of the UKI, used if
+ * the sidecar has none. */
+EFI_STATUS devicetree_sidecar_install(
+                EFI_LOADED_IMAGE_PROTOCOL *loaded_image,
+                const char16_t *path,
+                const void *hwids,
+                size_t hwids_size,
+                struct devicetree_state *state);
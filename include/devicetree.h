@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 #pragma once
 
+#include "chid.h"
 #include "efi.h"
 
 struct devicetree_state {
@@ -9,6 +10,8 @@ struct devicetree_state {
         void *orig;
 };
 
+#define FDT_MAGIC UINT32_C(0xd00dfeed)
+
 enum {
         FDT_BEGIN_NODE = 1,
         FDT_END_NODE   = 2,
@@ -30,10 +33,52 @@ typedef struct FdtHeader {
         uint32_t size_dt_struct;
 } FdtHeader;
 
-bool firmware_devicetree_exists(void);
+typedef enum DevicetreeMatchSource {
+        DEVICETREE_MATCH_NONE,     /* Nothing to match against, keep whatever DT there is */
+        DEVICETREE_MATCH_FIRMWARE, /* Match against the compatible list of the firmware provided DT */
+        DEVICETREE_MATCH_HWID,     /* Match against the compatible of the .hwids Device of this machine */
+} DevicetreeMatchSource;
+
+/* Everything the .dtbauto candidates are matched against. Collected once per boot, so that scoring a
+ * candidate does not need to look at the firmware again. */
+typedef struct DevicetreeMatchContext {
+        DevicetreeMatchSource source;
+        const void *fw_dtb;
+        const char *compatible;    /* NUL-separated list of compatible strings to match against */
+        size_t compatible_size;
+
+        /* Only for DEVICETREE_MATCH_HWID */
+        const void *hwids;
+        const Device *device;
+        size_t chid_type;
+} DevicetreeMatchContext;
+
 const char* devicetree_get_compatible(const void *dtb);
-EFI_STATUS devicetree_match(const void *uki_dtb, size_t uki_dtb_length);
-EFI_STATUS devicetree_match_by_compatible(const void *uki_dtb, size_t uki_dtb_length, const char *compat);
+const char* devicetree_get_compatible_list(const void *dtb, size_t *ret_size);
+/* Like devicetree_get_compatible_list(), but works on the structure and strings blocks of a DT directly.
+ * The structure block may be truncated, e.g. when only its beginning was read from disk. */
+const char* devicetree_find_compatible(
+                const void *struct_block,
+                size_t struct_size,
+                const char *strings_block,
+                size_t strings_size,
+                size_t *ret_size);
+void devicetree_match_context_init(DevicetreeMatchContext *ctx);
+void devicetree_match_context_set_device(
+                DevicetreeMatchContext *ctx,
+                const void *hwids,
+                const Device *device,
+                size_t chid_type);
+EFI_STATUS devicetree_match_score_compatible(
+                const DevicetreeMatchContext *ctx,
+                const char *dt_compat,
+                size_t dt_compat_size,
+                uint32_t *ret_score);
+EFI_STATUS devicetree_match_score(
+                const DevicetreeMatchContext *ctx,
+                const void *uki_dtb,
+                size_t uki_dtb_length,
+                uint32_t *ret_score);
 EFI_STATUS devicetree_install_from_memory(
                 struct devicetree_state *state, const void *dtb_buffer, size_t dtb_length);
 void devicetree_cleanup(struct devicetree_state *state);
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "devicetree.h"
+#include "efi.h"
+#include "pe.h"
+
+/* Optional companion index of the .dtbauto sections of a UKI, in a .dtbidx section, built with
+ * tools/dtbidx-build.py from the same DTBs in the same order. It carries the compatible list of every DT,
+ * so that candidates can be scored without looking at the DTs themselves, grouped by SoC, i.e. the last
+ * entry of their compatible list. All entries are scored, as leaving out the groups of other SoCs could
+ * change the outcome, so the grouping only keeps the entries of a SoC family together.
+ *
+ * The section starts with a DtbIndexHeader. At header_size follow n_groups DtbIndexGroup, then n_entries
+ * DtbIndexEntry, and at strings_offset strings_size bytes of NUL-terminated strings, which the groups and
+ * entries refer to by offset. A compatible list is a run of such strings, as in the DT property. The entries
+ * of a group are consecutive. All integers are little endian. */
+
+#define DTBIDX_MAGIC UINT32_C(0x58444944) /* "DIDX" */
+
+typedef struct DtbIndexHeader {
+        uint32_t magic;
+        uint32_t header_size;
+        uint32_t n_groups;
+        uint32_t n_entries;
+        uint32_t strings_offset;
+        uint32_t strings_size;
+} _packed_ DtbIndexHeader;
+
+typedef struct DtbIndexGroup {
+        uint32_t soc;           /* Offset of the SoC compatible string */
+        uint32_t first_entry;
+        uint32_t n_entries;
+} _packed_ DtbIndexGroup;
+
+typedef struct DtbIndexEntry {
+        uint32_t dtbauto;       /* Which .dtbauto section, counting from 0 in section table order */
+        uint32_t compatible;    /* Offset of the compatible list */
+        uint32_t compatible_size;
+} _packed_ DtbIndexEntry;
+
+/* Picks the best scoring .dtbauto section of section_table for dt_match by way of the index, with the same
+ * scoring and tie breaking as scanning all sections. Returns its position in section_table and its score.
+ * Returns EFI_NOT_FOUND if no candidate matches and EFI_INVALID_PARAMETER if the index is malformed or
+ * doesn't describe each .dtbauto section of section_table exactly once. */
+EFI_STATUS dtbidx_select(
+                const void *index,
+                size_t index_size,
+                const PeSectionHeader section_table[],
+                size_t n_section_table,
+                const DevicetreeMatchContext *dt_match,
+                size_t *ret_section_nb,
+                uint32_t *ret_score);
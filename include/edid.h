@@ -21,4 +21,5 @@ typedef struct EdidHeader {
 int edid_parse_blob(const void *blob, size_t blob_size, EdidHeader *ret_header);
 int edid_get_panel_id(const EdidHeader *edid_header, char16_t ret_panel[static 8]);
 
+EFI_STATUS edid_get_discovered_blob(const void **ret_blob, size_t *ret_size);
 EFI_STATUS edid_get_discovered_panel_id(char16_t **ret_panel);
@@ -4,6 +4,7 @@
 #include "efi.h"
 #include "efi-string.h"
 #include "proto/simple-text-io.h"
+#include "trace.h"
 
 #if defined __has_attribute
 #  if __has_attribute(no_stack_protector)
@@ -21,19 +22,32 @@ __attribute__((no_stack_protector, noinline)) void __stack_chk_guard_init(void);
 #  define __stack_chk_guard_init()
 #endif
 
+/* In order of severity. Only errors hold up the boot in log_wait(), see there. */
+typedef enum LogLevel {
+        LOG_ERROR,
+        LOG_WARNING,
+        LOG_INFO,
+        LOG_DEBUG,
+} LogLevel;
+
 extern bool log_isdebug;
+/* While set nothing is logged at all, not even errors, nor recorded into the trace, see bench_run() */
+extern bool log_ismuted;
+/* How long log_wait() pauses at most, UINT64_MAX for 2.5 s per message it waits for, up to 10 s */
+extern uint64_t log_pause_usec;
 
 _noreturn_ void freeze(void);
 void log_wait(void);
-_gnu_printf_(3, 4) EFI_STATUS log_internal(EFI_STATUS status, uint8_t text_color, const char *format, ...);
-#define log_full(status, text_color, format, ...)                       \
-        log_internal(status, text_color, "%s:%i@%s: " format, __FILE__, __LINE__, __func__, ##__VA_ARGS__)
-#define log_debug(...) ({ log_isdebug && log_full(EFI_SUCCESS, EFI_LIGHTGRAY, __VA_ARGS__); })
-#define log_info(...) log_full(EFI_SUCCESS, EFI_WHITE, __VA_ARGS__)
-#define log_warning_status(status, ...) log_full(status, EFI_YELLOW, __VA_ARGS__)
-#define log_error_status(status, ...) log_full(status, EFI_LIGHTRED, __VA_ARGS__)
-#define log_error(...) log_full(EFI_INVALID_PARAMETER, EFI_LIGHTRED, __VA_ARGS__)
-#define log_oom() log_full(EFI_OUT_OF_RESOURCES, EFI_LIGHTRED, "Out of memory.")
+_gnu_printf_(3, 4) EFI_STATUS log_internal(EFI_STATUS status, LogLevel level, const char *format, ...);
+#define log_full(status, level, format, ...)                            \
+        log_internal(status, level, "%s:%i@%s: " format, __FILE__, __LINE__, __func__, ##__VA_ARGS__)
+/* Outside of debug mode debug messages are only recorded, if tracing, see log_internal() */
+#define log_debug(...) ({ (log_isdebug || log_istrace) && log_full(EFI_SUCCESS, LOG_DEBUG, __VA_ARGS__); })
+#define log_info(...) log_full(EFI_SUCCESS, LOG_INFO, __VA_ARGS__)
+#define log_warning_status(status, ...) log_full(status, LOG_WARNING, __VA_ARGS__)
+#define log_error_status(status, ...) log_full(status, LOG_ERROR, __VA_ARGS__)
+#define log_error(...) log_full(EFI_INVALID_PARAMETER, LOG_ERROR, __VA_ARGS__)
+#define log_oom() log_full(EFI_OUT_OF_RESOURCES, LOG_ERROR, "Out of memory.")
 
 /* Debugging helper — please keep this around, even if not used */
 #define log_hexdump(prefix, data, size)                                 \
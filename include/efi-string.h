@@ -95,6 +95,8 @@ static inline char16_t *xstrdup16(const char16_t *s) {
         return xstrndup16(s, SIZE_MAX);
 }
 
+/* Like xstrn8_to_16(), but writes to str16, which must have room for n + 1 characters. Returns str16. */
+char16_t *strn8_to_16(char16_t *str16, const char *str8, size_t n);
 char16_t *xstrn8_to_16(const char *str8, size_t n);
 static inline char16_t *xstr8_to_16(const char *str8) {
         return xstrn8_to_16(str8, SIZE_MAX);
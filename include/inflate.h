@@ -0,0 +1,11 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "efi.h"
+
+/* Decompresses the gzip stream (RFC 1952) in src into dst, which doubles as the DEFLATE window, so no other
+ * memory is needed. On success the size of the output is returned in *ret_size and the CRC and size in the
+ * trailer have been checked. Returns EFI_BUFFER_TOO_SMALL if dst is full before the stream ends, in which
+ * case dst holds the beginning of the output, which is how to peek at a header. Returns EFI_UNSUPPORTED if
+ * src is not a gzip stream and EFI_COMPROMISED_DATA if it is corrupt or truncated. */
+EFI_STATUS gzip_decompress(const void *src, size_t src_size, void *dst, size_t dst_size, size_t *ret_size);
@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "efi.h"
+
+/* Set with stubble.mp=true on the command line. Off by default, as some firmware ships a broken
+ * implementation of the MP services protocol. */
+extern bool mp_enabled;
+
+/* Copies n bytes from src to dest like memcpy(), but hands parts of large copies to idle application
+ * processors while the boot processor copies its own part. Falls back to memcpy() if multi-processing is
+ * disabled, the copy is small, or the firmware has no MP services protocol. */
+void mp_memcpy(void *dest, const void *src, size_t n);
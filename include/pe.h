@@ -19,6 +19,30 @@ typedef struct PeSectionHeader {
         uint32_t Characteristics;
 } _packed_ PeSectionHeader;
 
+typedef struct PeImageDataDirectory {
+        uint32_t VirtualAddress;
+        uint32_t Size;
+} _packed_ PeImageDataDirectory;
+
+/* https://learn.microsoft.com/en-us/windows/win32/debug/pe-format#optional-header-data-directories-image-only */
+#define PE_DATA_DIRECTORY_BASE_RELOCATION 5
+
+/* A PE image in memory whose headers have been validated, see pe_image_parse() */
+typedef struct PeImage {
+        const void *base;
+        size_t size;
+        uint16_t machine;
+        uint64_t image_base;
+        uint32_t entry_point;           /* Relative to base, like everything else */
+        uint32_t size_of_image;
+        uint32_t section_alignment;
+        uint16_t major_image_version;
+        const PeImageDataDirectory *data_directories;
+        size_t n_data_directories;
+        const PeSectionHeader *sections;
+        size_t n_sections;
+} PeImage;
+
 /* This is a subset of the full PE section header structure, with validated values, and without
  * the noise. */
 typedef struct PeSectionVector {
@@ -32,16 +56,21 @@ static inline bool PE_SECTION_VECTOR_IS_SET(const PeSectionVector *v) {
         return v && v->memory_size != 0;
 }
 
-EFI_STATUS pe_section_table_from_base(
-                const void *base,
-                const PeSectionHeader **ret_section_table,
-                size_t *ret_n_section_table);
-
 EFI_STATUS pe_section_table_from_file(
                 EFI_FILE *handle,
                 PeSectionHeader **ret_section_table,
                 size_t *ret_n_section_table);
 
+/* Compares up to 8 characters, i.e. the size of the name field of a section header */
+bool pe_section_name_equal(const char *a, const char *b);
+
+/* Validates the offsets and sizes of a section header, and converts it into a PeSectionVector. Like
+ * pe_locate_sections(), takes the load address into account if 'validate_base' is non-zero. */
+bool pe_section_vector_from_header(
+                const PeSectionHeader *section,
+                size_t validate_base,
+                PeSectionVector *ret);
+
 void pe_locate_sections(
                 const PeSectionHeader section_table[],
                 size_t n_section_table,
@@ -54,6 +83,20 @@ EFI_STATUS pe_memory_locate_sections(
                 const char *const section_names[],
                 PeSectionVector sections[]);
 
-EFI_STATUS pe_kernel_info(const void *base, uint32_t *ret_entry_point, uint64_t *ret_image_base, size_t *ret_size_in_memory);
+/* Validates the headers of the PE image at 'base' once and keeps what its users need. 'size' is how much of
+ * the image is there to look at, the headers and the section table have to lie within it. Pass SIZE_MAX if
+ * unknown. The compatibility machine type (x86_64 on i386) is only accepted if 'allow_compatibility' is set,
+ * which is what the kernel needs, the stub's own image and addons have to be native. */
+EFI_STATUS pe_image_parse(const void *base, size_t size, bool allow_compatibility, PeImage *ret);
+
+bool pe_image_is_native(const PeImage *image);
+
+/* Returns NULL if the image doesn't have the data directory */
+static inline const PeImageDataDirectory *pe_image_data_directory(const PeImage *image, size_t index) {
+        return index < image->n_data_directories ? image->data_directories + index : NULL;
+}
 
-EFI_STATUS pe_kernel_check_no_relocation(const void *base);
+/* Checks that the image is a kernel we can start: native, with an EFI stub that knows about
+ * LINUX_INITRD_MEDIA_GUID, and without relocations. Returns EFI_UNSUPPORTED or EFI_LOAD_ERROR otherwise, the
+ * details are logged at debug level. */
+EFI_STATUS pe_image_check_kernel(const PeImage *image);
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "efi.h"
+#include "proto/loaded-image.h"
+
+/* Optional function level profiler. When built with PROFILE=1 every function of the stub is compiled with
+ * -finstrument-functions, and the entry and exit hooks build a call tree with the number of calls and the
+ * ticks spent per node, callees included, in a fixed buffer. Inline helpers from include/ are left out, as
+ * the hooks would cost more than they do. Firmware calls are accounted to the function making them. Before
+ * the kernel is started the tree is written to \stubble-profile.bin on the volume the stub was loaded
+ * from, which tools/profile-fold.py turns into folded stacks for flamegraph.pl.
+ *
+ * The file starts with a ProfileHeader followed by n_nodes nodes of node_size bytes each. Node 0 is the
+ * root, every other node has a lower index than its children. All integers are little endian. */
+
+#ifndef STUBBLE_PROFILE
+#  define STUBBLE_PROFILE 0
+#endif
+
+#define PROFILE_MAGIC UINT32_C(0x464f5250) /* "PROF" */
+#define PROFILE_PATH u"\\stubble-profile.bin"
+
+typedef struct ProfileHeader {
+        uint32_t magic;
+        uint32_t node_size;
+        uint32_t n_nodes;
+        uint32_t n_dropped;     /* Calls not accounted because the tree or the stack was full */
+        uint64_t ticks_freq;    /* 0 if unknown */
+} _packed_ ProfileHeader;
+
+typedef struct ProfileNode {
+        uint32_t fn;            /* Offset of the function from the start of the image, 0 for the root */
+        uint32_t parent;        /* Index of the node of the caller */
+        uint64_t calls;
+        uint64_t ticks;         /* Including callees */
+} ProfileNode;
+
+assert_cc(sizeof(ProfileNode) == 24);
+
+#if STUBBLE_PROFILE
+
+/* Stops recording, accounts the functions still running up to now and writes the file */
+void profile_export(EFI_LOADED_IMAGE_PROTOCOL *loaded_image);
+
+#else
+
+static inline void profile_export(EFI_LOADED_IMAGE_PROTOCOL *loaded_image) {}
+
+#endif
@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "efi.h"
+
+#define EFI_MP_SERVICES_PROTOCOL_GUID \
+        GUID_DEF(0x3fdda605, 0xa76e, 0x4f46, 0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08)
+
+#define PROCESSOR_AS_BSP_BIT        0x00000001U
+#define PROCESSOR_ENABLED_BIT       0x00000002U
+#define PROCESSOR_HEALTH_STATUS_BIT 0x00000004U
+
+typedef struct {
+        uint32_t Package;
+        uint32_t Core;
+        uint32_t Thread;
+} EFI_CPU_PHYSICAL_LOCATION;
+
+typedef struct {
+        uint32_t Package;
+        uint32_t Die;
+        uint32_t Tile;
+        uint32_t Module;
+        uint32_t Core;
+        uint32_t Thread;
+} EFI_CPU_PHYSICAL_LOCATION2;
+
+typedef struct {
+        uint64_t ProcessorId;
+        uint32_t StatusFlag;
+        EFI_CPU_PHYSICAL_LOCATION Location;
+        /* Only filled in if requested with CPU_V2_EXTENDED_TOPOLOGY, but firmware written against newer
+         * revisions of the spec may still assume the buffer is this large. */
+        union {
+                EFI_CPU_PHYSICAL_LOCATION2 Location2;
+        } ExtendedInformation;
+} EFI_PROCESSOR_INFORMATION;
+
+typedef void (EFIAPI *EFI_AP_PROCEDURE)(void *ProcedureArgument);
+
+typedef struct EFI_MP_SERVICES_PROTOCOL EFI_MP_SERVICES_PROTOCOL;
+struct EFI_MP_SERVICES_PROTOCOL {
+        EFI_STATUS (EFIAPI *GetNumberOfProcessors)(
+                        EFI_MP_SERVICES_PROTOCOL *This,
+                        size_t *NumberOfProcessors,
+                        size_t *NumberOfEnabledProcessors);
+        EFI_STATUS (EFIAPI *GetProcessorInfo)(
+                        EFI_MP_SERVICES_PROTOCOL *This,
+                        size_t ProcessorNumber,
+                        EFI_PROCESSOR_INFORMATION *ProcessorInfoBuffer);
+        EFI_STATUS (EFIAPI *StartupAllAPs)(
+                        EFI_MP_SERVICES_PROTOCOL *This,
+                        EFI_AP_PROCEDURE Procedure,
+                        bool SingleThread,
+                        EFI_EVENT WaitEvent,
+                        size_t TimeoutInMicroSeconds,
+                        void *ProcedureArgument,
+                        size_t **FailedCpuList);
+        EFI_STATUS (EFIAPI *StartupThisAP)(
+                        EFI_MP_SERVICES_PROTOCOL *This,
+                        EFI_AP_PROCEDURE Procedure,
+                        size_t ProcessorNumber,
+                        EFI_EVENT WaitEvent,
+                        size_t TimeoutInMicroseconds,
+                        void *ProcedureArgument,
+                        bool *Finished);
+        EFI_STATUS (EFIAPI *SwitchBSP)(
+                        EFI_MP_SERVICES_PROTOCOL *This,
+                        size_t ProcessorNumber,
+                        bool EnableOldBSP);
+        EFI_STATUS (EFIAPI *EnableDisableAP)(
+                        EFI_MP_SERVICES_PROTOCOL *This,
+                        size_t ProcessorNumber,
+                        bool EnableAP,
+                        uint32_t *HealthFlag);
+        EFI_STATUS (EFIAPI *WhoAmI)(
+                        EFI_MP_SERVICES_PROTOCOL *This,
+                        size_t *ProcessorNumber);
+};
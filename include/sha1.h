@@ -34,3 +34,22 @@ void sha1_process_bytes(const void *buffer, size_t size, struct sha1_ctx *ctx);
    hash to RESBUF, which should point to 20 bytes of storage.  All
    data written to CTX is erased before returning from the function.  */
 void *sha1_finish_ctx(struct sha1_ctx *ctx, uint8_t result[static SHA1_DIGEST_SIZE]);
+
+/* Size of the buffer sha1_pad() needs for a message of SIZE bytes: the message, the 0x80 byte and the
+   64-bit length, rounded up to the block size.  */
+#define SHA1_PADDED_SIZE(size) ((((size) + 8U) / 64U + 1U) * 64U)
+
+/* Append the SHA1 padding to the SIZE bytes of message at the beginning of BUFFER,
+   which must have room for SHA1_PADDED_SIZE(SIZE) bytes. Returns the number of
+   64 byte blocks of the padded message.  */
+size_t sha1_pad(uint8_t *buffer, size_t size);
+
+/* Hash N independent messages at once, each padded by sha1_pad() and N_BLOCKS[i]
+   blocks long, and write the digest of MESSAGES[i] to RESULTS[i]. The messages are
+   processed in interleaved lanes, which is faster than hashing short messages one
+   after another.  */
+void sha1_batch(
+                const uint8_t *const messages[],
+                const size_t n_blocks[],
+                size_t n,
+                uint8_t results[][SHA1_DIGEST_SIZE]);
@@ -5,6 +5,10 @@
 
 bool smbios_in_hypervisor(void);
 
+/* Returns the SMBIOS structure table as provided by the firmware, and optionally the entry point referring
+ * to it. The 64-bit SMBIOS 3 entry point is preferred over the 32-bit one. */
+const void* smbios_get_raw_table(const void **ret_entry_point, size_t *ret_entry_point_size, uint64_t *ret_size);
+
 const char* smbios_find_oem_string(const char *name, const char *after);
 
 typedef struct RawSmbiosInfo {
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "efi.h"
+#include "proto/graphics-output.h"
+
+/* The .splash section is either a BMP (uncompressed, 24 or 32 bits per pixel), as the UKI specification
+ * has it, or an image pre-converted by tools/splash-convert.py into the pixel layout GOP Blt() takes. The
+ * latter is handed to the firmware straight from the section, the former is converted into a new buffer
+ * first.
+ *
+ * A pre-converted image starts with a SplashHeader, followed at header_size by width * height
+ * EFI_GRAPHICS_OUTPUT_BLT_PIXEL, row by row from the top. All integers are little endian. */
+
+#define SPLASH_MAGIC UINT32_C(0x58524742) /* "BGRX" */
+
+/* Larger images would not fit on any screen anyway */
+#define SPLASH_DIMENSION_MAX 16384U
+
+typedef struct SplashHeader {
+        uint32_t magic;
+        uint32_t header_size;   /* Offset of the pixels, a multiple of 4 */
+        uint32_t width;
+        uint32_t height;
+} _packed_ SplashHeader;
+
+/* Draws the image centered on the screen with a single Blt(), cropping it to the screen if it is larger.
+ * Returns EFI_NOT_FOUND if there is no graphics output. */
+EFI_STATUS splash_show(const void *content, size_t size);
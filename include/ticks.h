@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "efi.h"
+
+/* A cheap, monotonic cycle counter: the TSC on x86, the virtual counter on aarch64. Returns 0 on
+ * architectures where none is available. */
+static inline uint64_t ticks_read(void) {
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+        uint64_t val;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(val));
+        return val;
+#else
+        return 0;
+#endif
+}
+
+/* Ticks per second, or 0 if unknown. */
+uint64_t ticks_freq(void);
+
+/* Converts a tick delta into microseconds, or returns 0 if the frequency is unknown. */
+uint64_t ticks_to_usec(uint64_t ticks);
+
+/* In debug mode or when tracing, logs the time since *start as "phase <name>: <usec> us" and restarts the clock, not counting
+ * the logging itself towards the next phase. tools/bench-qemu.py collects these lines. */
+void log_phase(const char *name, uint64_t *start);
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+#include "efi.h"
+
+/* Binary trace log. With stubble.trace every message the stub logs, including log_debug() ones outside of
+ * debug mode, is recorded into a preallocated buffer as the offset of its format string, a timestamp and
+ * the raw argument words, without formatting anything. Just before handing over to the kernel the buffer is
+ * exported as the StubbleTrace EFI variable, which tools/stubble-trace.py decodes against the stubble ELF.
+ *
+ * The variable starts with a TraceHeader followed by n_records records. Each record is a TraceRecord
+ * followed by n_args argument words. All integers are little endian. Signed arguments are sign extended to
+ * 64 bits, strings and pointers are recorded as addresses, which the decoder can only resolve when they
+ * point into the image itself. */
+
+#define TRACE_MAGIC UINT32_C(0x43525453) /* "STRC" */
+#define TRACE_ARGS_MAX 12U
+
+typedef struct TraceHeader {
+        uint32_t magic;
+        uint32_t header_size;
+        uint32_t n_records;
+        uint32_t n_dropped;     /* Records lost because the buffer was full */
+        uint64_t ticks_freq;    /* 0 if unknown */
+        uint64_t image_base;    /* Address the image ran at, to map pointer arguments back into the ELF */
+} _packed_ TraceHeader;
+
+typedef struct TraceRecord {
+        uint32_t format;        /* Offset of the format string from the start of the image */
+        uint32_t n_args;
+        uint64_t ticks;
+        uint64_t status;        /* For %m */
+        uint64_t args[];
+} TraceRecord;
+
+/* Not packed, so that the arguments can be written in place, but without any padding either */
+assert_cc(sizeof(TraceRecord) == 24);
+
+/* Set by trace_init() until the buffer is exported */
+extern bool log_istrace;
+
+/* Allocates the buffer and enables recording, see stubble.trace */
+void trace_init(void);
+
+void trace_record(EFI_STATUS status, const char *format, va_list ap);
+_gnu_printf_(2, 3) void trace_log(EFI_STATUS status, const char *format, ...);
+
+/* Stops recording and exports what has been recorded so far. Called right before the kernel is started, and
+ * from efi_main() when the stub returns to the firmware instead. Only the first call does anything. */
+void trace_export(void);
@@ -1,8 +1,11 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 #pragma once
 
+#include "arena.h"
+#include "bs-stats.h"
 #include "efi.h"
 #include "memory-util-fundamental.h"
+#include "trace.h"
 
 #include "proto/file-io.h"
 
@@ -22,6 +25,11 @@ static inline void freep(void *p) {
 _malloc_ _alloc_(1) _returns_nonnull_ _warn_unused_result_
 void *xmalloc(size_t size);
 
+/* Like xmalloc(), but served from the arena while it has room. Only for memory that is freed again before
+ * anything else is kept, or that is dropped by an ARENA_SCOPE(), since it is never reclaimed otherwise. */
+_malloc_ _alloc_(1) _returns_nonnull_ _warn_unused_result_
+void *xmalloc_scratch(size_t size);
+
 _malloc_ _alloc_(1) _returns_nonnull_ _warn_unused_result_
 static inline void *xcalloc(size_t size) {
         void *t = xmalloc(size);
@@ -60,6 +68,14 @@ static inline void* xmemdup(const void *p, size_t l) {
 #define xnew(type, n) ((type *) xmalloc_multiply((n), sizeof(type)))
 #define xnew0(type, n) ((type *) xcalloc_multiply((n), sizeof(type)))
 
+_malloc_ _alloc_(1, 2) _returns_nonnull_ _warn_unused_result_
+static inline void *xmalloc_scratch_multiply(size_t n, size_t size) {
+        assert_se(MUL_ASSIGN_SAFE(&size, n));
+        return xmalloc_scratch(size);
+}
+
+#define xnew_scratch(type, n) ((type *) xmalloc_scratch_multiply((n), sizeof(type)))
+
 typedef struct {
         EFI_PHYSICAL_ADDRESS addr;
         size_t n_pages;
@@ -86,8 +102,32 @@ static inline Pages xmalloc_pages(
         };
 }
 
+/* Like xmalloc_pages(), but returns an error instead of failing hard and places the allocation at an
+ * address that is a multiple of 'alignment' (a power of two). For AllocateMaxAddress 'addr' is the highest
+ * address the allocation may end at. */
+EFI_STATUS allocate_aligned_pages(
+                EFI_ALLOCATE_TYPE type,
+                EFI_MEMORY_TYPE memory_type,
+                size_t n_pages,
+                size_t alignment,
+                EFI_PHYSICAL_ADDRESS addr,
+                Pages *ret_pages);
+
 char16_t *mangle_stub_cmdline(char16_t *cmdline);
 
+static inline void file_closep(EFI_FILE **handle) {
+        if (!*handle)
+                return;
+
+        (*handle)->Close(*handle);
+}
+
+#define _cleanup_file_close_ _cleanup_(file_closep)
+
+EFI_STATUS open_volume(EFI_HANDLE device, EFI_FILE **ret_file);
+/* Writes all of buf, handling short writes */
+EFI_STATUS file_write_all(EFI_FILE *handle, const void *buf, size_t size);
+
 /* Note that GUID is evaluated multiple times! */
 #define GUID_FORMAT_STR "%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X"
 #define GUID_FORMAT_VAL(g) (g).Data1, (g).Data2, (g).Data3, (g).Data4[0], (g).Data4[1], \
@@ -132,10 +172,16 @@ void notify_debugger(const char *identity, bool wait);
                 ST = system_table;                                                     \
                 BS = system_table->BootServices;                                       \
                 RT = system_table->RuntimeServices;                                    \
+                bs_stats_init();                                                       \
                 __stack_chk_guard_init();                                              \
                 notify_debugger((identity), (wait_for_debugger));                      \
+                arena_init(ARENA_SIZE);                                                \
                 EFI_STATUS err = func(image);                                          \
+                /* Only reached if the kernel wasn't started, keep the trace of why */  \
+                trace_export();                                                        \
                 log_wait();                                                            \
+                arena_done();                                                          \
+                bs_stats_done();                                                       \
                 return err;                                                            \
         }
 
@@ -144,6 +190,8 @@ static inline bool efi_guid_equal(const EFI_GUID *a, const EFI_GUID *b) {
 }
 
 void *find_configuration_table(const EFI_GUID *guid);
+/* Use this rather than BS->InstallConfigurationTable() directly, so that cached lookups are dropped. */
+EFI_STATUS install_configuration_table(const EFI_GUID *guid, void *table);
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 #  define be16toh(x) __builtin_bswap16(x)
@@ -0,0 +1,474 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* A DEFLATE (RFC 1951) decoder for the gzip compressed payload of EFI zboot kernels. Huffman codes of up to
+ * FAST_BITS bits, which is nearly all of them, are decoded with a single table lookup, longer ones by
+ * walking the canonical code the way zlib's puff.c does. Input is read a word at a time into a 64 bit
+ * buffer and matches are copied a word at a time, which is what it takes to keep up with the memory
+ * bandwidth without SIMD. */
+
+#include "inflate.h"
+#include "unaligned-fundamental.h"
+#include "util.h"
+
+#define MAX_BITS 15U
+#define FAST_BITS 10U
+#define LITLEN_CODES 288U
+#define DIST_CODES 30U
+#define CODELEN_CODES 19U
+
+/* Matches are copied in whole words while there is this much room left in the output */
+#define COPY_SLACK 8U
+
+#define GZIP_FLAG_HCRC 0x02U
+#define GZIP_FLAG_EXTRA 0x04U
+#define GZIP_FLAG_NAME 0x08U
+#define GZIP_FLAG_COMMENT 0x10U
+#define GZIP_FLAGS_RESERVED 0xe0U
+
+typedef struct Huffman {
+        /* Indexed by the next FAST_BITS bits of input: symbol << 4 | code length, 0 if the code is longer */
+        uint16_t fast[1U << FAST_BITS];
+        uint16_t count[MAX_BITS + 1];   /* Number of codes of each length */
+        uint16_t symbol[LITLEN_CODES];  /* Symbols ordered by their code, i.e. by length and then value */
+} Huffman;
+
+typedef struct Inflater {
+        const uint8_t *in, *in_end;
+        size_t overrun;                 /* Zero bytes fed into the bit buffer past in_end */
+        uint64_t bits;                  /* The next bit of input is the least significant one */
+        unsigned n_bits;
+
+        uint8_t *out, *out_start, *out_end;
+
+        Huffman litlen, dist;
+} Inflater;
+
+static const uint16_t length_base[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t length_extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t dist_base[DIST_CODES] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t dist_extra[DIST_CODES] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+static void refill(Inflater *s) {
+        /* Tops the buffer up to at least 56 bits. The word read may hold a few bytes more than are counted
+         * in n_bits, which is fine as the next refill ORs in the very same bytes there. */
+        if (_likely_(s->in_end - s->in >= 8)) {
+                s->bits |= unaligned_read_ne64(s->in) << s->n_bits;
+                s->in += (63 - s->n_bits) >> 3;
+                s->n_bits |= 56;
+                return;
+        }
+
+        while (s->n_bits <= 56) {
+                if (s->in < s->in_end)
+                        s->bits |= (uint64_t) *s->in++ << s->n_bits;
+                else
+                        s->overrun++;
+                s->n_bits += 8;
+        }
+}
+
+static uint32_t getbits(Inflater *s, unsigned n) {
+        if (s->n_bits < n)
+                refill(s);
+
+        uint32_t v = s->bits & ((UINT64_C(1) << n) - 1);
+        s->bits >>= n;
+        s->n_bits -= n;
+        return v;
+}
+
+/* Called at the end of a block: more than a buffer's worth of made up zeroes means the input was cut short */
+static bool truncated(const Inflater *s) {
+        return s->overrun > sizeof(s->bits);
+}
+
+static bool align_to_byte(Inflater *s) {
+        /* Drops the rest of the current byte and hands the whole bytes left in the bit buffer back to the
+         * input, for the parts of the stream that are byte aligned */
+        s->bits >>= s->n_bits & 7;
+        s->n_bits &= ~7U;
+
+        size_t n_bytes = s->n_bits / 8;
+        if (n_bytes < s->overrun)
+                return false;
+
+        s->in -= n_bytes - s->overrun;
+        s->bits = 0;
+        s->n_bits = 0;
+        s->overrun = 0;
+        return true;
+}
+
+static bool huffman_build(Huffman *h, const uint8_t *lengths, size_t n) {
+        uint16_t offs[MAX_BITS + 1];
+
+        assert(n <= LITLEN_CODES);
+
+        memzero(h->count, sizeof(h->count));
+        for (size_t i = 0; i < n; i++)
+                h->count[lengths[i]]++;
+        h->count[0] = 0;
+
+        /* Over-subscribed codes are invalid. Incomplete ones are only used for distance codes with a single
+         * symbol in practice, anything that hits the hole fails to decode. */
+        int left = 1;
+        for (unsigned len = 1; len <= MAX_BITS; len++) {
+                left <<= 1;
+                left -= h->count[len];
+                if (left < 0)
+                        return false;
+        }
+
+        offs[1] = 0;
+        for (unsigned len = 1; len < MAX_BITS; len++)
+                offs[len + 1] = offs[len] + h->count[len];
+        for (size_t i = 0; i < n; i++)
+                if (lengths[i] != 0)
+                        h->symbol[offs[lengths[i]]++] = i;
+
+        /* Codes are assigned in canonical order, i.e. in the order of symbol[], and stored in the stream
+         * starting with their most significant bit. The table is indexed by input bits as they come, hence
+         * by the reversed code, and every entry whose low bits match the code belongs to it. */
+        memzero(h->fast, sizeof(h->fast));
+        uint32_t code = 0;
+        size_t k = 0;
+        for (unsigned len = 1; len <= FAST_BITS; len++) {
+                for (unsigned i = 0; i < h->count[len]; i++, k++, code++) {
+                        uint32_t rev = 0;
+                        for (unsigned b = 0; b < len; b++)
+                                rev |= ((code >> b) & 1U) << (len - 1 - b);
+
+                        uint16_t entry = h->symbol[k] << 4 | len;
+                        for (uint32_t j = rev; j < ELEMENTSOF(h->fast); j += 1U << len)
+                                h->fast[j] = entry;
+                }
+                code <<= 1;
+        }
+
+        return true;
+}
+
+static _noinline_ int decode_slow(Inflater *s, const Huffman *h) {
+        uint64_t bits = s->bits;
+        int code = 0, first = 0, index = 0;
+
+        for (unsigned len = 1; len <= MAX_BITS; len++) {
+                code |= bits & 1;
+                bits >>= 1;
+
+                int count = h->count[len];
+                if (code - count < first) {
+                        s->bits >>= len;
+                        s->n_bits -= len;
+                        return h->symbol[index + (code - first)];
+                }
+
+                index += count;
+                first += count;
+                first <<= 1;
+                code <<= 1;
+        }
+
+        return -1;
+}
+
+static int decode(Inflater *s, const Huffman *h) {
+        if (s->n_bits < MAX_BITS)
+                refill(s);
+
+        uint16_t e = h->fast[s->bits & (ELEMENTSOF(h->fast) - 1)];
+        if (_likely_(e != 0)) {
+                s->bits >>= e & 15;
+                s->n_bits -= e & 15;
+                return e >> 4;
+        }
+
+        return decode_slow(s, h);
+}
+
+static EFI_STATUS inflate_codes(Inflater *s) {
+        for (;;) {
+                int sym = decode(s, &s->litlen);
+                if (sym < 256) {
+                        if (sym < 0)
+                                return EFI_COMPROMISED_DATA;
+                        if (s->out == s->out_end)
+                                return EFI_BUFFER_TOO_SMALL;
+                        *s->out++ = sym;
+                        continue;
+                }
+                if (sym == 256)
+                        return EFI_SUCCESS;
+
+                sym -= 257;
+                if (sym >= (int) ELEMENTSOF(length_base))
+                        return EFI_COMPROMISED_DATA;
+                size_t len = length_base[sym] + getbits(s, length_extra[sym]);
+
+                int dsym = decode(s, &s->dist);
+                if (dsym < 0 || dsym >= (int) DIST_CODES)
+                        return EFI_COMPROMISED_DATA;
+                size_t dist = dist_base[dsym] + getbits(s, dist_extra[dsym]);
+                if (dist > (size_t) (s->out - s->out_start))
+                        return EFI_COMPROMISED_DATA;
+
+                uint8_t *to = s->out;
+                const uint8_t *from = to - dist;
+                size_t room = s->out_end - to;
+
+                if (_likely_(room >= len + COPY_SLACK)) {
+                        size_t step = dist;
+
+                        /* For short distances lay down the first word byte by byte, after that the pattern
+                         * repeats every 'step' bytes, the first multiple of the distance that is at least a
+                         * word. Either way up to a word more than the match is written. */
+                        if (dist < 8) {
+                                for (size_t i = 0; i < 8; i++)
+                                        to[i] = from[i];
+                                while (step < 8)
+                                        step += dist;
+                                for (size_t i = 8; i < len; i += 8)
+                                        unaligned_write_ne64(to + i, unaligned_read_ne64(to + i - step));
+                        } else
+                                for (size_t i = 0; i < len; i += 8)
+                                        unaligned_write_ne64(to + i, unaligned_read_ne64(from + i));
+
+                        s->out += len;
+                        continue;
+                }
+
+                bool full = len > room;
+                len = MIN(len, room);
+                for (size_t i = 0; i < len; i++)
+                        to[i] = from[i];
+                s->out += len;
+                if (full)
+                        return EFI_BUFFER_TOO_SMALL;
+        }
+}
+
+static EFI_STATUS inflate_stored(Inflater *s) {
+        if (!align_to_byte(s) || s->in_end - s->in < 4)
+                return EFI_COMPROMISED_DATA;
+
+        uint16_t len = s->in[0] | s->in[1] << 8, nlen = s->in[2] | s->in[3] << 8;
+        s->in += 4;
+        if (len != (uint16_t) ~nlen || (size_t) (s->in_end - s->in) < len)
+                return EFI_COMPROMISED_DATA;
+
+        size_t n = MIN((size_t) len, (size_t) (s->out_end - s->out));
+        memcpy(s->out, s->in, n);
+        s->out += n;
+        s->in += n;
+
+        return n < len ? EFI_BUFFER_TOO_SMALL : EFI_SUCCESS;
+}
+
+static EFI_STATUS inflate_fixed(Inflater *s) {
+        uint8_t lengths[LITLEN_CODES];
+
+        for (size_t i = 0; i < LITLEN_CODES; i++)
+                lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+        if (!huffman_build(&s->litlen, lengths, LITLEN_CODES))
+                return EFI_COMPROMISED_DATA;
+
+        for (size_t i = 0; i < DIST_CODES; i++)
+                lengths[i] = 5;
+        if (!huffman_build(&s->dist, lengths, DIST_CODES))
+                return EFI_COMPROMISED_DATA;
+
+        return inflate_codes(s);
+}
+
+static EFI_STATUS inflate_dynamic(Inflater *s) {
+        static const uint8_t order[CODELEN_CODES] = {
+                16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+        };
+        uint8_t lengths[LITLEN_CODES + DIST_CODES];
+
+        size_t n_litlen = getbits(s, 5) + 257, n_dist = getbits(s, 5) + 1, n_codelen = getbits(s, 4) + 4;
+        if (n_litlen > 286 || n_dist > DIST_CODES)
+                return EFI_COMPROMISED_DATA;
+
+        memzero(lengths, CODELEN_CODES);
+        for (size_t i = 0; i < n_codelen; i++)
+                lengths[order[i]] = getbits(s, 3);
+
+        /* The code lengths are themselves Huffman coded. That table is only needed until the distance
+         * table is built, so it lives there in the meantime. */
+        if (!huffman_build(&s->dist, lengths, CODELEN_CODES))
+                return EFI_COMPROMISED_DATA;
+
+        for (size_t i = 0; i < n_litlen + n_dist;) {
+                int sym = decode(s, &s->dist);
+                if (sym < 0)
+                        return EFI_COMPROMISED_DATA;
+                if (sym < 16) {
+                        lengths[i++] = sym;
+                        continue;
+                }
+
+                uint8_t len = 0;
+                size_t repeat;
+                if (sym == 16) {
+                        if (i == 0)
+                                return EFI_COMPROMISED_DATA;
+                        len = lengths[i - 1];
+                        repeat = 3 + getbits(s, 2);
+                } else if (sym == 17)
+                        repeat = 3 + getbits(s, 3);
+                else
+                        repeat = 11 + getbits(s, 7);
+
+                if (i + repeat > n_litlen + n_dist)
+                        return EFI_COMPROMISED_DATA;
+                while (repeat-- > 0)
+                        lengths[i++] = len;
+        }
+
+        /* Without an end of block code the block would never end */
+        if (lengths[256] == 0)
+                return EFI_COMPROMISED_DATA;
+
+        if (!huffman_build(&s->litlen, lengths, n_litlen) ||
+            !huffman_build(&s->dist, lengths + n_litlen, n_dist))
+                return EFI_COMPROMISED_DATA;
+
+        return inflate_codes(s);
+}
+
+static uint32_t crc32_table[8][256];
+
+static uint32_t crc32(const uint8_t *p, size_t n) {
+        /* Slicing by 8, the table is built on first use */
+        if (crc32_table[0][1] == 0) {
+                for (uint32_t i = 0; i < 256; i++) {
+                        uint32_t c = i;
+                        for (unsigned k = 0; k < 8; k++)
+                                c = c & 1 ? UINT32_C(0xedb88320) ^ (c >> 1) : c >> 1;
+                        crc32_table[0][i] = c;
+                }
+                for (uint32_t i = 0; i < 256; i++)
+                        for (unsigned k = 1; k < 8; k++)
+                                crc32_table[k][i] = (crc32_table[k - 1][i] >> 8) ^
+                                                    crc32_table[0][crc32_table[k - 1][i] & 0xff];
+        }
+
+        uint32_t c = UINT32_MAX;
+        for (; n >= 8; n -= 8, p += 8) {
+                uint64_t v = unaligned_read_ne64(p) ^ c;
+                c = crc32_table[7][v & 0xff] ^ crc32_table[6][(v >> 8) & 0xff] ^
+                    crc32_table[5][(v >> 16) & 0xff] ^ crc32_table[4][(v >> 24) & 0xff] ^
+                    crc32_table[3][(v >> 32) & 0xff] ^ crc32_table[2][(v >> 40) & 0xff] ^
+                    crc32_table[1][(v >> 48) & 0xff] ^ crc32_table[0][v >> 56];
+        }
+        for (; n > 0; n--, p++)
+                c = crc32_table[0][(c ^ *p) & 0xff] ^ (c >> 8);
+
+        return ~c;
+}
+
+static EFI_STATUS gzip_skip_header(const uint8_t **p, const uint8_t *end) {
+        const uint8_t *q = *p;
+
+        if (end - q < 10 || q[0] != 0x1f || q[1] != 0x8b || q[2] != 8 /* deflate */)
+                return EFI_UNSUPPORTED;
+
+        uint8_t flags = q[3];
+        if (flags & GZIP_FLAGS_RESERVED)
+                return EFI_UNSUPPORTED;
+        q += 10;
+
+        if (flags & GZIP_FLAG_EXTRA) {
+                if (end - q < 2 || end - q - 2 < (q[0] | q[1] << 8))
+                        return EFI_COMPROMISED_DATA;
+                q += 2 + (q[0] | q[1] << 8);
+        }
+
+        for (uint8_t f = GZIP_FLAG_NAME; f <= GZIP_FLAG_COMMENT; f <<= 1) {
+                if (!(flags & f))
+                        continue;
+                while (q < end && *q != '\0')
+                        q++;
+                if (q == end)
+                        return EFI_COMPROMISED_DATA;
+                q++;
+        }
+
+        if (flags & GZIP_FLAG_HCRC) {
+                if (end - q < 2)
+                        return EFI_COMPROMISED_DATA;
+                q += 2;
+        }
+
+        *p = q;
+        return EFI_SUCCESS;
+}
+
+EFI_STATUS gzip_decompress(const void *src, size_t src_size, void *dst, size_t dst_size, size_t *ret_size) {
+        EFI_STATUS err;
+
+        assert(src || src_size == 0);
+        assert(dst || dst_size == 0);
+        assert(ret_size);
+
+        Inflater s = {
+                .in = src,
+                .in_end = (const uint8_t *) src + src_size,
+                .out = dst,
+                .out_start = dst,
+                .out_end = (uint8_t *) dst + dst_size,
+        };
+
+        err = gzip_skip_header(&s.in, s.in_end);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        bool last;
+        do {
+                last = getbits(&s, 1);
+                switch (getbits(&s, 2)) {
+                case 0:
+                        err = inflate_stored(&s);
+                        break;
+                case 1:
+                        err = inflate_fixed(&s);
+                        break;
+                case 2:
+                        err = inflate_dynamic(&s);
+                        break;
+                default:
+                        err = EFI_COMPROMISED_DATA;
+                }
+
+                if (truncated(&s))
+                        return EFI_COMPROMISED_DATA;
+                if (err == EFI_BUFFER_TOO_SMALL)
+                        *ret_size = s.out - s.out_start;
+                if (err != EFI_SUCCESS)
+                        return err;
+        } while (!last);
+
+        if (!align_to_byte(&s) || s.in_end - s.in < 8)
+                return EFI_COMPROMISED_DATA;
+
+        size_t size = s.out - s.out_start;
+        if (unaligned_read_ne32(s.in + 4) != (uint32_t) size ||
+            unaligned_read_ne32(s.in) != crc32(s.out_start, size))
+                return EFI_COMPROMISED_DATA;
+
+        *ret_size = size;
+        return EFI_SUCCESS;
+}
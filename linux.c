@@ -9,11 +9,16 @@
  */
 
 #include "efi-log.h"
+#include "inflate.h"
 #include "initrd.h"
 #include "linux.h"
+#include "mp.h"
 #include "pe.h"
+#include "profile.h"
 #include "proto/device-path.h"
 #include "proto/loaded-image.h"
+#include "ticks.h"
+#include "trace.h"
 #include "util.h"
 
 typedef struct {
@@ -21,6 +26,321 @@ typedef struct {
         EFI_DEVICE_PATH end_path;
 } _packed_ KERNEL_FILE_PATH;
 
+/* The header of EFI zboot images, a PE wrapper with its own EFI stub that decompresses the actual kernel
+ * image from its payload, see drivers/firmware/efi/libstub/zboot-header.S in the kernel tree. */
+#define ZBOOT_IMAGE_TYPE "zimg"
+
+typedef struct ZbootHeader {
+        uint8_t mz_magic[4];
+        char image_type[4];
+        uint32_t payload_offset;
+        uint32_t payload_size;
+        uint32_t reserved[2];
+        char comp_type[32];
+        uint32_t linux_pe_magic;
+        uint32_t pe_header_offset;
+} _packed_ ZbootHeader;
+
+assert_cc(offsetof(ZbootHeader, linux_pe_magic) == 0x38);
+
+/* How much of the decompressed kernel is looked at before it is placed: enough for the PE headers and the
+ * section table */
+#define ZBOOT_PEEK_SIZE 4096U
+
+/* Where the inner kernel image should be placed so that its own EFI stub can run it in place, instead of
+ * copying the whole image once more before it starts. */
+typedef struct KernelPlacement {
+        size_t alignment;                       /* Minimum alignment of the image base */
+        EFI_PHYSICAL_ADDRESS max_address;       /* Highest address the image may occupy, 0 if unrestricted */
+        EFI_PHYSICAL_ADDRESS preferred_address; /* Where the kernel was linked to run, 0 if it doesn't care */
+        size_t min_size;                        /* How much memory the kernel needs at its base to start up */
+} KernelPlacement;
+
+#if defined(__x86_64__) || defined(__i386__)
+/* The parts of the setup header of the x86 boot protocol we are interested in, see
+ * Documentation/arch/x86/boot.rst in the kernel tree. It sits at a fixed offset in the bzImage, which is
+ * also the PE image. */
+#define SETUP_HEADER_OFFSET 0x1f1U
+#define SETUP_HEADER_MAGIC UINT32_C(0x53726448) /* "HdrS" */
+#define SETUP_BOOT_FLAG UINT16_C(0xAA55)
+
+typedef struct SetupHeader {
+        uint8_t setup_sects;
+        uint8_t _pad1[0x1fe - 0x1f2];
+        uint16_t boot_flag;
+        uint8_t _pad2[2];
+        uint32_t header;
+        uint16_t version;
+        uint8_t _pad3[0x230 - 0x208];
+        uint32_t kernel_alignment;
+        uint8_t relocatable_kernel;
+        uint8_t min_alignment;
+        uint16_t xloadflags;
+        uint8_t _pad4[0x258 - 0x238];
+        uint64_t pref_address;          /* Since protocol 2.10 */
+        uint32_t init_size;             /* Since protocol 2.10 */
+} _packed_ SetupHeader;
+
+assert_cc(offsetof(SetupHeader, boot_flag) == 0x1fe - SETUP_HEADER_OFFSET);
+assert_cc(offsetof(SetupHeader, header) == 0x202 - SETUP_HEADER_OFFSET);
+assert_cc(offsetof(SetupHeader, kernel_alignment) == 0x230 - SETUP_HEADER_OFFSET);
+assert_cc(offsetof(SetupHeader, pref_address) == 0x258 - SETUP_HEADER_OFFSET);
+assert_cc(offsetof(SetupHeader, init_size) == 0x260 - SETUP_HEADER_OFFSET);
+
+static const SetupHeader *kernel_setup_header(const struct iovec *kernel) {
+        assert(kernel);
+
+        if (kernel->iov_len < SETUP_HEADER_OFFSET + sizeof(SetupHeader))
+                return NULL;
+
+        const SetupHeader *hdr = (const SetupHeader *) ((const uint8_t *) kernel->iov_base + SETUP_HEADER_OFFSET);
+        if (hdr->boot_flag != SETUP_BOOT_FLAG || hdr->header != SETUP_HEADER_MAGIC || hdr->version < 0x020a)
+                return NULL;
+
+        return hdr;
+}
+#endif
+
+static KernelPlacement kernel_placement(const struct iovec *kernel, uint32_t section_alignment) {
+        KernelPlacement p = {
+                .alignment = EFI_PAGE_SIZE,
+        };
+
+        assert(kernel);
+
+        /* The PE header carries the alignment the image was linked for. Ignore it if it is bogus. */
+        if (ISPOWEROF2(section_alignment))
+                p.alignment = MAX(p.alignment, (size_t) section_alignment);
+
+#if defined(__aarch64__)
+        /* The arm64 EFI stub moves the Image to a fresh allocation unless it is already 2 MiB aligned
+         * (MIN_KIMG_ALIGN), see efi_relocate_kernel() in drivers/firmware/efi/libstub/arm64-stub.c */
+        p.alignment = MAX(p.alignment, (size_t) (2U * 1024U * 1024U));
+#elif defined(__x86_64__) || defined(__i386__)
+        /* The x86 boot protocol historically requires the kernel to live below 4 GiB, and the EFI stub
+         * relocates the image there otherwise. */
+        p.max_address = UINT32_MAX;
+
+        /* Older x86 EFI stubs also relocate the image unless it sits at or above the address the kernel was
+         * linked for, and the decompressor then needs init_size bytes from the kernel_alignment aligned
+         * base to decompress in place. The setup header has all of that. */
+        const SetupHeader *hdr = kernel_setup_header(kernel);
+        if (hdr) {
+                if (ISPOWEROF2(hdr->kernel_alignment))
+                        p.alignment = MAX(p.alignment, (size_t) hdr->kernel_alignment);
+                if (hdr->pref_address < p.max_address)
+                        p.preferred_address = hdr->pref_address;
+                p.min_size = hdr->init_size;
+        }
+#endif
+
+        return p;
+}
+
+static EFI_STATUS kernel_allocate(
+                const struct iovec *kernel,
+                size_t size_in_memory,
+                uint32_t section_alignment,
+                Pages *ret_pages) {
+
+        EFI_STATUS err;
+
+        assert(kernel);
+        assert(ret_pages);
+
+        KernelPlacement p = kernel_placement(kernel, section_alignment);
+        size_t n_pages = EFI_SIZE_TO_PAGES(MAX(size_in_memory, p.min_size));
+
+        /* Right where the kernel was linked to run, nothing needs to move at all */
+        if (p.preferred_address != 0 && p.preferred_address % p.alignment == 0) {
+                err = allocate_aligned_pages(
+                                AllocateAddress, EfiLoaderCode, n_pages, p.alignment, p.preferred_address, ret_pages);
+                if (err == EFI_SUCCESS) {
+                        log_debug("Placing kernel at its preferred address 0x%" PRIx64, ret_pages->addr);
+                        return EFI_SUCCESS;
+                }
+
+                log_debug("Preferred kernel address 0x%" PRIx64 " is not available: %m", p.preferred_address);
+        }
+
+        err = allocate_aligned_pages(
+                        p.max_address != 0 ? AllocateMaxAddress : AllocateAnyPages,
+                        EfiLoaderCode,
+                        n_pages,
+                        p.alignment,
+                        p.max_address,
+                        ret_pages);
+        if (err == EFI_SUCCESS) {
+                log_debug("Placing kernel at 0x%" PRIx64 " (alignment 0x%zx, limit 0x%" PRIx64 ")",
+                          ret_pages->addr, p.alignment, p.max_address);
+                if (ret_pages->addr < p.preferred_address)
+                        log_debug("Kernel is placed below 0x%" PRIx64 ", it will relocate itself.",
+                                  p.preferred_address);
+                return EFI_SUCCESS;
+        }
+
+        /* Not fatal, the kernel stub will move itself where it wants to be. It only costs another copy. */
+        log_debug("Cannot satisfy preferred kernel placement, falling back to any address: %m");
+        return allocate_aligned_pages(
+                        AllocateAnyPages,
+                        EfiLoaderCode,
+                        EFI_SIZE_TO_PAGES(size_in_memory),
+                        EFI_PAGE_SIZE,
+                        0,
+                        ret_pages);
+}
+
+/* Decompresses the kernel of a zboot image right into its final, aligned place, so that it runs where it is
+ * instead of the wrapper's stub decompressing it into yet another allocation. Only gzip payloads holding an
+ * image that is laid out in the file the way it runs in memory are handled, like the arm64 and RISC-V Image.
+ * Returns EFI_UNSUPPORTED for anything else, which is then started as it is. */
+static EFI_STATUS kernel_load_zboot(
+                const struct iovec *kernel,
+                Pages *ret_pages,
+                struct iovec *ret_file,
+                size_t *ret_size_in_memory,
+                uint32_t *ret_entry_point) {
+
+        EFI_STATUS err;
+
+        assert(kernel);
+        assert(ret_pages);
+        assert(ret_file);
+        assert(ret_size_in_memory);
+        assert(ret_entry_point);
+
+        if (kernel->iov_len < sizeof(ZbootHeader))
+                return EFI_UNSUPPORTED;
+
+        const ZbootHeader *z = kernel->iov_base;
+        if (memcmp(z->mz_magic, "MZ", 2) != 0 || memcmp(z->image_type, ZBOOT_IMAGE_TYPE, 4) != 0)
+                return EFI_UNSUPPORTED;
+        if (z->payload_offset > kernel->iov_len || z->payload_size > kernel->iov_len - z->payload_offset)
+                return log_error_status(EFI_LOAD_ERROR, "zboot payload lies outside of the kernel image.");
+        if (!strneq8(z->comp_type, "gzip", sizeof(z->comp_type))) {
+                log_debug("zboot payload is compressed with %.*s, leaving it to the kernel's own stub.",
+                          (int) sizeof(z->comp_type), z->comp_type);
+                return EFI_UNSUPPORTED;
+        }
+
+        const uint8_t *payload = (const uint8_t *) kernel->iov_base + z->payload_offset;
+        _cleanup_free_ uint8_t *peek = xmalloc(ZBOOT_PEEK_SIZE);
+        size_t peek_size;
+        err = gzip_decompress(payload, z->payload_size, peek, ZBOOT_PEEK_SIZE, &peek_size);
+        if (!IN_SET(err, EFI_SUCCESS, EFI_BUFFER_TOO_SMALL))
+                return log_error_status(err, "Cannot decompress zboot payload: %m");
+
+        PeImage pe;
+        err = pe_image_parse(peek, peek_size, /* allow_compatibility= */ true, &pe);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Bad kernel image in zboot payload: %m");
+
+        /* Whatever the kernel itself can't be started for, the wrapper may still have an answer to */
+        err = pe_image_check_kernel(&pe);
+        if (err == EFI_UNSUPPORTED) {
+                log_debug("Kernel in zboot payload is not supported, leaving it to the kernel's own stub.");
+                return EFI_UNSUPPORTED;
+        }
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Bad kernel image in zboot payload: %m");
+
+        FOREACH_ARRAY(h, pe.sections, pe.n_sections) {
+                if (h->PointerToRelocations != 0)
+                        return log_error_status(EFI_LOAD_ERROR, "Inner kernel image contains sections with relocations, which we do not support.");
+                if (h->SizeOfRawData == 0)
+                        continue;
+
+                if (pe.image_base != 0 || h->VirtualAddress != h->PointerToRawData) {
+                        log_debug("Kernel in zboot payload is not laid out the way it runs, leaving it to the kernel's own stub.");
+                        return EFI_UNSUPPORTED;
+                }
+                if ((uint64_t) h->VirtualAddress + MAX(h->VirtualSize, h->SizeOfRawData) > pe.size_of_image)
+                        return log_error_status(EFI_LOAD_ERROR, "Section would write outside of memory");
+        }
+
+        _cleanup_pages_ Pages pages = {};
+        err = kernel_allocate(&IOVEC_MAKE(peek, peek_size), pe.size_of_image, pe.section_alignment, &pages);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Cannot allocate memory for kernel image: %m");
+
+        /* The output doubles as the window of the decompressor, there is no intermediate copy */
+        uint8_t *image = PHYSICAL_ADDRESS_TO_POINTER(pages.addr);
+        size_t image_size;
+        err = gzip_decompress(payload, z->payload_size, image, pe.size_of_image, &image_size);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Cannot decompress zboot payload: %m");
+
+        memzero(image + image_size, pe.size_of_image - image_size);
+        FOREACH_ARRAY(h, pe.sections, pe.n_sections)
+                if (h->SizeOfRawData != 0 && h->VirtualSize > h->SizeOfRawData)
+                        memzero(image + h->VirtualAddress + h->SizeOfRawData, h->VirtualSize - h->SizeOfRawData);
+
+        log_debug("Decompressed %zu bytes of kernel from zboot payload of %" PRIu32 " bytes.",
+                  image_size, z->payload_size);
+
+        *ret_pages = TAKE_STRUCT(pages);
+        *ret_file = IOVEC_MAKE(image, image_size);
+        *ret_size_in_memory = pe.size_of_image;
+        *ret_entry_point = pe.entry_point;
+        return EFI_SUCCESS;
+}
+
+/* Copies the sections of a plain PE kernel into their final place */
+static EFI_STATUS kernel_load_pe(
+                const struct iovec *kernel,
+                Pages *ret_pages,
+                struct iovec *ret_file,
+                size_t *ret_size_in_memory,
+                uint32_t *ret_entry_point) {
+
+        EFI_STATUS err;
+
+        assert(kernel);
+        assert(ret_pages);
+        assert(ret_file);
+        assert(ret_size_in_memory);
+        assert(ret_entry_point);
+
+        PeImage pe;
+        err = pe_image_parse(kernel->iov_base, kernel->iov_len, /* allow_compatibility= */ true, &pe);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Bad kernel image: %m");
+
+        err = pe_image_check_kernel(&pe);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Bad kernel image: %m");
+
+        _cleanup_pages_ Pages loaded_kernel_pages = {};
+        err = kernel_allocate(kernel, pe.size_of_image, pe.section_alignment, &loaded_kernel_pages);
+        if (err != EFI_SUCCESS)
+                return log_error_status(err, "Cannot allocate memory for kernel image: %m");
+
+        uint8_t* loaded_kernel = PHYSICAL_ADDRESS_TO_POINTER(loaded_kernel_pages.addr);
+        FOREACH_ARRAY(h, pe.sections, pe.n_sections) {
+                if (h->PointerToRelocations != 0)
+                        return log_error_status(EFI_LOAD_ERROR, "Inner kernel image contains sections with relocations, which we do not support.");
+                if (h->SizeOfRawData == 0)
+                        continue;
+
+                if (h->PointerToRawData > kernel->iov_len || h->SizeOfRawData > kernel->iov_len - h->PointerToRawData)
+                        return log_error_status(EFI_LOAD_ERROR, "Section lies outside of the kernel image");
+                if ((h->VirtualAddress < pe.image_base)
+                    || (h->VirtualAddress - pe.image_base + h->SizeOfRawData > pe.size_of_image))
+                        return log_error_status(EFI_LOAD_ERROR, "Section would write outside of memory");
+                mp_memcpy(loaded_kernel + h->VirtualAddress - pe.image_base,
+                          (const uint8_t*)kernel->iov_base + h->PointerToRawData,
+                          h->SizeOfRawData);
+                memzero(loaded_kernel + h->VirtualAddress + h->SizeOfRawData,
+                        h->VirtualSize - h->SizeOfRawData);
+        }
+
+        *ret_pages = TAKE_STRUCT(loaded_kernel_pages);
+        *ret_file = *kernel;
+        *ret_size_in_memory = pe.size_of_image;
+        *ret_entry_point = pe.entry_point;
+        return EFI_SUCCESS;
+}
+
 EFI_STATUS linux_exec(
                 EFI_HANDLE parent_image,
                 const char16_t *cmdline,
@@ -29,18 +349,14 @@ EFI_STATUS linux_exec(
 
         EFI_LOADED_IMAGE_PROTOCOL original_parent_loaded_image;
         size_t kernel_size_in_memory = 0;
-        uint32_t entry_point;
-        uint64_t image_base;
+        uint32_t entry_point = 0;
+        uint64_t phase = ticks_read();
         EFI_STATUS err;
 
         assert(parent_image);
         assert(iovec_is_set(kernel));
         assert(iovec_is_valid(initrd));
 
-        err = pe_kernel_info(kernel->iov_base, &entry_point, &image_base, &kernel_size_in_memory);
-        if (err != EFI_SUCCESS)
-                return log_error_status(err, "Bad kernel image: %m");
-
         /* Re-use the parent_image(_handle) and parent_loaded_image for the kernel image we are about to execute.
          * We have to do this, because if kernel stub code passes its own handle to certain firmware functions,
          * the firmware could cast EFI_LOADED_IMAGE_PROTOCOL * to a larger struct to access its own private data,
@@ -52,38 +368,14 @@ EFI_STATUS linux_exec(
         if (err != EFI_SUCCESS)
                 return log_error_status(err, "Cannot get parent loaded image: %m");
 
-        err = pe_kernel_check_no_relocation(kernel->iov_base);
+        _cleanup_pages_ Pages loaded_kernel_pages = {};
+        struct iovec kernel_file = {};
+        err = kernel_load_zboot(kernel, &loaded_kernel_pages, &kernel_file, &kernel_size_in_memory, &entry_point);
+        if (err == EFI_UNSUPPORTED)
+                err = kernel_load_pe(kernel, &loaded_kernel_pages, &kernel_file, &kernel_size_in_memory, &entry_point);
         if (err != EFI_SUCCESS)
                 return err;
-
-        const PeSectionHeader *headers;
-        size_t n_headers;
-
-        /* Do we need to validate anything here? the len? */
-        err = pe_section_table_from_base(kernel->iov_base, &headers, &n_headers);
-        if (err != EFI_SUCCESS)
-                return log_error_status(err, "Cannot read sections: %m");
-
-        /* Do we need to ensure under 4gb address on x86? */
-        _cleanup_pages_ Pages loaded_kernel_pages = xmalloc_pages(
-                        AllocateAnyPages, EfiLoaderCode, EFI_SIZE_TO_PAGES(kernel_size_in_memory), 0);
-
-        uint8_t* loaded_kernel = PHYSICAL_ADDRESS_TO_POINTER(loaded_kernel_pages.addr);
-        FOREACH_ARRAY(h, headers, n_headers) {
-                if (h->PointerToRelocations != 0)
-                        return log_error_status(EFI_LOAD_ERROR, "Inner kernel image contains sections with relocations, which we do not support.");
-                if (h->SizeOfRawData == 0)
-                        continue;
-
-                if ((h->VirtualAddress < image_base)
-                    || (h->VirtualAddress - image_base + h->SizeOfRawData > kernel_size_in_memory))
-                        return log_error_status(EFI_LOAD_ERROR, "Section would write outside of memory");
-                memcpy(loaded_kernel + h->VirtualAddress - image_base,
-                       (const uint8_t*)kernel->iov_base + h->PointerToRawData,
-                       h->SizeOfRawData);
-                memzero(loaded_kernel + h->VirtualAddress + h->SizeOfRawData,
-                        h->VirtualSize - h->SizeOfRawData);
-        }
+        log_phase("kernel_copy", &phase);
 
         _cleanup_free_ KERNEL_FILE_PATH *kernel_file_path = xnew(KERNEL_FILE_PATH, 1);
 
@@ -91,8 +383,8 @@ EFI_STATUS linux_exec(
         kernel_file_path->memmap_path.Header.SubType = HW_MEMMAP_DP;
         kernel_file_path->memmap_path.Header.Length = sizeof (MEMMAP_DEVICE_PATH);
         kernel_file_path->memmap_path.MemoryType = EfiLoaderData;
-        kernel_file_path->memmap_path.StartingAddress = POINTER_TO_PHYSICAL_ADDRESS(kernel->iov_base);
-        kernel_file_path->memmap_path.EndingAddress = POINTER_TO_PHYSICAL_ADDRESS(kernel->iov_base) + kernel->iov_len;
+        kernel_file_path->memmap_path.StartingAddress = POINTER_TO_PHYSICAL_ADDRESS(kernel_file.iov_base);
+        kernel_file_path->memmap_path.EndingAddress = POINTER_TO_PHYSICAL_ADDRESS(kernel_file.iov_base) + kernel_file.iov_len;
 
         kernel_file_path->end_path.Type = END_DEVICE_PATH_TYPE;
         kernel_file_path->end_path.SubType = END_ENTIRE_DEVICE_PATH_SUBTYPE;
@@ -100,7 +392,7 @@ EFI_STATUS linux_exec(
 
         original_parent_loaded_image = *parent_loaded_image;
         parent_loaded_image->FilePath = &kernel_file_path->memmap_path.Header;
-        parent_loaded_image->ImageBase = loaded_kernel;
+        parent_loaded_image->ImageBase = PHYSICAL_ADDRESS_TO_POINTER(loaded_kernel_pages.addr);
         parent_loaded_image->ImageSize = kernel_size_in_memory;
 
         if (cmdline) {
@@ -112,7 +404,10 @@ EFI_STATUS linux_exec(
         err = initrd_register(initrd->iov_base, initrd->iov_len, &initrd_handle);
         if (err != EFI_SUCCESS)
                 return log_error_status(err, "Error registering initrd: %m");
+        log_phase("initrd", &phase);
 
+        trace_export();
+        profile_export(parent_loaded_image);
         log_wait();
 
         EFI_IMAGE_ENTRY_POINT entry =
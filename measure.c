@@ -7,6 +7,38 @@
 #include "tpm2-pcr.h"
 #include "util.h"
 
+/* Enough for the events of a typical description, larger ones grow the buffer */
+#define MEASURE_EVENT_SIZE_MIN 512U
+/* PCRs whose CC measurement register is cached */
+#define MEASURE_PCRS_MAX 32U
+
+/* The state of measuring during one boot: what the firmware provides is looked up once, and every event is
+ * built in the same buffer. */
+static struct {
+        bool probed;
+        EFI_TCG2_PROTOCOL *tcg2;
+        EFI_CC_MEASUREMENT_PROTOCOL *cc;
+
+        bool have_active_pcr_banks;
+        uint32_t active_pcr_banks;
+
+        uint32_t cc_mr_valid;           /* Bit mask of the PCRs set in cc_mr */
+        uint32_t cc_mr[MEASURE_PCRS_MAX];
+
+        void *event;
+        size_t event_size;
+} session;
+
+static void *event_buffer(size_t size) {
+        if (size > session.event_size) {
+                free(session.event);
+                session.event_size = MAX(size, MEASURE_EVENT_SIZE_MIN);
+                session.event = xmalloc(session.event_size);
+        }
+
+        return session.event;
+}
+
 static EFI_STATUS tpm2_measure_to_pcr_and_tagged_event_log(
                 EFI_TCG2_PROTOCOL *tcg,
                 uint32_t pcrindex,
@@ -15,10 +47,10 @@ static EFI_STATUS tpm2_measure_to_pcr_and_tagged_event_log(
                 uint32_t event_id,
                 const char16_t *description) {
 
-        _cleanup_free_ union event {
+        union event {
                 EFI_TCG2_EVENT tcg_event;
                 EFI_TCG2_TAGGED_EVENT tcg_tagged_event;
-        } *event = NULL;
+        } *event;
         size_t desc_len, event_size;
 
         assert(tcg);
@@ -29,7 +61,7 @@ static EFI_STATUS tpm2_measure_to_pcr_and_tagged_event_log(
         desc_len = strsize16(description);
         event_size = offsetof(EFI_TCG2_TAGGED_EVENT, Event) + desc_len;
 
-        event = xmalloc(event_size);
+        event = event_buffer(event_size);
         event->tcg_tagged_event = (EFI_TCG2_TAGGED_EVENT) {
                 .Size = event_size,
                 .Header.HeaderSize = sizeof(EFI_TCG2_EVENT_HEADER),
@@ -41,11 +73,14 @@ static EFI_STATUS tpm2_measure_to_pcr_and_tagged_event_log(
         };
         memcpy(event->tcg_tagged_event.Event, description, desc_len);
 
-        return tcg->HashLogExtendEvent(
-                        tcg,
-                        0,
-                        buffer, buffer_size,
-                        &event->tcg_event);
+        EFI_STATUS err;
+        BS_STATS_TRACK(BS_STATS_TCG2_HASH_LOG_EXTEND_EVENT, buffer_size,
+                       err = tcg->HashLogExtendEvent(
+                                       tcg,
+                                       0,
+                                       buffer, buffer_size,
+                                       &event->tcg_event));
+        return err;
 }
 
 static EFI_STATUS tpm2_measure_to_pcr_and_ipl_event_log(
@@ -55,7 +90,7 @@ static EFI_STATUS tpm2_measure_to_pcr_and_ipl_event_log(
                 uint64_t buffer_size,
                 const char16_t *description) {
 
-        _cleanup_free_ EFI_TCG2_EVENT *tcg_event = NULL;
+        EFI_TCG2_EVENT *tcg_event;
         size_t desc_len;
 
         assert(tcg);
@@ -67,7 +102,7 @@ static EFI_STATUS tpm2_measure_to_pcr_and_ipl_event_log(
          * of our choosing that makes clear what precisely we are measuring here. See above. */
 
         desc_len = strsize16(description);
-        tcg_event = xmalloc(offsetof(EFI_TCG2_EVENT, Event) + desc_len);
+        tcg_event = event_buffer(offsetof(EFI_TCG2_EVENT, Event) + desc_len);
         *tcg_event = (EFI_TCG2_EVENT) {
                 .Size = offsetof(EFI_TCG2_EVENT, Event) + desc_len,
                 .Header.HeaderSize = sizeof(EFI_TCG2_EVENT_HEADER),
@@ -78,11 +113,14 @@ static EFI_STATUS tpm2_measure_to_pcr_and_ipl_event_log(
 
         memcpy(tcg_event->Event, description, desc_len);
 
-        return tcg->HashLogExtendEvent(
-                        tcg,
-                        0,
-                        buffer, buffer_size,
-                        tcg_event);
+        EFI_STATUS err;
+        BS_STATS_TRACK(BS_STATS_TCG2_HASH_LOG_EXTEND_EVENT, buffer_size,
+                       err = tcg->HashLogExtendEvent(
+                                       tcg,
+                                       0,
+                                       buffer, buffer_size,
+                                       tcg_event));
+        return err;
 }
 
 static EFI_STATUS cc_measure_to_mr_and_ipl_event_log(
@@ -92,7 +130,7 @@ static EFI_STATUS cc_measure_to_mr_and_ipl_event_log(
                 uint64_t buffer_size,
                 const char16_t *description) {
 
-        _cleanup_free_ EFI_CC_EVENT *event = NULL;
+        EFI_CC_EVENT *event;
         uint32_t mr;
         EFI_STATUS err;
         size_t desc_len;
@@ -102,13 +140,24 @@ static EFI_STATUS cc_measure_to_mr_and_ipl_event_log(
 
         /* MapPcrToMrIndex service provides callers information on
          * how the TPM PCR registers are mapped to the CC measurement
-         * registers (MR) in the vendor implementation. */
-        err = cc->MapPcrToMrIndex(cc, pcrindex, &mr);
-        if (err != EFI_SUCCESS)
-                return EFI_NOT_FOUND;
+         * registers (MR) in the vendor implementation. The mapping
+         * doesn't change, so ask once per PCR. */
+        if (pcrindex < MEASURE_PCRS_MAX && FLAGS_SET(session.cc_mr_valid, UINT32_C(1) << pcrindex))
+                mr = session.cc_mr[pcrindex];
+        else {
+                BS_STATS_TRACK(BS_STATS_CC_MAP_PCR_TO_MR_INDEX, 0,
+                               err = cc->MapPcrToMrIndex(cc, pcrindex, &mr));
+                if (err != EFI_SUCCESS)
+                        return EFI_NOT_FOUND;
+
+                if (pcrindex < MEASURE_PCRS_MAX) {
+                        session.cc_mr[pcrindex] = mr;
+                        session.cc_mr_valid |= UINT32_C(1) << pcrindex;
+                }
+        }
 
         desc_len = strsize16(description);
-        event = xmalloc(offsetof(EFI_CC_EVENT, Event) + desc_len);
+        event = event_buffer(offsetof(EFI_CC_EVENT, Event) + desc_len);
         *event = (EFI_CC_EVENT) {
                 .Size = offsetof(EFI_CC_EVENT, Event) + desc_len,
                 .Header.HeaderSize = sizeof(EFI_CC_EVENT_HEADER),
@@ -119,12 +168,14 @@ static EFI_STATUS cc_measure_to_mr_and_ipl_event_log(
 
         memcpy(event->Event, description, desc_len);
 
-        return cc->HashLogExtendEvent(
-                        cc,
-                        0,
-                        buffer,
-                        buffer_size,
-                        event);
+        BS_STATS_TRACK(BS_STATS_CC_HASH_LOG_EXTEND_EVENT, buffer_size,
+                       err = cc->HashLogExtendEvent(
+                                       cc,
+                                       0,
+                                       buffer,
+                                       buffer_size,
+                                       event));
+        return err;
 }
 
 static EFI_CC_MEASUREMENT_PROTOCOL *cc_interface_check(void) {
@@ -138,7 +189,8 @@ static EFI_CC_MEASUREMENT_PROTOCOL *cc_interface_check(void) {
         if (err != EFI_SUCCESS)
                 return NULL;
 
-        err = cc->GetCapability(cc, &capability);
+        BS_STATS_TRACK(BS_STATS_CC_GET_CAPABILITY, 0,
+                       err = cc->GetCapability(cc, &capability));
         if (err != EFI_SUCCESS)
                 return NULL;
 
@@ -159,7 +211,8 @@ static EFI_TCG2_PROTOCOL *tcg2_interface_check(void) {
         if (err != EFI_SUCCESS)
                 return NULL;
 
-        err = tcg->GetCapability(tcg, &capability);
+        BS_STATS_TRACK(BS_STATS_TCG2_GET_CAPABILITY, 0,
+                       err = tcg->GetCapability(tcg, &capability));
         if (err != EFI_SUCCESS)
                 return NULL;
 
@@ -177,76 +230,60 @@ static EFI_TCG2_PROTOCOL *tcg2_interface_check(void) {
         return tcg;
 }
 
+static void measure_session_probe(void) {
+        if (session.probed)
+                return;
+        session.probed = true;
+
+        /* Measure into both CC and TPM if both are available to avoid a problem like CVE-2021-42299 */
+        session.cc = cc_interface_check();
+        session.tcg2 = tcg2_interface_check();
+
+        if (session.cc || session.tcg2)
+                (void) event_buffer(MEASURE_EVENT_SIZE_MIN);
+}
+
 bool tpm_present(void) {
-        return tcg2_interface_check();
+        measure_session_probe();
+        return session.tcg2;
 }
 
 uint32_t tpm_get_active_pcr_banks(void) {
-        uint32_t active_pcr_banks = 0;
-        EFI_TCG2_PROTOCOL *tpm2;
         EFI_STATUS err;
 
-        tpm2 = tcg2_interface_check();
-        if (!tpm2)
+        measure_session_probe();
+        if (!session.tcg2)
                 return 0;
 
-        err = tpm2->GetActivePcrBanks(tpm2, &active_pcr_banks);
+        if (session.have_active_pcr_banks)
+                return session.active_pcr_banks;
+        session.have_active_pcr_banks = true;
+
+        BS_STATS_TRACK(BS_STATS_TCG2_GET_ACTIVE_PCR_BANKS, 0,
+                       err = session.tcg2->GetActivePcrBanks(session.tcg2, &session.active_pcr_banks));
         if (err != EFI_SUCCESS) {
                 log_warning_status(err, "Failed to get TPM2 active PCR banks, assuming none: %m");
-                return 0;
+                session.active_pcr_banks = 0;
         }
 
-        return active_pcr_banks;
+        return session.active_pcr_banks;
 }
 
-static EFI_STATUS tcg2_log_ipl_event(uint32_t pcrindex, EFI_PHYSICAL_ADDRESS buffer, size_t buffer_size, const char16_t *description, bool *ret_measured) {
-        EFI_TCG2_PROTOCOL *tpm2;
-        EFI_STATUS err = EFI_SUCCESS;
-
-        assert(ret_measured);
-
-        tpm2 = tcg2_interface_check();
-        if (!tpm2) {
-                *ret_measured = false;
-                return EFI_SUCCESS;
-        }
-
-        err = tpm2_measure_to_pcr_and_ipl_event_log(tpm2, pcrindex, buffer, buffer_size, description);
-        if (err != EFI_SUCCESS)
-                return err;
-
-        *ret_measured = true;
-        return EFI_SUCCESS;
-}
-
-static EFI_STATUS cc_log_event(uint32_t pcrindex, EFI_PHYSICAL_ADDRESS buffer, size_t buffer_size, const char16_t *description, bool *ret_measured) {
-        EFI_CC_MEASUREMENT_PROTOCOL *cc;
-        EFI_STATUS err = EFI_SUCCESS;
-
-        assert(ret_measured);
-
-        cc = cc_interface_check();
-        if (!cc) {
-                *ret_measured = false;
-                return EFI_SUCCESS;
-        }
-
-        err = cc_measure_to_mr_and_ipl_event_log(cc, pcrindex, buffer, buffer_size, description);
-        if (err != EFI_SUCCESS)
-                return err;
-
-        *ret_measured = true;
-        return EFI_SUCCESS;
-}
+static EFI_STATUS measure_submit(
+                uint32_t pcrindex,
+                EFI_PHYSICAL_ADDRESS buffer,
+                size_t buffer_size,
+                uint32_t event_id,
+                const char16_t *description,
+                bool *ret_measured) {
 
-EFI_STATUS tpm_log_ipl_event(uint32_t pcrindex, EFI_PHYSICAL_ADDRESS buffer, size_t buffer_size, const char16_t *description, bool *ret_measured) {
+        bool measured = false;
         EFI_STATUS err;
-        bool tpm_ret_measured, cc_ret_measured;
 
         assert(description || pcrindex == UINT32_MAX);
 
         /* If EFI_SUCCESS is returned, will initialize ret_measured to true if we actually measured
-         * something, or false if measurement was turned off. */
+         * something, or false if measurement was turned off. An event_id of 0 logs an EV_IPL event. */
 
         if (pcrindex == UINT32_MAX) { /* PCR disabled? */
                 if (ret_measured)
@@ -255,21 +292,48 @@ EFI_STATUS tpm_log_ipl_event(uint32_t pcrindex, EFI_PHYSICAL_ADDRESS buffer, siz
                 return EFI_SUCCESS;
         }
 
-        /* Measure into both CC and TPM if both are available to avoid a problem like CVE-2021-42299 */
-        err = cc_log_event(pcrindex, buffer, buffer_size, description, &cc_ret_measured);
-        if (err != EFI_SUCCESS)
-                return err;
-
-        err = tcg2_log_ipl_event(pcrindex, buffer, buffer_size, description, &tpm_ret_measured);
-        if (err != EFI_SUCCESS)
-                return err;
+        measure_session_probe();
+
+        /* Tagged events only go to the TPM, there is no such event type for CC */
+        if (event_id > 0) {
+                if (session.tcg2) {
+                        err = tpm2_measure_to_pcr_and_tagged_event_log(
+                                        session.tcg2, pcrindex, buffer, buffer_size, event_id, description);
+                        if (err != EFI_SUCCESS)
+                                return err;
+
+                        measured = true;
+                }
+        } else {
+                if (session.cc) {
+                        err = cc_measure_to_mr_and_ipl_event_log(
+                                        session.cc, pcrindex, buffer, buffer_size, description);
+                        if (err != EFI_SUCCESS)
+                                return err;
+
+                        measured = true;
+                }
+
+                if (session.tcg2) {
+                        err = tpm2_measure_to_pcr_and_ipl_event_log(
+                                        session.tcg2, pcrindex, buffer, buffer_size, description);
+                        if (err != EFI_SUCCESS)
+                                return err;
+
+                        measured = true;
+                }
+        }
 
         if (ret_measured)
-                *ret_measured = tpm_ret_measured || cc_ret_measured;
+                *ret_measured = measured;
 
         return EFI_SUCCESS;
 }
 
+EFI_STATUS tpm_log_ipl_event(uint32_t pcrindex, EFI_PHYSICAL_ADDRESS buffer, size_t buffer_size, const char16_t *description, bool *ret_measured) {
+        return measure_submit(pcrindex, buffer, buffer_size, /* event_id= */ 0, description, ret_measured);
+}
+
 EFI_STATUS tpm_log_tagged_event(
                 uint32_t pcrindex,
                 EFI_PHYSICAL_ADDRESS buffer,
@@ -278,29 +342,9 @@ EFI_STATUS tpm_log_tagged_event(
                 const char16_t *description,
                 bool *ret_measured) {
 
-        EFI_TCG2_PROTOCOL *tpm2;
-        EFI_STATUS err;
-
-        assert(description || pcrindex == UINT32_MAX);
         assert(event_id > 0);
 
-        /* If EFI_SUCCESS is returned, will initialize ret_measured to true if we actually measured
-         * something, or false if measurement was turned off. */
-
-        tpm2 = tcg2_interface_check();
-        if (!tpm2 || pcrindex == UINT32_MAX) { /* PCR disabled? */
-                if (ret_measured)
-                        *ret_measured = false;
-
-                return EFI_SUCCESS;
-        }
-
-        err = tpm2_measure_to_pcr_and_tagged_event_log(tpm2, pcrindex, buffer, buffer_size, event_id, description);
-        if (!err)
-                return err;
-
-        *ret_measured = true;
-        return EFI_SUCCESS;
+        return measure_submit(pcrindex, buffer, buffer_size, event_id, description, ret_measured);
 }
 
 EFI_STATUS tpm_log_ipl_event_ascii(uint32_t pcrindex, EFI_PHYSICAL_ADDRESS buffer, size_t buffer_size, const char *description, bool *ret_measured) {
@@ -315,7 +359,15 @@ EFI_STATUS tpm_log_ipl_event_ascii(uint32_t pcrindex, EFI_PHYSICAL_ADDRESS buffe
 EFI_STATUS tpm_log_load_options(const char16_t *load_options, bool *ret_measured) {
         EFI_STATUS err;
 
-        /* Measures a load options string into the TPM2, i.e. the kernel command line */
+        /* Measures a load options string into the TPM2, i.e. the kernel command line. Without one there is
+         * nothing to measure. */
+
+        if (!load_options) {
+                if (ret_measured)
+                        *ret_measured = false;
+
+                return EFI_SUCCESS;
+        }
 
         err = tpm_log_ipl_event(
                         TPM2_PCR_KERNEL_CONFIG,
@@ -331,4 +383,3 @@ EFI_STATUS tpm_log_load_options(const char16_t *load_options, bool *ret_measured
 
         return EFI_SUCCESS;
 }
-
@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "efi-log.h"
+#include "mp.h"
+#include "proto/mp-services.h"
+#include "unaligned-fundamental.h"
+#include "util.h"
+
+/* More workers than this just fight over memory bandwidth */
+#define MP_WORKERS_MAX 4U
+/* Below this, waking up the APs costs more than it saves */
+#define MP_COPY_MIN (4U * 1024U * 1024U)
+/* How long an AP gets for its chunk before the firmware aborts it and the boot processor copies the chunk
+ * itself. A chunk takes milliseconds, this is only hit by a stuck AP. */
+#define MP_AP_TIMEOUT_USEC (1000U * 1000U)
+/* How often the boot processor checks whether the APs are done */
+#define MP_POLL_USEC 10U
+
+bool mp_enabled = false;
+
+typedef struct MpCopyJob {
+        uint8_t *dest;
+        const uint8_t *src;
+        size_t n;
+        EFI_EVENT event;
+        bool done;              /* Set by the AP once its whole chunk is copied */
+} MpCopyJob;
+
+static struct {
+        bool probed;
+        EFI_MP_SERVICES_PROTOCOL *mp;
+        size_t aps[MP_WORKERS_MAX];
+        size_t n_aps;
+        /* Not on the stack, an AP that is given up on might still be reading its job */
+        MpCopyJob jobs[MP_WORKERS_MAX];
+} mp_state;
+
+/* Runs on an application processor, which must not call into boot services. That rules out memcpy(), which
+ * forwards to BS->CopyMem(), so copy word by word and keep the compiler from turning the loop back into a
+ * memcpy() call. It is also left out of PROFILE=1 builds, the profiler hooks are not safe to run on several
+ * processors at once. */
+__attribute__((optimize("no-tree-loop-distribute-patterns"), no_instrument_function))
+static EFIAPI void mp_copy_procedure(void *arg) {
+        MpCopyJob *job = arg;
+        uint8_t *d = job->dest;
+        const uint8_t *s = job->src;
+        size_t n = job->n;
+
+        for (; n >= sizeof(uint64_t); n -= sizeof(uint64_t), d += sizeof(uint64_t), s += sizeof(uint64_t))
+                unaligned_write_ne64(d, unaligned_read_ne64(s));
+        for (; n > 0; n--)
+                *d++ = *s++;
+
+        __atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+}
+
+static bool mp_wait(EFI_EVENT event) {
+        /* The firmware signals the event once the AP is done or was aborted after MP_AP_TIMEOUT_USEC. In
+         * case it never does, stop waiting a while after that. */
+        for (uint64_t waited = 0; waited < 2U * MP_AP_TIMEOUT_USEC; waited += MP_POLL_USEC) {
+                if (BS->CheckEvent(event) != EFI_NOT_READY)
+                        return true;
+                BS->Stall(MP_POLL_USEC);
+        }
+
+        return BS->CheckEvent(event) != EFI_NOT_READY;
+}
+
+static size_t mp_probe(void) {
+        EFI_STATUS err;
+
+        if (mp_state.probed)
+                return mp_state.n_aps;
+        mp_state.probed = true;
+
+        err = BS->LocateProtocol(MAKE_GUID_PTR(EFI_MP_SERVICES_PROTOCOL), NULL, (void **) &mp_state.mp);
+        if (err != EFI_SUCCESS) {
+                log_debug("No MP services protocol, copying on the boot processor only: %m");
+                return 0;
+        }
+
+        size_t n_processors, n_enabled;
+        err = mp_state.mp->GetNumberOfProcessors(mp_state.mp, &n_processors, &n_enabled);
+        if (err != EFI_SUCCESS) {
+                log_debug("Failed to get number of processors, copying on the boot processor only: %m");
+                return 0;
+        }
+
+        for (size_t i = 0; i < n_processors && mp_state.n_aps < MP_WORKERS_MAX; i++) {
+                EFI_PROCESSOR_INFORMATION info = {};
+
+                if (mp_state.mp->GetProcessorInfo(mp_state.mp, i, &info) != EFI_SUCCESS)
+                        continue;
+                if (FLAGS_SET(info.StatusFlag, PROCESSOR_AS_BSP_BIT) ||
+                    !FLAGS_SET(info.StatusFlag, PROCESSOR_ENABLED_BIT | PROCESSOR_HEALTH_STATUS_BIT))
+                        continue;
+
+                mp_state.aps[mp_state.n_aps++] = i;
+        }
+
+        log_debug("Using %zu of %zu processors for large copies", mp_state.n_aps + 1, n_processors);
+        return mp_state.n_aps;
+}
+
+void mp_memcpy(void *dest, const void *src, size_t n) {
+        EFI_STATUS err;
+
+        if (!mp_enabled || n < MP_COPY_MIN || mp_probe() == 0) {
+                memcpy(dest, src, n);
+                return;
+        }
+
+        /* The boot processor copies the first chunk, each AP one of the following ones. Chunks are cache
+         * line aligned so that no two processors write to the same line. */
+        MpCopyJob *jobs = mp_state.jobs;
+        size_t chunk = ALIGN_TO(DIV_ROUND_UP(n, mp_state.n_aps + 1), 64U);
+
+        for (size_t i = 0; i < mp_state.n_aps; i++) {
+                size_t start = MIN(chunk * (i + 1), n);
+
+                jobs[i] = (MpCopyJob) {
+                        .dest = (uint8_t *) dest + start,
+                        .src = (const uint8_t *) src + start,
+                        .n = MIN(chunk, n - start),
+                };
+                if (jobs[i].n == 0)
+                        continue;
+
+                /* Passing an event makes the call non-blocking, the event is signalled once the AP is done. */
+                err = BS->CreateEvent(0, 0, NULL, NULL, &jobs[i].event);
+                if (err != EFI_SUCCESS)
+                        continue;
+
+                err = mp_state.mp->StartupThisAP(
+                                mp_state.mp,
+                                mp_copy_procedure,
+                                mp_state.aps[i],
+                                jobs[i].event,
+                                MP_AP_TIMEOUT_USEC,
+                                jobs + i,
+                                /* Finished= */ NULL);
+                if (err != EFI_SUCCESS) {
+                        log_debug("Failed to start AP %zu, copying its part on the boot processor: %m",
+                                  mp_state.aps[i]);
+                        (void) BS->CloseEvent(jobs[i].event);
+                        jobs[i].event = NULL;
+                }
+        }
+
+        memcpy(dest, src, MIN(chunk, n));
+
+        bool stuck = false;
+        for (size_t i = 0; i < mp_state.n_aps; i++) {
+                MpCopyJob *job = jobs + i;
+
+                if (!job->event) {
+                        memcpy(job->dest, job->src, job->n);
+                        continue;
+                }
+
+                if (!mp_wait(job->event)) {
+                        /* The firmware might still signal the event, so leave it open. The AP might still be
+                         * running too, so its job must not be reused. */
+                        log_warning_status(EFI_TIMEOUT,
+                                           "AP %zu did not finish, copying its part on the boot processor and not using APs anymore: %m",
+                                           mp_state.aps[i]);
+                        memcpy(job->dest, job->src, job->n);
+                        stuck = true;
+                        continue;
+                }
+                (void) BS->CloseEvent(job->event);
+
+                if (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) {
+                        log_warning_status(EFI_ABORTED, "AP %zu was aborted, copying its part on the boot processor: %m",
+                                           mp_state.aps[i]);
+                        memcpy(job->dest, job->src, job->n);
+                }
+        }
+
+        if (stuck)
+                mp_state.n_aps = 0;
+
+        /* Make sure whatever the APs wrote is visible before the kernel gets to run */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
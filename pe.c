@@ -2,6 +2,8 @@
 
 #include "chid.h"
 #include "devicetree.h"
+#include "devicetree-export.h"
+#include "dtbidx.h"
 #include "efi-log.h"
 #include "pe.h"
 #include "util.h"
@@ -72,11 +74,6 @@ typedef struct CoffFileHeader {
 #define OPTHDR32_MAGIC 0x10B /* PE32  OptionalHeader */
 #define OPTHDR64_MAGIC 0x20B /* PE32+ OptionalHeader */
 
-typedef struct PeImageDataDirectory {
-        uint32_t VirtualAddress;
-        uint32_t Size;
-} _packed_ PeImageDataDirectory;
-
 #define IMAGE_NUMBEROF_DIRECTORY_ENTRIES 16
 
 typedef struct PeOptionalHeader {
@@ -174,7 +171,7 @@ static size_t section_table_offset(const DosFileHeader *dos, const PeFileHeader
         return dos->ExeHeader + offsetof(PeFileHeader, OptionalHeader) + pe->FileHeader.SizeOfOptionalHeader;
 }
 
-static bool pe_section_name_equal(const char *a, const char *b) {
+bool pe_section_name_equal(const char *a, const char *b) {
 
         if (a == b)
                 return true;
@@ -194,50 +191,130 @@ static bool pe_section_name_equal(const char *a, const char *b) {
         return true;
 }
 
-static bool pe_use_this_dtb(
-                const void *dtb,
-                size_t dtb_size,
-                const void *base,
-                const Device *device,
-                size_t section_nb) {
+bool pe_section_vector_from_header(
+                const PeSectionHeader *section,
+                size_t validate_base,
+                PeSectionVector *ret) {
 
-        assert(dtb);
+        assert(section);
 
-        EFI_STATUS err;
+        /* Overflow check: ignore sections that are impossibly large, relative to the file address for the
+         * section. */
+        size_t size_max = SIZE_MAX - section->PointerToRawData;
+        if ((size_t) section->SizeOfRawData > size_max)
+                return false;
 
-        if (dtb_override == true) {
-                err = devicetree_match(dtb, dtb_size);
-                if (err == EFI_SUCCESS) {
-                        log_debug("found device-tree based on compatible: %s",
-                                        devicetree_get_compatible(dtb));
-                        return true;
-                }
-                if (err != EFI_UNSUPPORTED)
+        /* Overflow check: ignore sections that are impossibly large, given the virtual address for the
+         * section */
+        size_max = SIZE_MAX - section->VirtualAddress;
+        if ((size_t) section->VirtualSize > size_max)
+                return false;
+
+        /* 2nd overflow check: ignore sections that are impossibly large also taking the loaded base into
+         * account. */
+        if (validate_base != 0) {
+                if (validate_base > size_max)
+                        return false;
+                size_max -= validate_base;
+
+                if (section->VirtualAddress > size_max)
                         return false;
         }
 
-        /* Do nothing if a firmware dtb exists */
-        const void *fw_dtb = find_configuration_table(MAKE_GUID_PTR(EFI_DTB_TABLE));
-        if (fw_dtb)
-                return false;
+        if (ret)
+                *ret = (PeSectionVector) {
+                        .memory_size = section->VirtualSize,
+                        .memory_offset = section->VirtualAddress,
+                        /* VirtualSize can be bigger than SizeOfRawData when the section requires
+                         * uninitialized data. It can also be smaller than SizeOfRawData when there's no
+                         * need for uninitialized data as SizeOfRawData is aligned to FileAlignment and
+                         * VirtualSize isn't. The actual data that's read from disk is the minimum of these
+                         * two fields. */
+                        .file_size = MIN(section->SizeOfRawData, section->VirtualSize),
+                        .file_offset = section->PointerToRawData,
+                };
 
-        /* There's nothing to match against if there is no .hwids section */
-        if (!device || !base)
-                return false;
+        return true;
+}
 
-        const char *compatible = device_get_compatible(base, device);
-        if (!compatible)
-                return false;
+static void pe_log_dtb_match(const DevicetreeMatchContext *dt_match, const void *dtb, size_t section_nb, uint32_t score) {
+        assert(dt_match);
 
-        err = devicetree_match_by_compatible(dtb, dtb_size, compatible);
-        if (err == EFI_SUCCESS) {
-                log_debug("found device-tree based on HWID: %s",
-                                devicetree_get_compatible(dtb));
-                return true;
+        switch (dt_match->source) {
+        case DEVICETREE_MATCH_FIRMWARE:
+                log_debug("found device-tree in PE section %zu based on compatible: %s (score 0x%x)",
+                          section_nb, devicetree_get_compatible(dtb), score);
+                break;
+        case DEVICETREE_MATCH_HWID:
+                log_debug("found device-tree in PE section %zu based on HWID of %s (CHID type %zu): %s (score 0x%x)",
+                          section_nb,
+                          device_get_name(dt_match->hwids, dt_match->device) ?: "unknown device",
+                          dt_match->chid_type,
+                          devicetree_get_compatible(dtb),
+                          score);
+                break;
+        default:
+                assert_not_reached();
+        }
+}
+
+/* Picks the .dtbauto section through the .dtbidx index. Returns EFI_NOT_FOUND if the index has no match, and
+ * any other error if the index can't be used, in which case all sections have to be scanned. */
+static EFI_STATUS pe_select_dtbauto_indexed(
+                const PeSectionHeader section_table[],
+                size_t n_section_table,
+                size_t validate_base,
+                const DevicetreeMatchContext *dt_match,
+                const PeSectionVector *dtbidx,
+                const PeSectionHeader **ret_best,
+                uint32_t *ret_score) {
+
+        size_t section_nb;
+        uint32_t score, verified;
+        EFI_STATUS err;
+
+        assert(dt_match);
+        assert(dtbidx);
+        assert(ret_best);
+        assert(ret_score);
+
+        err = dtbidx_select(
+                        (const uint8_t *) SIZE_TO_PTR(validate_base) + dtbidx->memory_offset,
+                        dtbidx->memory_size,
+                        section_table,
+                        n_section_table,
+                        dt_match,
+                        &section_nb,
+                        &score);
+        if (err == EFI_NOT_FOUND)
+                return err;
+        if (err != EFI_SUCCESS)
+                return log_warning_status(err, "Bad .dtbidx section, scanning all .dtbauto sections: %m");
+
+        /* The index only points the way, the DT it points to has to agree */
+        const PeSectionHeader *best = section_table + section_nb;
+        if (!pe_section_vector_from_header(best, validate_base, NULL))
+                err = EFI_INVALID_PARAMETER;
+        else
+                err = devicetree_match_score(
+                                dt_match,
+                                (const uint8_t *) SIZE_TO_PTR(validate_base) + best->VirtualAddress,
+                                best->VirtualSize,
+                                &verified);
+        if (err == EFI_SUCCESS && verified != score)
+                err = EFI_INVALID_PARAMETER;
+        if (err != EFI_SUCCESS) {
+                log_warning_status(
+                                err,
+                                ".dtbidx does not agree with PE section %zu, scanning all .dtbauto sections: %m",
+                                section_nb);
+                /* Not EFI_NOT_FOUND in any case, which would mean there is no match at all */
+                return EFI_INVALID_PARAMETER;
         }
-        if (err == EFI_INVALID_PARAMETER)
-                log_error_status(err, "Found bad DT blob in PE section %zu", section_nb);
-        return false;
+
+        *ret_best = best;
+        *ret_score = score;
+        return EFI_SUCCESS;
 }
 
 static void pe_locate_sections_internal(
@@ -245,8 +322,8 @@ static void pe_locate_sections_internal(
                 size_t n_section_table,
                 const char *const section_names[],
                 size_t validate_base,
-                const void *device_table,
-                const Device *device,
+                const DevicetreeMatchContext *dt_match,
+                const PeSectionVector *dtbidx,
                 PeSectionVector sections[]) {
 
         assert(section_table || n_section_table == 0);
@@ -257,65 +334,82 @@ static void pe_locate_sections_internal(
          * data. If 'validate_base' is non-zero also takes base offset when loaded into memory into account for
          * checking for overflows. */
 
-        for (size_t i = 0; section_names[i]; i++)
+        for (size_t i = 0; section_names[i]; i++) {
+                bool dtbauto = pe_section_name_equal(section_names[i], ".dtbauto");
+                const PeSectionHeader *best = NULL;
+                uint32_t best_score = 0;
+
+                /* .dtbauto sections require validate_base and a match context for matching */
+                if (dtbauto && (!validate_base || !dt_match || dt_match->source == DEVICETREE_MATCH_NONE))
+                        continue;
+
+                /* With an index only the candidate it points to is looked at, unless it can't be used */
+                if (dtbauto && dtbidx) {
+                        EFI_STATUS err = pe_select_dtbauto_indexed(
+                                        section_table,
+                                        n_section_table,
+                                        validate_base,
+                                        dt_match,
+                                        dtbidx,
+                                        &best,
+                                        &best_score);
+                        if (err == EFI_SUCCESS)
+                                goto found;
+                        if (err == EFI_NOT_FOUND)
+                                continue;
+                }
+
                 FOREACH_ARRAY(j, section_table, n_section_table) {
 
                         if (!pe_section_name_equal((const char*) j->Name, section_names[i]))
                                 continue;
 
-                        /* Overflow check: ignore sections that are impossibly large, relative to the file
-                         * address for the section. */
-                        size_t size_max = SIZE_MAX - j->PointerToRawData;
-                        if ((size_t) j->SizeOfRawData > size_max)
+                        if (!pe_section_vector_from_header(j, validate_base, NULL))
                                 continue;
 
-                        /* Overflow check: ignore sections that are impossibly large, given the virtual
-                         * address for the section */
-                        size_max = SIZE_MAX - j->VirtualAddress;
-                        if ((size_t) j->VirtualSize > size_max)
-                                continue;
+                        if (!dtbauto) {
+                                /* First matching section wins, ignore the rest */
+                                best = j;
+                                break;
+                        }
 
-                        /* 2nd overflow check: ignore sections that are impossibly large also taking the
-                         * loaded base into account. */
-                        if (validate_base != 0) {
-                                if (validate_base > size_max)
-                                        continue;
-                                size_max -= validate_base;
+                        /* For .dtbauto all candidates are scored, the best one wins. On a tie the earlier
+                         * section is kept. */
+                        size_t section_nb = j - section_table;
+                        uint32_t score;
+                        EFI_STATUS err = devicetree_match_score(
+                                        dt_match,
+                                        (const uint8_t *) SIZE_TO_PTR(validate_base) + j->VirtualAddress,
+                                        j->VirtualSize,
+                                        &score);
+                        if (err == EFI_INVALID_PARAMETER)
+                                log_error_status(err, "Found bad DT blob in PE section %zu", section_nb);
+                        if (err != EFI_SUCCESS)
+                                continue;
 
-                                if (j->VirtualAddress > size_max)
-                                        continue;
-                        }
+                        if (best && score <= best_score)
+                                continue;
 
-                        /* Special handling for .dtbauto sections compared to plain .dtb */
-                        if (pe_section_name_equal(section_names[i], ".dtbauto")) {
-                                /* .dtbauto sections require validate_base for matching */
-                                if (!validate_base)
-                                        break;
-                                if (!pe_use_this_dtb(
-                                                  (const uint8_t *) SIZE_TO_PTR(validate_base) + j->VirtualAddress,
-                                                  j->VirtualSize,
-                                                  device_table,
-                                                  device,
-                                                  (PTR_TO_SIZE(j) - PTR_TO_SIZE(section_table)) / sizeof(*j)))
-                                        continue;
-                        }
+                        best = j;
+                        best_score = score;
+                }
 
-                        /* At this time, the sizes and offsets have been validated. Store them away */
-                        sections[i] = (PeSectionVector) {
-                                .memory_size = j->VirtualSize,
-                                .memory_offset = j->VirtualAddress,
-                                /* VirtualSize can be bigger than SizeOfRawData when the section requires
-                                 * uninitialized data. It can also be smaller than SizeOfRawData when there's
-                                 * no need for uninitialized data as SizeOfRawData is aligned to
-                                 * FileAlignment and VirtualSize isn't. The actual data that's read from disk
-                                 * is the minimum of these two fields. */
-                                .file_size = MIN(j->SizeOfRawData, j->VirtualSize),
-                                .file_offset = j->PointerToRawData,
-                        };
-
-                        /* First matching section wins, ignore the rest */
-                        break;
+                if (!best)
+                        continue;
+
+found:
+                if (dtbauto) {
+                        pe_log_dtb_match(
+                                        dt_match,
+                                        (const uint8_t *) SIZE_TO_PTR(validate_base) + best->VirtualAddress,
+                                        best - section_table,
+                                        best_score);
+                        devicetree_export_record_match(dt_match, best - section_table);
                 }
+
+                /* At this time, the sizes and offsets have been validated. Store them away */
+                assert_se(pe_section_vector_from_header(best, validate_base, sections + i));
+        }
 }
 
 static bool looking_for_dtbauto(const char *const section_names[]) {
@@ -340,38 +434,47 @@ void pe_locate_sections(
                                   n_section_table,
                                   section_names,
                                   validate_base,
-                                  /* device_base */ NULL,
-                                  /* device */ NULL,
+                                  /* dt_match */ NULL,
+                                  /* dtbidx */ NULL,
                                   sections);
 
         /* It doesn't make sense not to provide validate_base here */
         assert(validate_base != 0);
 
-        const void *hwids = NULL;
-        const Device *device = NULL;
-
-        if (!firmware_devicetree_exists()) {
-                /* Find HWIDs table and search for the current device */
-                static const char *const hwid_section_names[] = { ".hwids", NULL };
-                PeSectionVector hwids_section[1] = {};
-
-                pe_locate_sections_internal(
-                                section_table,
-                                n_section_table,
-                                hwid_section_names,
-                                validate_base,
-                                /* device_table */ NULL,
-                                /* device */ NULL,
-                                hwids_section);
-
-                if (PE_SECTION_VECTOR_IS_SET(hwids_section)) {
-                        hwids = (const uint8_t *) SIZE_TO_PTR(validate_base) + hwids_section[0].memory_offset;
+        /* Everything the .dtbauto candidates are matched against is gathered once up front, rather than
+         * being looked up again for every candidate section. */
+        DevicetreeMatchContext dt_match;
+        devicetree_match_context_init(&dt_match);
 
-                        EFI_STATUS err = chid_match(hwids, hwids_section[0].memory_size, DEVICE_TYPE_DEVICETREE, &device);
-                        if (err != EFI_SUCCESS) {
+        /* Find the HWIDs table and the index of the .dtbauto sections, if any */
+        static const char *const match_section_names[] = { ".hwids", ".dtbidx", NULL };
+        PeSectionVector match_sections[2] = {};
+        pe_locate_sections_internal(
+                        section_table,
+                        n_section_table,
+                        match_section_names,
+                        validate_base,
+                        /* dt_match */ NULL,
+                        /* dtbidx */ NULL,
+                        match_sections);
+
+        if (!dt_match.fw_dtb) {
+                /* Search for the current device */
+                if (PE_SECTION_VECTOR_IS_SET(match_sections + 0)) {
+                        const void *hwids = (const uint8_t *) SIZE_TO_PTR(validate_base) + match_sections[0].memory_offset;
+                        const Device *device = NULL;
+                        size_t chid_type = SIZE_MAX;
+
+                        EFI_STATUS err = chid_match(
+                                        hwids,
+                                        match_sections[0].memory_size,
+                                        DEVICE_TYPE_DEVICETREE,
+                                        &device,
+                                        &chid_type);
+                        if (err != EFI_SUCCESS)
                                 log_error_status(err, "HWID matching failed, no DT blob will be selected: %m");
-                                hwids = NULL;
-                        }
+                        else
+                                devicetree_match_context_set_device(&dt_match, hwids, device, chid_type);
                 }
         }
 
@@ -380,111 +483,92 @@ void pe_locate_sections(
                             n_section_table,
                             section_names,
                             validate_base,
-                            hwids,
-                            device,
+                            &dt_match,
+                            PE_SECTION_VECTOR_IS_SET(match_sections + 1) ? match_sections + 1 : NULL,
                             sections);
 }
 
-EFI_STATUS pe_kernel_info(const void *base, uint32_t *ret_entry_point, uint64_t *ret_image_base, size_t *ret_size_in_memory) {
+EFI_STATUS pe_image_parse(const void *base, size_t size, bool allow_compatibility, PeImage *ret) {
         assert(base);
+        assert(ret);
 
-        const DosFileHeader *dos = (const DosFileHeader *) base;
-        if (!verify_dos(dos))
-                return EFI_LOAD_ERROR;
-
-        const PeFileHeader *pe = (const PeFileHeader *) ((const uint8_t *) base + dos->ExeHeader);
-        if (!verify_pe(dos, pe, /* allow_compatibility= */ true))
+        /* Everything below is read from the image, so make sure it lies within it first. The optional header
+         * has to go at least up to the data directories, it's only those that may be left out. */
+        const DosFileHeader *dos = base;
+        if (size < sizeof(DosFileHeader) || !verify_dos(dos))
                 return EFI_LOAD_ERROR;
 
-        uint64_t image_base;
-        switch (pe->OptionalHeader.Magic) {
-        case OPTHDR32_MAGIC:
-                image_base = pe->OptionalHeader.ImageBase32;
-                break;
-        case OPTHDR64_MAGIC:
-                image_base = pe->OptionalHeader.ImageBase64;
-                break;
-        default:
-                assert_not_reached();
-        }
-
-        /* When allocating we need to also consider the virtual/uninitialized data sections, so parse it out
-         * of the SizeOfImage field in the PE header and return it */
-        size_t size_in_memory = pe->OptionalHeader.SizeOfImage;
-
-        /* Support for LINUX_INITRD_MEDIA_GUID was added in kernel stub 1.0. */
-        if (pe->OptionalHeader.MajorImageVersion < 1)
-                return EFI_UNSUPPORTED;
-
-        /* We do not support cross-architecture kernel loading. */
-        if (pe->FileHeader.Machine != TARGET_MACHINE_TYPE)
-                return EFI_UNSUPPORTED;
-
-        if (ret_entry_point)
-                *ret_entry_point = pe->OptionalHeader.AddressOfEntryPoint;
-        if (ret_image_base)
-                *ret_image_base = image_base;
-        if (ret_size_in_memory)
-                *ret_size_in_memory = size_in_memory;
-        return EFI_SUCCESS;
-}
-
-/* https://learn.microsoft.com/en-us/windows/win32/debug/pe-format#optional-header-data-directories-image-only */
-#define BASE_RELOCATION_TABLE_DATA_DIRECTORY_ENTRY 5
-
-/* We do not expect PE inner kernels to have any relocations. However that might be wrong for some
- * architectures, or it might change in the future. If the case of relocation arise, we should transform this
- * function in a function applying the relocations. However for now, since it would not be exercised and
- * would bitrot, we leave it as a check that relocations are never expected.
- */
-EFI_STATUS pe_kernel_check_no_relocation(const void *base) {
-        assert(base);
-
-        const DosFileHeader *dos = base;
-        if (!verify_dos(dos))
+        size_t opt_offset = dos->ExeHeader + offsetof(PeFileHeader, OptionalHeader);
+        if (opt_offset > size || size - opt_offset < sizeof_field(PeOptionalHeader, Magic))
                 return EFI_LOAD_ERROR;
 
         const PeFileHeader *pe = (const PeFileHeader *) ((const uint8_t *) base + dos->ExeHeader);
-        if (!verify_pe(dos, pe, /* allow_compatibility= */ true))
+        if (!verify_pe(dos, pe, allow_compatibility))
                 return EFI_LOAD_ERROR;
 
-        const PeImageDataDirectory *data_directory;
-        switch (pe->OptionalHeader.Magic) {
-        case OPTHDR32_MAGIC:
-                data_directory = pe->OptionalHeader.DataDirectory32;
-                break;
-        case OPTHDR64_MAGIC:
-                data_directory = pe->OptionalHeader.DataDirectory64;
-                break;
-        default:
-                assert_not_reached();
-        }
+        bool pe32_plus = pe->OptionalHeader.Magic == OPTHDR64_MAGIC;
+        size_t dir_offset = pe32_plus ? offsetof(PeOptionalHeader, DataDirectory64) :
+                                        offsetof(PeOptionalHeader, DataDirectory32);
+        size_t opt_size = pe->FileHeader.SizeOfOptionalHeader;
+        if (opt_size < dir_offset || opt_size > size - opt_offset)
+                return EFI_LOAD_ERROR;
 
-        if (data_directory[BASE_RELOCATION_TABLE_DATA_DIRECTORY_ENTRY].Size != 0)
-                return log_error_status(EFI_LOAD_ERROR, "Inner kernel image contains base relocations, which we do not support.");
+        size_t n_sections = pe->FileHeader.NumberOfSections;
+        size_t sections_offset = section_table_offset(dos, pe);
+        if (n_sections * sizeof(PeSectionHeader) > SECTION_TABLE_BYTES_MAX ||
+            sections_offset > size ||
+            size - sections_offset < n_sections * sizeof(PeSectionHeader))
+                return EFI_LOAD_ERROR;
 
+        const PeOptionalHeader *opt = &pe->OptionalHeader;
+        *ret = (PeImage) {
+                .base = base,
+                .size = size,
+                .machine = pe->FileHeader.Machine,
+                .image_base = pe32_plus ? opt->ImageBase64 : opt->ImageBase32,
+                .entry_point = opt->AddressOfEntryPoint,
+                .size_of_image = opt->SizeOfImage,
+                .section_alignment = opt->SectionAlignment,
+                .major_image_version = opt->MajorImageVersion,
+                .data_directories = pe32_plus ? opt->DataDirectory64 : opt->DataDirectory32,
+                .n_data_directories = MIN3((size_t) (pe32_plus ? opt->NumberOfRvaAndSizes64 : opt->NumberOfRvaAndSizes32),
+                                           (opt_size - dir_offset) / sizeof(PeImageDataDirectory),
+                                           (size_t) IMAGE_NUMBEROF_DIRECTORY_ENTRIES),
+                .sections = (const PeSectionHeader *) ((const uint8_t *) base + sections_offset),
+                .n_sections = n_sections,
+        };
         return EFI_SUCCESS;
 }
 
-EFI_STATUS pe_section_table_from_base(
-                const void *base,
-                const PeSectionHeader **ret_section_table,
-                size_t *ret_n_section_table) {
+bool pe_image_is_native(const PeImage *image) {
+        assert(image);
+        return image->machine == TARGET_MACHINE_TYPE;
+}
 
-        assert(base);
-        assert(ret_section_table);
-        assert(ret_n_section_table);
+EFI_STATUS pe_image_check_kernel(const PeImage *image) {
+        assert(image);
 
-        const DosFileHeader *dos = (const DosFileHeader*) base;
-        if (!verify_dos(dos))
-                return EFI_LOAD_ERROR;
+        /* Support for LINUX_INITRD_MEDIA_GUID was added in kernel stub 1.0. */
+        if (image->major_image_version < 1) {
+                log_debug("Kernel image version %u predates LINUX_INITRD_MEDIA_GUID support.", image->major_image_version);
+                return EFI_UNSUPPORTED;
+        }
 
-        const PeFileHeader *pe = (const PeFileHeader*) ((const uint8_t*) base + dos->ExeHeader);
-        if (!verify_pe(dos, pe, /* allow_compatibility= */ false))
-                return EFI_LOAD_ERROR;
+        /* We do not support cross-architecture kernel loading. */
+        if (!pe_image_is_native(image)) {
+                log_debug("Kernel image is for machine type 0x%x.", image->machine);
+                return EFI_UNSUPPORTED;
+        }
 
-        *ret_section_table = (const PeSectionHeader*) ((const uint8_t*) base + section_table_offset(dos, pe));
-        *ret_n_section_table = pe->FileHeader.NumberOfSections;
+        /* We do not expect PE inner kernels to have any relocations. However that might be wrong for some
+         * architectures, or it might change in the future. If the case of relocation arise, this is where
+         * they should be applied. However for now, since it would not be exercised and would bitrot, we
+         * leave it as a check that relocations are never expected. */
+        const PeImageDataDirectory *relocations = pe_image_data_directory(image, PE_DATA_DIRECTORY_BASE_RELOCATION);
+        if (relocations && relocations->Size != 0) {
+                log_debug("Inner kernel image contains base relocations, which we do not support.");
+                return EFI_LOAD_ERROR;
+        }
 
         return EFI_SUCCESS;
 }
@@ -500,15 +584,14 @@ EFI_STATUS pe_memory_locate_sections(
         assert(section_names);
         assert(sections);
 
-        const PeSectionHeader *section_table;
-        size_t n_section_table;
-        err = pe_section_table_from_base(base, &section_table, &n_section_table);
+        PeImage image;
+        err = pe_image_parse(base, SIZE_MAX, /* allow_compatibility= */ false, &image);
         if (err != EFI_SUCCESS)
                 return err;
 
         pe_locate_sections(
-                        section_table,
-                        n_section_table,
+                        image.sections,
+                        image.n_sections,
                         section_names,
                         PTR_TO_SIZE(base),
                         sections);
@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "profile.h"
+
+#if STUBBLE_PROFILE
+
+#include "efi-log.h"
+#include "ticks.h"
+#include "util.h"
+
+/* Enough for the distinct call paths of a boot, about 130 KiB of .bss in total */
+#define PROFILE_NODES_MAX 4096U
+#define PROFILE_DEPTH_MAX 64U
+#define PROFILE_NODE_NONE UINT32_MAX
+
+/* Everything here runs from the hooks, which must not be instrumented themselves. Nor may they call into
+ * anything that is. */
+#define _no_instrument_ __attribute__((no_instrument_function))
+
+_no_instrument_ void __cyg_profile_func_enter(void *fn, void *call_site);
+_no_instrument_ void __cyg_profile_func_exit(void *fn, void *call_site);
+
+static struct {
+        bool stopped;
+
+        ProfileNode nodes[PROFILE_NODES_MAX];
+        uint32_t n_nodes;
+        uint32_t n_dropped;
+        /* Children of a node as a singly linked list, index 0 (the root) terminates it */
+        uint32_t first_child[PROFILE_NODES_MAX];
+        uint32_t next_sibling[PROFILE_NODES_MAX];
+
+        struct {
+                uint32_t node;
+                uint64_t start;
+        } stack[PROFILE_DEPTH_MAX];
+        uint32_t depth;
+} profile;
+
+_no_instrument_ static uint32_t profile_child(uint32_t parent, uint32_t fn) {
+        for (uint32_t i = profile.first_child[parent]; i != 0; i = profile.next_sibling[i])
+                if (profile.nodes[i].fn == fn)
+                        return i;
+
+        if (profile.n_nodes >= PROFILE_NODES_MAX)
+                return PROFILE_NODE_NONE;
+
+        /* No struct assignments, the hooks must not end up in memcpy() */
+        uint32_t i = profile.n_nodes++;
+        profile.nodes[i].fn = fn;
+        profile.nodes[i].parent = parent;
+        profile.nodes[i].calls = profile.nodes[i].ticks = 0;
+        profile.next_sibling[i] = profile.first_child[parent];
+        profile.first_child[parent] = i;
+        return i;
+}
+
+void __cyg_profile_func_enter(void *fn, void *call_site) {
+        if (profile.stopped)
+                return;
+
+        /* Node 0 is the root, keep the whole state in .bss rather than initializing it */
+        if (profile.n_nodes == 0)
+                profile.n_nodes = 1;
+
+        uint32_t depth = profile.depth++;
+        if (depth >= PROFILE_DEPTH_MAX) {
+                profile.n_dropped++;
+                return;
+        }
+
+        uint32_t parent = depth > 0 ? profile.stack[depth - 1].node : 0;
+        uint32_t node = PROFILE_NODE_NONE;
+        if (parent != PROFILE_NODE_NONE)
+                node = profile_child(parent, (uint32_t) ((const uint8_t *) fn - __executable_start));
+        if (node == PROFILE_NODE_NONE)
+                profile.n_dropped++;
+
+        profile.stack[depth].node = node;
+        /* Taken last, so that looking up the node counts towards the caller rather than the callee */
+        profile.stack[depth].start = ticks_read();
+}
+
+void __cyg_profile_func_exit(void *fn, void *call_site) {
+        uint64_t now = ticks_read();
+
+        if (profile.stopped || profile.depth == 0)
+                return;
+
+        uint32_t depth = --profile.depth;
+        if (depth >= PROFILE_DEPTH_MAX)
+                return;
+
+        uint32_t node = profile.stack[depth].node;
+        if (node == PROFILE_NODE_NONE)
+                return;
+
+        profile.nodes[node].calls++;
+        profile.nodes[node].ticks += now - profile.stack[depth].start;
+}
+
+void profile_export(EFI_LOADED_IMAGE_PROTOCOL *loaded_image) {
+        uint64_t now = ticks_read();
+        EFI_STATUS err;
+
+        assert(loaded_image);
+
+        if (profile.stopped)
+                return;
+        profile.stopped = true;
+
+        /* The functions on the way here never return before the kernel is started, account them now */
+        for (uint32_t d = 0; d < MIN(profile.depth, PROFILE_DEPTH_MAX); d++) {
+                uint32_t node = profile.stack[d].node;
+                if (node == PROFILE_NODE_NONE)
+                        continue;
+
+                profile.nodes[node].calls++;
+                profile.nodes[node].ticks += now - profile.stack[d].start;
+        }
+
+        ProfileHeader header = {
+                .magic = PROFILE_MAGIC,
+                .node_size = sizeof(ProfileNode),
+                .n_nodes = profile.n_nodes,
+                .n_dropped = profile.n_dropped,
+                .ticks_freq = ticks_freq(),
+        };
+
+        _cleanup_file_close_ EFI_FILE *root = NULL, *handle = NULL;
+        err = open_volume(loaded_image->DeviceHandle, &root);
+        if (err != EFI_SUCCESS) {
+                log_warning_status(err, "Unable to open root directory for profile, ignoring: %m");
+                return;
+        }
+
+        /* Drop the profile of an earlier boot, there is no way to truncate a file otherwise */
+        if (root->Open(root, &handle, (char16_t *) PROFILE_PATH, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0) == EFI_SUCCESS)
+                (void) handle->Delete(TAKE_PTR(handle));
+
+        err = root->Open(
+                        root,
+                        &handle,
+                        (char16_t *) PROFILE_PATH,
+                        EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+                        0);
+        if (err == EFI_SUCCESS)
+                err = file_write_all(handle, &header, sizeof(header));
+        if (err == EFI_SUCCESS)
+                err = file_write_all(handle, profile.nodes, profile.n_nodes * sizeof(ProfileNode));
+        if (err == EFI_SUCCESS)
+                err = handle->Flush(handle);
+        if (err != EFI_SUCCESS) {
+                log_warning_status(err, "Unable to write profile %ls, ignoring: %m", PROFILE_PATH);
+                return;
+        }
+
+        log_debug("Wrote profile with %u nodes, %u calls dropped, to %ls",
+                  profile.n_nodes, profile.n_dropped, PROFILE_PATH);
+}
+
+#endif
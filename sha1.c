@@ -76,6 +76,7 @@ Still 100% public domain
 modified for use with systemd
 */
 
+#include "macro-fundamental.h"
 #include "memory-util-fundamental.h"
 #include "sha1.h"
 
@@ -114,6 +115,89 @@ modified for use with systemd
         z += (w ^ x ^ y) + blk(i) + 0xCA62C1D6 + rol(v, 5); \
         w = rol(w, 30);
 
+/* The 80 rounds, loop unrolled, for the R0 to R4 of a transform working on a, b, c, d and e */
+#define SHA1_ROUNDS(R0, R1, R2, R3, R4)  \
+        R0(a, b, c, d, e, 0);            \
+        R0(e, a, b, c, d, 1);            \
+        R0(d, e, a, b, c, 2);            \
+        R0(c, d, e, a, b, 3);            \
+        R0(b, c, d, e, a, 4);            \
+        R0(a, b, c, d, e, 5);            \
+        R0(e, a, b, c, d, 6);            \
+        R0(d, e, a, b, c, 7);            \
+        R0(c, d, e, a, b, 8);            \
+        R0(b, c, d, e, a, 9);            \
+        R0(a, b, c, d, e, 10);           \
+        R0(e, a, b, c, d, 11);           \
+        R0(d, e, a, b, c, 12);           \
+        R0(c, d, e, a, b, 13);           \
+        R0(b, c, d, e, a, 14);           \
+        R0(a, b, c, d, e, 15);           \
+        R1(e, a, b, c, d, 16);           \
+        R1(d, e, a, b, c, 17);           \
+        R1(c, d, e, a, b, 18);           \
+        R1(b, c, d, e, a, 19);           \
+        R2(a, b, c, d, e, 20);           \
+        R2(e, a, b, c, d, 21);           \
+        R2(d, e, a, b, c, 22);           \
+        R2(c, d, e, a, b, 23);           \
+        R2(b, c, d, e, a, 24);           \
+        R2(a, b, c, d, e, 25);           \
+        R2(e, a, b, c, d, 26);           \
+        R2(d, e, a, b, c, 27);           \
+        R2(c, d, e, a, b, 28);           \
+        R2(b, c, d, e, a, 29);           \
+        R2(a, b, c, d, e, 30);           \
+        R2(e, a, b, c, d, 31);           \
+        R2(d, e, a, b, c, 32);           \
+        R2(c, d, e, a, b, 33);           \
+        R2(b, c, d, e, a, 34);           \
+        R2(a, b, c, d, e, 35);           \
+        R2(e, a, b, c, d, 36);           \
+        R2(d, e, a, b, c, 37);           \
+        R2(c, d, e, a, b, 38);           \
+        R2(b, c, d, e, a, 39);           \
+        R3(a, b, c, d, e, 40);           \
+        R3(e, a, b, c, d, 41);           \
+        R3(d, e, a, b, c, 42);           \
+        R3(c, d, e, a, b, 43);           \
+        R3(b, c, d, e, a, 44);           \
+        R3(a, b, c, d, e, 45);           \
+        R3(e, a, b, c, d, 46);           \
+        R3(d, e, a, b, c, 47);           \
+        R3(c, d, e, a, b, 48);           \
+        R3(b, c, d, e, a, 49);           \
+        R3(a, b, c, d, e, 50);           \
+        R3(e, a, b, c, d, 51);           \
+        R3(d, e, a, b, c, 52);           \
+        R3(c, d, e, a, b, 53);           \
+        R3(b, c, d, e, a, 54);           \
+        R3(a, b, c, d, e, 55);           \
+        R3(e, a, b, c, d, 56);           \
+        R3(d, e, a, b, c, 57);           \
+        R3(c, d, e, a, b, 58);           \
+        R3(b, c, d, e, a, 59);           \
+        R4(a, b, c, d, e, 60);           \
+        R4(e, a, b, c, d, 61);           \
+        R4(d, e, a, b, c, 62);           \
+        R4(c, d, e, a, b, 63);           \
+        R4(b, c, d, e, a, 64);           \
+        R4(a, b, c, d, e, 65);           \
+        R4(e, a, b, c, d, 66);           \
+        R4(d, e, a, b, c, 67);           \
+        R4(c, d, e, a, b, 68);           \
+        R4(b, c, d, e, a, 69);           \
+        R4(a, b, c, d, e, 70);           \
+        R4(e, a, b, c, d, 71);           \
+        R4(d, e, a, b, c, 72);           \
+        R4(c, d, e, a, b, 73);           \
+        R4(b, c, d, e, a, 74);           \
+        R4(a, b, c, d, e, 75);           \
+        R4(e, a, b, c, d, 76);           \
+        R4(d, e, a, b, c, 77);           \
+        R4(c, d, e, a, b, 78);           \
+        R4(b, c, d, e, a, 79);
+
 /* Hash a single 512-bit block. This is the core of the algorithm. */
 static void sha1_do_transform(uint32_t state[5], const uint8_t buffer[64]) {
         uint32_t a, b, c, d, e;
@@ -133,86 +217,7 @@ static void sha1_do_transform(uint32_t state[5], const uint8_t buffer[64]) {
         e = state[4];
 
         /* 4 rounds of 20 operations each. Loop unrolled. */
-        R0(a, b, c, d, e, 0);
-        R0(e, a, b, c, d, 1);
-        R0(d, e, a, b, c, 2);
-        R0(c, d, e, a, b, 3);
-        R0(b, c, d, e, a, 4);
-        R0(a, b, c, d, e, 5);
-        R0(e, a, b, c, d, 6);
-        R0(d, e, a, b, c, 7);
-        R0(c, d, e, a, b, 8);
-        R0(b, c, d, e, a, 9);
-        R0(a, b, c, d, e, 10);
-        R0(e, a, b, c, d, 11);
-        R0(d, e, a, b, c, 12);
-        R0(c, d, e, a, b, 13);
-        R0(b, c, d, e, a, 14);
-        R0(a, b, c, d, e, 15);
-        R1(e, a, b, c, d, 16);
-        R1(d, e, a, b, c, 17);
-        R1(c, d, e, a, b, 18);
-        R1(b, c, d, e, a, 19);
-        R2(a, b, c, d, e, 20);
-        R2(e, a, b, c, d, 21);
-        R2(d, e, a, b, c, 22);
-        R2(c, d, e, a, b, 23);
-        R2(b, c, d, e, a, 24);
-        R2(a, b, c, d, e, 25);
-        R2(e, a, b, c, d, 26);
-        R2(d, e, a, b, c, 27);
-        R2(c, d, e, a, b, 28);
-        R2(b, c, d, e, a, 29);
-        R2(a, b, c, d, e, 30);
-        R2(e, a, b, c, d, 31);
-        R2(d, e, a, b, c, 32);
-        R2(c, d, e, a, b, 33);
-        R2(b, c, d, e, a, 34);
-        R2(a, b, c, d, e, 35);
-        R2(e, a, b, c, d, 36);
-        R2(d, e, a, b, c, 37);
-        R2(c, d, e, a, b, 38);
-        R2(b, c, d, e, a, 39);
-        R3(a, b, c, d, e, 40);
-        R3(e, a, b, c, d, 41);
-        R3(d, e, a, b, c, 42);
-        R3(c, d, e, a, b, 43);
-        R3(b, c, d, e, a, 44);
-        R3(a, b, c, d, e, 45);
-        R3(e, a, b, c, d, 46);
-        R3(d, e, a, b, c, 47);
-        R3(c, d, e, a, b, 48);
-        R3(b, c, d, e, a, 49);
-        R3(a, b, c, d, e, 50);
-        R3(e, a, b, c, d, 51);
-        R3(d, e, a, b, c, 52);
-        R3(c, d, e, a, b, 53);
-        R3(b, c, d, e, a, 54);
-        R3(a, b, c, d, e, 55);
-        R3(e, a, b, c, d, 56);
-        R3(d, e, a, b, c, 57);
-        R3(c, d, e, a, b, 58);
-        R3(b, c, d, e, a, 59);
-        R4(a, b, c, d, e, 60);
-        R4(e, a, b, c, d, 61);
-        R4(d, e, a, b, c, 62);
-        R4(c, d, e, a, b, 63);
-        R4(b, c, d, e, a, 64);
-        R4(a, b, c, d, e, 65);
-        R4(e, a, b, c, d, 66);
-        R4(d, e, a, b, c, 67);
-        R4(c, d, e, a, b, 68);
-        R4(b, c, d, e, a, 69);
-        R4(a, b, c, d, e, 70);
-        R4(e, a, b, c, d, 71);
-        R4(d, e, a, b, c, 72);
-        R4(c, d, e, a, b, 73);
-        R4(b, c, d, e, a, 74);
-        R4(a, b, c, d, e, 75);
-        R4(e, a, b, c, d, 76);
-        R4(d, e, a, b, c, 77);
-        R4(c, d, e, a, b, 78);
-        R4(b, c, d, e, a, 79);
+        SHA1_ROUNDS(R0, R1, R2, R3, R4);
 
         /* Add the working vars back into context.state[] */
         state[0] += a;
@@ -225,14 +230,104 @@ static void sha1_do_transform(uint32_t state[5], const uint8_t buffer[64]) {
         a = b = c = d = e = 0;
 }
 
+static void sha1_init_state(uint32_t state[static 5]) {
+        /* SHA1 initialization constants */
+        state[0] = 0x67452301;
+        state[1] = 0xEFCDAB89;
+        state[2] = 0x98BADCFE;
+        state[3] = 0x10325476;
+        state[4] = 0xC3D2E1F0;
+}
+
+static void sha1_write_digest(const uint32_t state[static 5], uint8_t result[static SHA1_DIGEST_SIZE]) {
+        for (uint32_t i = 0; i < SHA1_DIGEST_SIZE; i++)
+                result[i] = (uint8_t) ((state[i >> 2] >> ((3 - (i & 3)) * 8)) & 255);
+}
+
+/* Multi-buffer variant of sha1_do_transform() for sha1_batch(). The stub may not touch SIMD registers, but
+ * running the rounds of two independent messages interleaved still lets the CPU overlap their dependency
+ * chains. That only pays off if both sets of working variables fit into registers: on aarch64 they do, on
+ * x86-64 they spill and the interleaved rounds end up slower than hashing the messages one after another,
+ * see tools/bench-sha1.c. Define SHA1_LANES to override. */
+#ifndef SHA1_LANES
+#  if defined(__aarch64__)
+#    define SHA1_LANES 2
+#  else
+#    define SHA1_LANES 1
+#  endif
+#endif
+
+#if SHA1_LANES > 1
+assert_cc(SHA1_LANES == 2);
+#define FOR_LANES(M, ...) M(0, __VA_ARGS__) M(1, __VA_ARGS__)
+
+static inline uint32_t load_be32(const uint8_t *p) {
+        return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
+
+#define F0(w, x, y) ((w & (x ^ y)) ^ y)
+#define F2(w, x, y) (w ^ x ^ y)
+#define F3(w, x, y) (((w | x) & y) | (w & x))
+
+#define lane_blk0(l, i) (lanes[l][i] = load_be32(buffers[l] + 4 * (i)))
+#define lane_blk(l, i)                                                                                    \
+        (lanes[l][(i) & 15] = rol(                                                                        \
+                         lanes[l][((i) + 13) & 15] ^ lanes[l][((i) + 8) & 15] ^ lanes[l][((i) + 2) & 15] ^ \
+                                         lanes[l][(i) & 15],                                              \
+                         1))
+
+#define LANE_R0(l, v, w, x, y, z, i)                                                     \
+        z[l] += F0(w[l], x[l], y[l]) + lane_blk0(l, i) + 0x5A827999 + rol(v[l], 5); \
+        w[l] = rol(w[l], 30);
+#define LANE_R1(l, v, w, x, y, z, i)                                                    \
+        z[l] += F0(w[l], x[l], y[l]) + lane_blk(l, i) + 0x5A827999 + rol(v[l], 5); \
+        w[l] = rol(w[l], 30);
+#define LANE_R2(l, v, w, x, y, z, i)                                                    \
+        z[l] += F2(w[l], x[l], y[l]) + lane_blk(l, i) + 0x6ED9EBA1 + rol(v[l], 5); \
+        w[l] = rol(w[l], 30);
+#define LANE_R3(l, v, w, x, y, z, i)                                                    \
+        z[l] += F3(w[l], x[l], y[l]) + lane_blk(l, i) + 0x8F1BBCDC + rol(v[l], 5); \
+        w[l] = rol(w[l], 30);
+#define LANE_R4(l, v, w, x, y, z, i)                                                    \
+        z[l] += F2(w[l], x[l], y[l]) + lane_blk(l, i) + 0xCA62C1D6 + rol(v[l], 5); \
+        w[l] = rol(w[l], 30);
+
+#define LR0(v, w, x, y, z, i) FOR_LANES(LANE_R0, v, w, x, y, z, i)
+#define LR1(v, w, x, y, z, i) FOR_LANES(LANE_R1, v, w, x, y, z, i)
+#define LR2(v, w, x, y, z, i) FOR_LANES(LANE_R2, v, w, x, y, z, i)
+#define LR3(v, w, x, y, z, i) FOR_LANES(LANE_R3, v, w, x, y, z, i)
+#define LR4(v, w, x, y, z, i) FOR_LANES(LANE_R4, v, w, x, y, z, i)
+
+static void sha1_do_transform_lanes(
+                uint32_t state[static SHA1_LANES][5],
+                const uint8_t *const buffers[static SHA1_LANES]) {
+
+        uint32_t a[SHA1_LANES], b[SHA1_LANES], c[SHA1_LANES], d[SHA1_LANES], e[SHA1_LANES];
+        uint32_t lanes[SHA1_LANES][16];
+
+        for (size_t l = 0; l < SHA1_LANES; l++) {
+                a[l] = state[l][0];
+                b[l] = state[l][1];
+                c[l] = state[l][2];
+                d[l] = state[l][3];
+                e[l] = state[l][4];
+        }
+
+        SHA1_ROUNDS(LR0, LR1, LR2, LR3, LR4);
+
+        for (size_t l = 0; l < SHA1_LANES; l++) {
+                state[l][0] += a[l];
+                state[l][1] += b[l];
+                state[l][2] += c[l];
+                state[l][3] += d[l];
+                state[l][4] += e[l];
+        }
+}
+#endif
+
 /* SHA1Init - Initialize new context */
 void sha1_init_ctx(struct sha1_ctx *ctx) {
-        /* SHA1 initialization constants */
-        ctx->state[0] = 0x67452301;
-        ctx->state[1] = 0xEFCDAB89;
-        ctx->state[2] = 0x98BADCFE;
-        ctx->state[3] = 0x10325476;
-        ctx->state[4] = 0xC3D2E1F0;
+        sha1_init_state(ctx->state);
         ctx->count[0] = ctx->count[1] = 0;
 }
 
@@ -270,9 +365,7 @@ void *sha1_finish_ctx(struct sha1_ctx *ctx, uint8_t result[static SHA1_DIGEST_SI
         while ((ctx->count[0] & 504) != 448)
                 sha1_process_bytes((const uint8_t *) "\0", 1, ctx);
         sha1_process_bytes(finalcount, 8, ctx); /* Should cause a sha1_do_transform() */
-        for (i = 0; i < SHA1_DIGEST_SIZE; i++) {
-                result[i] = (uint8_t) ((ctx->state[i >> 2] >> ((3 - (i & 3)) * 8)) & 255);
-        }
+        sha1_write_digest(ctx->state, result);
 
         /* Wipe variables */
         i = 0;
@@ -281,3 +374,67 @@ void *sha1_finish_ctx(struct sha1_ctx *ctx, uint8_t result[static SHA1_DIGEST_SI
 
         return result;
 }
+
+size_t sha1_pad(uint8_t *buffer, size_t size) {
+        size_t padded = SHA1_PADDED_SIZE(size);
+        uint64_t bits = (uint64_t) size << 3;
+
+        buffer[size] = 0x80;
+        memzero(buffer + size + 1, padded - size - 1 - 8);
+        for (size_t i = 0; i < 8; i++)
+                buffer[padded - 1 - i] = (uint8_t) (bits >> (i * 8));
+
+        return padded / 64;
+}
+
+void sha1_batch(
+                const uint8_t *const messages[],
+                const size_t n_blocks[],
+                size_t n,
+                uint8_t results[][SHA1_DIGEST_SIZE]) {
+
+        uint32_t state[SHA1_LANES][5];
+        size_t message[SHA1_LANES], block[SHA1_LANES], next = 0;
+
+        for (size_t l = 0; l < SHA1_LANES; l++)
+                message[l] = SIZE_MAX;
+
+        for (;;) {
+                const uint8_t *buffers[SHA1_LANES];
+                size_t n_active = 0;
+
+                /* Lanes whose message is done pick up the next one */
+                for (size_t l = 0; l < SHA1_LANES; l++) {
+                        if (message[l] == SIZE_MAX && next < n) {
+                                message[l] = next++;
+                                block[l] = 0;
+                                sha1_init_state(state[l]);
+                        }
+                        if (message[l] == SIZE_MAX)
+                                continue;
+
+                        buffers[l] = messages[message[l]] + block[l] * 64;
+                        n_active++;
+                }
+
+                if (n_active == 0)
+                        break;
+
+#if SHA1_LANES > 1
+                if (n_active == SHA1_LANES)
+                        sha1_do_transform_lanes(state, buffers);
+                else
+#endif
+                        for (size_t l = 0; l < SHA1_LANES; l++)
+                                if (message[l] != SIZE_MAX)
+                                        sha1_do_transform(state[l], buffers[l]);
+
+                for (size_t l = 0; l < SHA1_LANES; l++) {
+                        if (message[l] == SIZE_MAX || ++block[l] < n_blocks[message[l]])
+                                continue;
+
+                        sha1_write_digest(state[l], results[message[l]]);
+                        message[l] = SIZE_MAX;
+                }
+        }
+}
@@ -82,12 +82,16 @@ typedef struct {
         char contents[];
 } _packed_ SmbiosTableType11;
 
-static const void* find_smbios_configuration_table(uint64_t *ret_size) {
+const void* smbios_get_raw_table(const void **ret_entry_point, size_t *ret_entry_point_size, uint64_t *ret_size) {
         assert(ret_size);
 
         const Smbios3EntryPoint *entry3 = find_configuration_table(MAKE_GUID_PTR(SMBIOS3_TABLE));
         if (entry3 && memcmp(entry3->anchor_string, "_SM3_", 5) == 0 &&
             entry3->entry_point_length <= sizeof(*entry3)) {
+                if (ret_entry_point)
+                        *ret_entry_point = entry3;
+                if (ret_entry_point_size)
+                        *ret_entry_point_size = entry3->entry_point_length;
                 *ret_size = entry3->table_maximum_size;
                 return PHYSICAL_ADDRESS_TO_POINTER(entry3->table_address);
         }
@@ -95,17 +99,25 @@ static const void* find_smbios_configuration_table(uint64_t *ret_size) {
         const SmbiosEntryPoint *entry = find_configuration_table(MAKE_GUID_PTR(SMBIOS_TABLE));
         if (entry && memcmp(entry->anchor_string, "_SM_", 4) == 0 &&
             entry->entry_point_length <= sizeof(*entry)) {
+                if (ret_entry_point)
+                        *ret_entry_point = entry;
+                if (ret_entry_point_size)
+                        *ret_entry_point_size = entry->entry_point_length;
                 *ret_size = entry->table_length;
                 return PHYSICAL_ADDRESS_TO_POINTER(entry->table_address);
         }
 
+        if (ret_entry_point)
+                *ret_entry_point = NULL;
+        if (ret_entry_point_size)
+                *ret_entry_point_size = 0;
         *ret_size = 0;
         return NULL;
 }
 
 static const SmbiosHeader* get_smbios_table(uint8_t type, size_t min_size, uint64_t *ret_size_left) {
         uint64_t size;
-        const uint8_t *p = find_smbios_configuration_table(&size);
+        const uint8_t *p = smbios_get_raw_table(NULL, NULL, &size);
         if (!p)
                 goto not_found;
 
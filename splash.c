@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "splash.h"
+#include "util.h"
+
+typedef struct BmpFile {
+        char signature[2];
+        uint32_t size;
+        uint16_t reserved[2];
+        uint32_t offset;
+} _packed_ BmpFile;
+
+typedef struct BmpDib {
+        uint32_t size;
+        int32_t width;
+        int32_t height;         /* Negative for rows stored from the top */
+        uint16_t planes;
+        uint16_t depth;
+        uint32_t compression;
+        uint32_t image_size;
+        int32_t x_pixel_meter;
+        int32_t y_pixel_meter;
+        uint32_t colors_used;
+        uint32_t colors_important;
+} _packed_ BmpDib;
+
+/* Only set for BI_BITFIELDS, right after the BITMAPINFOHEADER part of the DIB header */
+typedef struct BmpMasks {
+        uint32_t red;
+        uint32_t green;
+        uint32_t blue;
+} _packed_ BmpMasks;
+
+#define BMP_BI_RGB       0U
+#define BMP_BI_BITFIELDS 3U
+
+static EFI_STATUS splash_from_raw(
+                const uint8_t *content,
+                size_t size,
+                const EFI_GRAPHICS_OUTPUT_BLT_PIXEL **ret_pixels,
+                size_t *ret_width,
+                size_t *ret_height) {
+
+        assert(content);
+        assert(ret_pixels);
+        assert(ret_width);
+        assert(ret_height);
+
+        const SplashHeader *h = (const SplashHeader *) content;
+        if (size < sizeof(SplashHeader) || h->magic != SPLASH_MAGIC)
+                return EFI_UNSUPPORTED;
+
+        if (h->header_size < sizeof(SplashHeader) || h->header_size % sizeof(uint32_t) != 0 ||
+            h->width == 0 || h->width > SPLASH_DIMENSION_MAX ||
+            h->height == 0 || h->height > SPLASH_DIMENSION_MAX ||
+            h->header_size > size ||
+            (size - h->header_size) / sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL) / h->width < h->height)
+                return EFI_INVALID_PARAMETER;
+
+        *ret_pixels = (const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *) (content + h->header_size);
+        *ret_width = h->width;
+        *ret_height = h->height;
+        return EFI_SUCCESS;
+}
+
+static EFI_STATUS splash_from_bmp(
+                const uint8_t *content,
+                size_t size,
+                EFI_GRAPHICS_OUTPUT_BLT_PIXEL **ret_pixels,
+                size_t *ret_width,
+                size_t *ret_height) {
+
+        assert(content);
+        assert(ret_pixels);
+        assert(ret_width);
+        assert(ret_height);
+
+        if (size < sizeof(BmpFile) + sizeof(BmpDib))
+                return EFI_UNSUPPORTED;
+
+        const BmpFile *file = (const BmpFile *) content;
+        const BmpDib *dib = (const BmpDib *) (content + sizeof(BmpFile));
+        if (memcmp(file->signature, "BM", sizeof(file->signature)) != 0)
+                return EFI_UNSUPPORTED;
+
+        if (dib->size < sizeof(BmpDib) || dib->planes != 1 || !IN_SET(dib->depth, 24, 32))
+                return EFI_UNSUPPORTED;
+
+        /* 32-bit BMPs often come with explicit masks, which are fine as long as they are the usual ones */
+        if (dib->compression == BMP_BI_BITFIELDS) {
+                if (dib->depth != 32 || size < sizeof(BmpFile) + sizeof(BmpDib) + sizeof(BmpMasks))
+                        return EFI_UNSUPPORTED;
+
+                const BmpMasks *masks = (const BmpMasks *) (content + sizeof(BmpFile) + sizeof(BmpDib));
+                if (masks->red != 0x00ff0000 || masks->green != 0x0000ff00 || masks->blue != 0x000000ff)
+                        return EFI_UNSUPPORTED;
+        } else if (dib->compression != BMP_BI_RGB)
+                return EFI_UNSUPPORTED;
+
+        if (dib->width <= 0 || (uint32_t) dib->width > SPLASH_DIMENSION_MAX ||
+            dib->height == 0 || dib->height < -(int32_t) SPLASH_DIMENSION_MAX ||
+            dib->height > (int32_t) SPLASH_DIMENSION_MAX)
+                return EFI_INVALID_PARAMETER;
+
+        bool top_down = dib->height < 0;
+        size_t width = dib->width, height = top_down ? -dib->height : dib->height;
+        size_t bytes_per_pixel = dib->depth / 8;
+        /* Rows are padded to 4 bytes */
+        size_t stride = (width * bytes_per_pixel + 3) & ~(size_t) 3;
+
+        if (file->offset > size || (size - file->offset) / stride < height)
+                return EFI_INVALID_PARAMETER;
+
+        EFI_GRAPHICS_OUTPUT_BLT_PIXEL *pixels = xnew(EFI_GRAPHICS_OUTPUT_BLT_PIXEL, width * height);
+        for (size_t y = 0; y < height; y++) {
+                const uint8_t *src = content + file->offset + (top_down ? y : height - 1 - y) * stride;
+                EFI_GRAPHICS_OUTPUT_BLT_PIXEL *dst = pixels + y * width;
+
+                /* Blue, green, red and one unused byte, which is what Blt() takes already */
+                if (bytes_per_pixel == sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL)) {
+                        memcpy(dst, src, width * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+                        continue;
+                }
+
+                for (size_t x = 0; x < width; x++, src += 3)
+                        dst[x] = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL) {
+                                .Blue = src[0],
+                                .Green = src[1],
+                                .Red = src[2],
+                        };
+        }
+
+        *ret_pixels = pixels;
+        *ret_width = width;
+        *ret_height = height;
+        return EFI_SUCCESS;
+}
+
+static void center(size_t image, size_t screen, size_t *ret_src, size_t *ret_dst, size_t *ret_len) {
+        if (image > screen) {
+                *ret_src = (image - screen) / 2;
+                *ret_dst = 0;
+                *ret_len = screen;
+        } else {
+                *ret_src = 0;
+                *ret_dst = (screen - image) / 2;
+                *ret_len = image;
+        }
+}
+
+EFI_STATUS splash_show(const void *content, size_t size) {
+        _cleanup_free_ EFI_GRAPHICS_OUTPUT_BLT_PIXEL *converted = NULL;
+        const EFI_GRAPHICS_OUTPUT_BLT_PIXEL *pixels;
+        size_t width, height;
+        EFI_STATUS err;
+
+        assert(content);
+
+        /* Look for the screen first, there is no point in converting anything on a headless machine */
+        EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = NULL;
+        err = BS->LocateProtocol(MAKE_GUID_PTR(EFI_GRAPHICS_OUTPUT_PROTOCOL), NULL, (void **) &gop);
+        if (err != EFI_SUCCESS)
+                return err;
+        if (!gop || !gop->Mode || !gop->Mode->Info)
+                return EFI_NOT_FOUND;
+
+        err = splash_from_raw(content, size, &pixels, &width, &height);
+        if (err == EFI_UNSUPPORTED) {
+                err = splash_from_bmp(content, size, &converted, &width, &height);
+                pixels = converted;
+        }
+        if (err != EFI_SUCCESS)
+                return err;
+
+        size_t src_x, src_y, dst_x, dst_y, blt_width, blt_height;
+        center(width, gop->Mode->Info->HorizontalResolution, &src_x, &dst_x, &blt_width);
+        center(height, gop->Mode->Info->VerticalResolution, &src_y, &dst_y, &blt_height);
+        if (blt_width == 0 || blt_height == 0)
+                return EFI_SUCCESS;
+
+        /* Blt() only reads from the buffer for EfiBltBufferToVideo, even though it isn't declared const */
+        return gop->Blt(
+                        gop,
+                        (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *) pixels,
+                        EfiBltBufferToVideo,
+                        src_x,
+                        src_y,
+                        dst_x,
+                        dst_y,
+                        blt_width,
+                        blt_height,
+                        width * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+}
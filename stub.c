@@ -1,13 +1,23 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include "bench.h"
+#include "capture.h"
 #include "devicetree.h"
+#include "devicetree-export.h"
+#include "devicetree-sidecar.h"
 #include "efi-log.h"
+#include "proto/dt-fixup.h"
 #include "proto/loaded-image.h"
 #include "linux.h"
 #include "measure.h"
+#include "mp.h"
 #include "pe.h"
 #include "proto/shell-parameters.h"
 #include "sbat.h"
+#include "splash.h"
+#include "string-util-fundamental.h"
+#include "ticks.h"
+#include "trace.h"
 #include "uki.h"
 #include "util.h"
 #include "version.h"
@@ -23,6 +33,18 @@ static bool parse_string(char16_t *p, const char16_t *opt) {
         return false;
 }
 
+static char16_t *parse_path(const char16_t *p) {
+        const char16_t *e = strchr16(p, ' ');
+        char16_t *path = xstrndup16(p, e ? (size_t) (e - p) : SIZE_MAX);
+
+        /* Accept forward slashes for convenience */
+        for (char16_t *c = path; *c != '\0'; c++)
+                if (*c == '/')
+                        *c = '\\';
+
+        return path;
+}
+
 static void parse_cmdline(char16_t *p) {
         assert(p);
         while (*p != '\0') {
@@ -36,6 +58,40 @@ static void parse_cmdline(char16_t *p) {
                         } else if (parse_string(p, L"false")) {
                                 dtb_override = false;
                         }
+                } else if (strncmp16(p, L"stubble.dtb_sidecar=",
+                                        strlen16(L"stubble.dtb_sidecar=")) == 0) {
+                        p += strlen16(L"stubble.dtb_sidecar=");
+                        free(dtb_sidecar_path);
+                        dtb_sidecar_path = parse_path(p);
+                } else if (strncmp16(p, L"stubble.mp=", strlen16(L"stubble.mp=")) == 0) {
+                        p += strlen16(L"stubble.mp=");
+                        if (parse_string(p, L"true")) {
+                                mp_enabled = true;
+                        } else if (parse_string(p, L"false")) {
+                                mp_enabled = false;
+                        }
+                } else if (parse_string(p, L"stubble.capture")) {
+                        /* An empty path picks a file name from the CHIDs */
+                        free(capture_path);
+                        capture_path = xstrdup16(u"");
+                } else if (strncmp16(p, L"stubble.capture=", strlen16(L"stubble.capture=")) == 0) {
+                        p += strlen16(L"stubble.capture=");
+                        free(capture_path);
+                        capture_path = parse_path(p);
+                } else if (parse_string(p, L"stubble.trace")) {
+                        trace_init();
+                } else if (strncmp16(p, L"stubble.bench=", strlen16(L"stubble.bench=")) == 0) {
+                        p += strlen16(L"stubble.bench=");
+                        uint64_t n;
+                        const char16_t *tail;
+                        if (parse_number16(p, &n, &tail) && IN_SET(*tail, ' ', '\0'))
+                                bench_iterations = MIN(n, (uint64_t) BENCH_ITERATIONS_MAX);
+                } else if (strncmp16(p, L"stubble.error_pause=", strlen16(L"stubble.error_pause=")) == 0) {
+                        p += strlen16(L"stubble.error_pause=");
+                        uint64_t sec;
+                        const char16_t *tail;
+                        if (parse_number16(p, &sec, &tail) && IN_SET(*tail, ' ', '\0'))
+                                log_pause_usec = MIN(sec, UINT64_C(3600)) * 1000 * 1000;
                 }
                 p = strchr16(p, ' ');
                 if (p == NULL)
@@ -92,7 +148,7 @@ nothing:
         return;
 }
 
-static void install_embedded_devicetree(
+static bool install_embedded_devicetree(
                 EFI_LOADED_IMAGE_PROTOCOL *loaded_image,
                 const PeSectionVector sections[static _UNIFIED_SECTION_MAX],
                 struct devicetree_state *dt_state) {
@@ -111,14 +167,49 @@ static void install_embedded_devicetree(
         else if (PE_SECTION_VECTOR_IS_SET(sections + UNIFIED_SECTION_DTB))
                 section = UNIFIED_SECTION_DTB;
         else
-                return;
+                return false;
 
         err = devicetree_install_from_memory(
                         dt_state,
                         (const uint8_t*) loaded_image->ImageBase + sections[section].memory_offset,
                         sections[section].memory_size);
-        if (err != EFI_SUCCESS)
-                log_error_status(err, "Error loading embedded devicetree, ignoring: %m");
+        if (err != EFI_SUCCESS) {
+                log_warning_status(err, "Error loading embedded devicetree, ignoring: %m");
+                return false;
+        }
+
+        return true;
+}
+
+static bool install_sidecar_devicetree(
+                EFI_LOADED_IMAGE_PROTOCOL *loaded_image,
+                const PeSectionVector sections[static _UNIFIED_SECTION_MAX],
+                struct devicetree_state *dt_state) {
+
+        EFI_STATUS err;
+
+        assert(loaded_image);
+        assert(sections);
+        assert(dt_state);
+
+        if (!dtb_sidecar_path)
+                return false;
+
+        const void *hwids = NULL;
+        size_t hwids_size = 0;
+        if (PE_SECTION_VECTOR_IS_SET(sections + UNIFIED_SECTION_HWIDS)) {
+                hwids = (const uint8_t*) loaded_image->ImageBase + sections[UNIFIED_SECTION_HWIDS].memory_offset;
+                hwids_size = sections[UNIFIED_SECTION_HWIDS].memory_size;
+        }
+
+        err = devicetree_sidecar_install(loaded_image, dtb_sidecar_path, hwids, hwids_size, dt_state);
+        if (err == EFI_SUCCESS)
+                return true;
+
+        /* Errors have been logged already, fall back to what the UKI brings */
+        log_debug("No devicetree from sidecar %ls, using embedded devicetree: %m", dtb_sidecar_path);
+        devicetree_cleanup(dt_state);
+        return false;
 }
 
 static EFI_STATUS find_sections(
@@ -130,16 +221,19 @@ static EFI_STATUS find_sections(
         assert(loaded_image);
         assert(sections);
 
-        const PeSectionHeader *section_table;
-        size_t n_section_table;
-        err = pe_section_table_from_base(loaded_image->ImageBase, &section_table, &n_section_table);
+        PeImage pe;
+        err = pe_image_parse(
+                        loaded_image->ImageBase,
+                        loaded_image->ImageSize,
+                        /* allow_compatibility= */ false,
+                        &pe);
         if (err != EFI_SUCCESS)
                 return log_error_status(err, "Unable to locate PE section table: %m");
 
         /* Get the base sections */
         pe_locate_sections(
-                    section_table,
-                    n_section_table,
+                    pe.sections,
+                    pe.n_sections,
                     unified_sections,
                     /* validate_base= */ PTR_TO_SIZE(loaded_image->ImageBase),
                     sections);
@@ -170,12 +264,43 @@ static EFI_STATUS run(EFI_HANDLE image) {
                 log_debug("Stubble configuration:");
                 log_debug("debug: enabled");
                 log_debug("dtb_override: %s", dtb_override ? "enabled" : "disabled");
+                log_debug("mp: %s", mp_enabled ? "enabled" : "disabled");
+                log_debug("dtb_sidecar: %ls", dtb_sidecar_path ?: u"none");
+                log_debug("capture: %ls", !capture_path ? u"disabled" : isempty(capture_path) ? u"default path" : capture_path);
+                log_debug("trace: %s", log_istrace ? "enabled" : "disabled");
+                log_debug("bench: %u", bench_iterations);
         }
 
+        /* Record what the firmware hands us before we start changing things, i.e. before installing a DT */
+        if (capture_path)
+                (void) capture_write(loaded_image, capture_path);
+
+        uint64_t phase = ticks_read();
+
         /* Find the sections we want to operate on */
         err = find_sections(loaded_image, sections);
         if (err != EFI_SUCCESS)
                 return err;
+        log_phase("sections", &phase);
+
+        /* Draw the splash before anything else, it is what is on the screen until the kernel takes over */
+        if (PE_SECTION_VECTOR_IS_SET(sections + UNIFIED_SECTION_SPLASH)) {
+                err = splash_show(
+                                (const uint8_t*) loaded_image->ImageBase + sections[UNIFIED_SECTION_SPLASH].memory_offset,
+                                sections[UNIFIED_SECTION_SPLASH].memory_size);
+                /* No graphics output is nothing to warn about */
+                if (err == EFI_NOT_FOUND)
+                        log_debug("No graphics output, not showing splash.");
+                else if (err != EFI_SUCCESS)
+                        log_warning_status(err, "Unable to show splash, ignoring: %m");
+                log_phase("splash", &phase);
+        }
+
+        if (bench_iterations > 0) {
+                bench_run(loaded_image, sections);
+                /* Not part of any phase */
+                phase = ticks_read();
+        }
 
         /* Let's measure the passed kernel command line into the TPM. Note that this possibly
          * duplicates what we already did in the boot menu, if that was already
@@ -183,9 +308,21 @@ static EFI_STATUS run(EFI_HANDLE image) {
          * this stub to be usable from any boot menu, let's measure things anyway. */
         bool m = false;
         (void) tpm_log_load_options(cmdline, &m);
-
-        /* Load the base device tree. */
-        install_embedded_devicetree(loaded_image, sections, &dt_state);
+        log_phase("measure", &phase);
+
+        /* Load the base device tree, preferring the sidecar if there is one. */
+        DevicetreeOrigin dt_origin;
+        if (install_sidecar_devicetree(loaded_image, sections, &dt_state))
+                dt_origin = DEVICETREE_ORIGIN_SIDECAR;
+        else if (install_embedded_devicetree(loaded_image, sections, &dt_state))
+                dt_origin = PE_SECTION_VECTOR_IS_SET(sections + UNIFIED_SECTION_DTBAUTO) ?
+                            DEVICETREE_ORIGIN_DTBAUTO : DEVICETREE_ORIGIN_DTB;
+        else if (find_configuration_table(MAKE_GUID_PTR(EFI_DTB_TABLE)))
+                dt_origin = DEVICETREE_ORIGIN_FIRMWARE;
+        else
+                dt_origin = DEVICETREE_ORIGIN_NONE;
+        devicetree_export(dt_origin);
+        log_phase("devicetree", &phase);
 
         /* Find initrd if there is a .initrd section */
         if (PE_SECTION_VECTOR_IS_SET(sections + UNIFIED_SECTION_INITRD))
@@ -197,6 +334,9 @@ static EFI_STATUS run(EFI_HANDLE image) {
                         (const uint8_t*) loaded_image->ImageBase + sections[UNIFIED_SECTION_LINUX].memory_offset,
                         sections[UNIFIED_SECTION_LINUX].memory_size);
 
+        arena_log_stats();
+        bs_stats_report();
+
         err = linux_exec(image, cmdline, &kernel, &initrd);
         return err;
 }
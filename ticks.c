@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "efi-log.h"
+#include "ticks.h"
+#include "util.h"
+
+uint64_t ticks_freq(void) {
+        static uint64_t cache = 0;
+
+        if (cache != 0)
+                return cache;
+
+#if defined(__aarch64__)
+        asm volatile("mrs %0, cntfrq_el0" : "=r"(cache));
+#elif defined(__x86_64__) || defined(__i386__)
+        /* The TSC frequency isn't reliably reported anywhere, so measure it against the firmware's
+         * notion of time. 1ms is plenty for the precision we need here. */
+        uint64_t ticks_start = ticks_read();
+        BS->Stall(1000);
+        uint64_t ticks_end = ticks_read();
+
+        if (ticks_end > ticks_start)
+                cache = (ticks_end - ticks_start) * 1000UL;
+#endif
+
+        return cache;
+}
+
+uint64_t ticks_to_usec(uint64_t ticks) {
+        uint64_t freq = ticks_freq();
+        if (freq == 0)
+                return 0;
+
+        /* Split to avoid overflowing for large deltas */
+        return ticks / freq * 1000000UL + ticks % freq * 1000000UL / freq;
+}
+
+void log_phase(const char *name, uint64_t *start) {
+        assert(name);
+        assert(start);
+
+        if (!log_isdebug && !log_istrace)
+                return;
+
+        log_debug("phase %s: %" PRIu64 " us", name, ticks_to_usec(ticks_read() - *start));
+        *start = ticks_read();
+}
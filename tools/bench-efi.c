@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* Just enough of a firmware for the host benchmarks to call stubble code that allocates. Everything except the
+ * pool and memory functions is left NULL. */
+
+#include "bench-efi.h"
+#include "efi.h"
+
+EFI_SYSTEM_TABLE *ST;
+EFI_BOOT_SERVICES *BS;
+EFI_RUNTIME_SERVICES *RT;
+
+static EFI_BOOT_SERVICES bench_bs;
+static void *(*host_alloc)(size_t size);
+static void (*host_release)(void *p);
+
+static EFIAPI EFI_STATUS bench_allocate_pool(EFI_MEMORY_TYPE pool_type, size_t size, void **buffer) {
+        void *p = host_alloc(size);
+        if (!p)
+                return EFI_OUT_OF_RESOURCES;
+
+        *buffer = p;
+        return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS bench_free_pool(void *buffer) {
+        host_release(buffer);
+        return EFI_SUCCESS;
+}
+
+static EFIAPI void bench_copy_mem(void *dest, void *src, size_t length) {
+        __builtin_memmove(dest, src, length);
+}
+
+static EFIAPI void bench_set_mem(void *buffer, size_t size, uint8_t value) {
+        __builtin_memset(buffer, value, size);
+}
+
+void bench_efi_init(void *(*alloc)(size_t size), void (*release)(void *p)) {
+        host_alloc = alloc;
+        host_release = release;
+
+        bench_bs = (EFI_BOOT_SERVICES) {
+                .AllocatePool = bench_allocate_pool,
+                .FreePool = bench_free_pool,
+                .CopyMem = bench_copy_mem,
+                .SetMem = bench_set_mem,
+        };
+        BS = &bench_bs;
+}
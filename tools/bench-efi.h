@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+/* Interface between the host benchmarks, built against libc, and the bit of fake firmware that lets them call
+ * stubble code that allocates, built freestanding against the EFI headers. Hence only plain C types here. */
+
+#include <stddef.h>
+
+/* Sets up boot services whose pool allocations are served by the given functions */
+void bench_efi_init(void *(*alloc)(size_t size), void (*release)(void *p));
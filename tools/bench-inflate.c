@@ -0,0 +1,403 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* Times the stub's gzip decompressor, built with the same flags as for the stub, on a gzip file such as the
+ * payload of a zboot kernel, or on synthetic data that looks a bit like a kernel image. If built against zlib,
+ * the output is compared against zlib's and zlib is timed as well. Truncated and corrupted input is fed to
+ * the decompressor to check that it fails cleanly without writing past the end of the output. */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench-efi.h"
+
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* From include/inflate.h and include/efi.h, which can't be included here as they are meant for
+ * freestanding builds only */
+typedef size_t EFI_STATUS;
+#define EFI_ERROR_MASK ((EFI_STATUS) 1 << (sizeof(EFI_STATUS) * 8 - 1))
+#define EFI_SUCCESS 0
+#define EFI_UNSUPPORTED (EFI_ERROR_MASK | 3)
+#define EFI_BUFFER_TOO_SMALL (EFI_ERROR_MASK | 5)
+#define EFI_COMPROMISED_DATA (EFI_ERROR_MASK | 33)
+
+EFI_STATUS gzip_decompress(const void *src, size_t src_size, void *dst, size_t dst_size, size_t *ret_size);
+
+/* Bytes after the end of the output that must stay untouched */
+#define GUARD_SIZE 64U
+#define GUARD_BYTE 0xa5
+
+/* Decompressing damaged input is tried on at most this much of the data */
+#define DAMAGE_SIZE_MAX (256U * 1024U)
+
+#define MIN_SIZE(a, b) ((a) < (b) ? (a) : (b))
+
+static unsigned n_checks, n_failures;
+
+static void check(bool ok, const char *what, size_t arg) {
+        n_checks++;
+        if (ok)
+                return;
+
+        n_failures++;
+        if (n_failures <= 10)
+                fprintf(stderr, "FAIL: %s (%zu)\n", what, arg);
+}
+
+static uint64_t now_ns(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+static void *xmalloc(size_t size) {
+        void *p = malloc(size ?: 1);
+        if (!p) {
+                fprintf(stderr, "Out of memory.\n");
+                exit(EXIT_FAILURE);
+        }
+        return p;
+}
+
+static bool guard_intact(const uint8_t *p) {
+        for (size_t i = 0; i < GUARD_SIZE; i++)
+                if (p[i] != GUARD_BYTE)
+                        return false;
+        return true;
+}
+
+static uint8_t *read_file(const char *path, size_t *ret_size) {
+        FILE *f = fopen(path, "re");
+        if (!f) {
+                fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        size_t size = 0, allocated = 1024 * 1024;
+        uint8_t *buf = xmalloc(allocated);
+        for (;;) {
+                size += fread(buf + size, 1, allocated - size, f);
+                if (size < allocated)
+                        break;
+                allocated *= 2;
+                buf = realloc(buf, allocated);
+                if (!buf) {
+                        fprintf(stderr, "Out of memory.\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+        if (ferror(f)) {
+                fprintf(stderr, "Failed to read %s.\n", path);
+                exit(EXIT_FAILURE);
+        }
+        fclose(f);
+
+        *ret_size = size;
+        return buf;
+}
+
+/* The uncompressed size modulo 4 GiB, from the gzip trailer */
+static size_t gzip_isize(const uint8_t *gz, size_t size) {
+        if (size < 4)
+                return 0;
+        return gz[size - 4] | gz[size - 3] << 8 | gz[size - 2] << 16 | (size_t) gz[size - 1] << 24;
+}
+
+#if HAVE_ZLIB
+/* Something with the mix of code, tables, strings and zero padding of a kernel image, so that all kinds of
+ * blocks, matches and literals show up */
+static uint8_t *synthesize(size_t size) {
+        static const char *const words[] = {
+                "kernel", "device", "memory", "driver", "failed", "register", "module", "interrupt",
+                "%s: %d\n", "0x%08lx", "mutex_lock", "spin_unlock", "efi", "pci", "usb", "acpi",
+        };
+        uint8_t *p = xmalloc(size);
+        size_t i = 0;
+
+        while (i < size) {
+                size_t n = MIN_SIZE(size - i, 64 + (size_t) rand() % 4096);
+                switch (rand() % 4) {
+                case 0: /* Zero padding */
+                        memset(p + i, 0, n);
+                        break;
+                case 1: /* Strings */
+                        for (size_t j = 0; j < n; j++) {
+                                const char *w = words[rand() % (sizeof(words) / sizeof(words[0]))];
+                                for (; *w && j < n; w++, j++)
+                                        p[i + j] = (uint8_t) *w;
+                                if (j < n)
+                                        p[i + j] = ' ';
+                        }
+                        break;
+                case 2: /* Code: a few opcodes with random operands */
+                        for (size_t j = 0; j < n; j++)
+                                p[i + j] = j % 4 == 0 ? (uint8_t) (0x90 + rand() % 8) : (uint8_t) (rand() % 16);
+                        break;
+                default: /* Tables of pointers */
+                        for (size_t j = 0; j < n; j++)
+                                p[i + j] = j % 8 < 3 ? (uint8_t) rand() : j % 8 < 5 ? 0xff : 0x80;
+                }
+                i += n;
+        }
+
+        return p;
+}
+
+static uint8_t *zlib_compress(const uint8_t *data, size_t size, size_t *ret_size) {
+        z_stream z = {};
+
+        /* 16 + 15 window bits asks for a gzip header and trailer */
+        if (deflateInit2(&z, 9, Z_DEFLATED, 16 + 15, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+                fprintf(stderr, "deflateInit2() failed.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        size_t allocated = deflateBound(&z, size);
+        uint8_t *out = xmalloc(allocated);
+        z.next_in = (uint8_t *) data;
+        z.avail_in = size;
+        z.next_out = out;
+        z.avail_out = allocated;
+        if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+                fprintf(stderr, "deflate() failed.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        *ret_size = z.total_out;
+        deflateEnd(&z);
+        return out;
+}
+
+static size_t zlib_decompress(const uint8_t *gz, size_t gz_size, uint8_t *dst, size_t dst_size) {
+        z_stream z = {};
+
+        if (inflateInit2(&z, 16 + 15) != Z_OK) {
+                fprintf(stderr, "inflateInit2() failed.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        z.next_in = (uint8_t *) gz;
+        z.avail_in = gz_size;
+        z.next_out = dst;
+        z.avail_out = dst_size;
+        int r = inflate(&z, Z_FINISH);
+        size_t size = z.total_out;
+        inflateEnd(&z);
+
+        return r == Z_STREAM_END ? size : SIZE_MAX;
+}
+#endif
+
+static void check_output(const uint8_t *gz, size_t gz_size, const uint8_t *expected, size_t expected_size) {
+        uint8_t *out = xmalloc(expected_size + GUARD_SIZE);
+        size_t size = 0;
+
+        memset(out + expected_size, GUARD_BYTE, GUARD_SIZE);
+        check(gzip_decompress(gz, gz_size, out, expected_size, &size) == EFI_SUCCESS, "decompressing", gz_size);
+        check(size == expected_size, "output size", size);
+        check(memcmp(out, expected, MIN_SIZE(size, expected_size)) == 0, "output content", 0);
+        check(guard_intact(out + expected_size), "writing past the output", 0);
+
+        /* Peeking at the start through a smaller buffer */
+        static const size_t peek_sizes[] = { 0, 1, 7, 64, 4096, 65536, 1000003 };
+        for (size_t i = 0; i < sizeof(peek_sizes) / sizeof(peek_sizes[0]); i++) {
+                size_t n = peek_sizes[i];
+                if (n >= expected_size)
+                        continue;
+
+                memset(out + n, GUARD_BYTE, GUARD_SIZE);
+                check(gzip_decompress(gz, gz_size, out, n, &size) == EFI_BUFFER_TOO_SMALL && size == n,
+                      "peeking", n);
+                check(memcmp(out, expected, n) == 0, "peeked content", n);
+                check(guard_intact(out + n), "writing past the peek buffer", n);
+        }
+
+        free(out);
+}
+
+static void check_damage(const uint8_t *gz, size_t gz_size, size_t out_size, unsigned n_damaged) {
+        uint8_t *out = xmalloc(out_size + GUARD_SIZE);
+        uint8_t *bad = xmalloc(gz_size);
+        size_t size;
+
+        memset(out + out_size, GUARD_BYTE, GUARD_SIZE);
+
+        for (unsigned i = 0; i < n_damaged; i++) {
+                size_t cut = (size_t) rand() % gz_size;
+                EFI_STATUS r = gzip_decompress(gz, cut, out, out_size, &size);
+                check(r == EFI_COMPROMISED_DATA || r == EFI_UNSUPPORTED, "truncated input", cut);
+                check(guard_intact(out + out_size), "writing past the output on truncated input", cut);
+
+                memcpy(bad, gz, gz_size);
+                size_t pos = (size_t) rand() % gz_size;
+                bad[pos] ^= (uint8_t) (1 + rand() % 255);
+                r = gzip_decompress(bad, gz_size, out, out_size, &size);
+                /* Flipping bits in a stored block or a name field goes unnoticed but for the CRC */
+                check(r != EFI_SUCCESS || (size == out_size && guard_intact(out + out_size)), "corrupted input", pos);
+                check(guard_intact(out + out_size), "writing past the output on corrupted input", pos);
+        }
+
+        check(gzip_decompress("not gzip at all", 15, out, out_size, &size) == EFI_UNSUPPORTED, "non-gzip input", 0);
+
+        free(bad);
+        free(out);
+}
+
+/* Best of 'rounds' runs, in nanoseconds */
+static double time_decompress(
+                size_t (*f)(const uint8_t *gz, size_t gz_size, uint8_t *dst, size_t dst_size),
+                const uint8_t *gz,
+                size_t gz_size,
+                uint8_t *dst,
+                size_t dst_size,
+                unsigned rounds) {
+
+        double best = 0;
+
+        for (unsigned r = 0; r < rounds; r++) {
+                uint64_t start = now_ns();
+                if (f(gz, gz_size, dst, dst_size) != dst_size) {
+                        fprintf(stderr, "Decompression failed while timing.\n");
+                        exit(EXIT_FAILURE);
+                }
+                __asm__ volatile("" ::: "memory");
+                double t = (double) (now_ns() - start);
+                if (r == 0 || t < best)
+                        best = t;
+        }
+
+        return best;
+}
+
+static size_t stub_decompress(const uint8_t *gz, size_t gz_size, uint8_t *dst, size_t dst_size) {
+        size_t size;
+
+        if (gzip_decompress(gz, gz_size, dst, dst_size, &size) != EFI_SUCCESS)
+                return SIZE_MAX;
+        return size;
+}
+
+static void report(const char *name, double ns, size_t size, double base) {
+        printf("%-10s %9.2f ms %8.1f MB/s %6.2fx\n", name, ns / 1e6, (double) size * 1e3 / ns, base / ns);
+}
+
+static void help(void) {
+        printf("Usage: bench-inflate [OPTIONS] [FILE.gz]\n\n"
+               "  -S --size=N         Size of the synthetic data in MiB if no file is given (default 32)\n"
+               "  -d --damaged=N      Truncated and corrupted inputs to check (default 500)\n"
+               "  -r --rounds=N       Rounds, the best one counts (default 10)\n"
+               "  -s --seed=N         Seed for the synthetic data and the damage\n");
+}
+
+int main(int argc, char *argv[]) {
+        static const struct option options[] = {
+                { "size",    required_argument, NULL, 'S' },
+                { "damaged", required_argument, NULL, 'd' },
+                { "rounds",  required_argument, NULL, 'r' },
+                { "seed",    required_argument, NULL, 's' },
+                { "help",    no_argument,       NULL, 'h' },
+                {}
+        };
+        unsigned size_mib = 32, n_damaged = 500, rounds = 10, seed = 1;
+        int c;
+
+        while ((c = getopt_long(argc, argv, "S:d:r:s:h", options, NULL)) >= 0)
+                switch (c) {
+                case 'S':
+                        size_mib = (unsigned) strtoul(optarg, NULL, 0);
+                        break;
+                case 'd':
+                        n_damaged = (unsigned) strtoul(optarg, NULL, 0);
+                        break;
+                case 'r':
+                        rounds = (unsigned) strtoul(optarg, NULL, 0);
+                        break;
+                case 's':
+                        seed = (unsigned) strtoul(optarg, NULL, 0);
+                        break;
+                case 'h':
+                        help();
+                        return EXIT_SUCCESS;
+                default:
+                        return EXIT_FAILURE;
+                }
+
+        if (size_mib == 0 || rounds == 0 || optind < argc - 1) {
+                fprintf(stderr, "Invalid arguments.\n");
+                return EXIT_FAILURE;
+        }
+
+        bench_efi_init(malloc, free);
+        srand(seed);
+
+        uint8_t *gz, *data = NULL;
+        size_t gz_size, size;
+        if (optind < argc) {
+                gz = read_file(argv[optind], &gz_size);
+                size = gzip_isize(gz, gz_size);
+#if HAVE_ZLIB
+                /* ISIZE is only the size modulo 4 GiB, have zlib tell the real one */
+                data = xmalloc(size);
+                if (zlib_decompress(gz, gz_size, data, size) != size) {
+                        fprintf(stderr, "%s is not a gzip file zlib can decompress.\n", argv[optind]);
+                        return EXIT_FAILURE;
+                }
+#endif
+        } else {
+#if HAVE_ZLIB
+                size = (size_t) size_mib * 1024 * 1024;
+                data = synthesize(size);
+                gz = zlib_compress(data, size, &gz_size);
+#else
+                fprintf(stderr, "Built without zlib, a gzip file to decompress is needed.\n");
+                return EXIT_FAILURE;
+#endif
+        }
+
+        uint8_t *out = xmalloc(size);
+
+        if (data)
+                check_output(gz, gz_size, data, size);
+        else
+                /* Without a reference the CRC in the trailer has to do */
+                check(stub_decompress(gz, gz_size, out, size) == size, "decompressing", gz_size);
+
+#if HAVE_ZLIB
+        /* Damage is looked for on something smaller, or this takes forever */
+        size_t small_size = MIN_SIZE(size, DAMAGE_SIZE_MAX), small_gz_size;
+        uint8_t *small = data ?: synthesize(small_size);
+        uint8_t *small_gz = zlib_compress(small, small_size, &small_gz_size);
+        check_damage(small_gz, small_gz_size, small_size, n_damaged);
+        free(small_gz);
+        if (small != data)
+                free(small);
+#else
+        check_damage(gz, gz_size, size, n_damaged);
+#endif
+
+        printf("%u checks, %u failed\n", n_checks, n_failures);
+        if (n_failures > 0)
+                return EXIT_FAILURE;
+
+        printf("%zu bytes compressed to %zu\n", size, gz_size);
+
+        double base = time_decompress(stub_decompress, gz, gz_size, out, size, rounds);
+        report("stub", base, size, base);
+#if HAVE_ZLIB
+        report("zlib", time_decompress(zlib_decompress, gz, gz_size, out, size, rounds), size, base);
+#endif
+
+        free(out);
+        free(data);
+        free(gz);
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,560 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: LGPL-2.1-or-later
+
+"""
+End-to-end boot time benchmark of stubble under QEMU.
+
+Assembles synthetic UKIs from stubble.efi, a tiny EFI "kernel", an initrd of
+random data and a configurable number of generated DTBs and .hwids entries,
+boots each of them under QEMU with OVMF/AAVMF and a fake SMBIOS, and collects
+the "phase" timings of the stub.
+
+The stub runs with stubble.trace rather than in debug mode, so that writing
+log messages to the serial console doesn't end up in the timings. The kernel
+dumps the StubbleTrace variable to the console, and the phases are decoded
+from it against the stubble ELF (--elf), see tools/stubble-trace.py.
+
+The DT (and .hwids entry) matching the fake machine is always the last one, so
+that matching has to look at all candidates. On aarch64 QEMU passes its own DT
+to the firmware, the matching DT therefore also carries its compatible.
+
+The kernel prints a marker, dumps the trace and powers the machine off, so each
+boot ends soon after the stub handed over. Besides the stub's own phases the
+report shows the wall clock time until the kernel was reached, and until the
+stub started (firmware start-up and loading the UKI, which scales with its
+size). The latter is the former less the time the stub's phases took.
+
+With --mp the stub copies the kernel with the help of the application
+processors (stubble.mp=true), QEMU gets --smp of them. Only a --kernel-size of
+at least 4M is split up.
+
+Example:
+
+  tools/bench-qemu.py --stub stubble.efi --elf stubble --firmware /usr/share/OVMF/OVMF_CODE.fd \\
+      --firmware-vars /usr/share/OVMF/OVMF_VARS.fd --dtbs 1,16,128 --initrd-sizes 0,64M
+"""
+
+import argparse
+import hashlib
+import importlib.util
+import itertools
+import json
+import os
+import platform
+import re
+import shutil
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import uuid
+from pathlib import Path
+
+KERNEL_MARKER = 'stubble-bench: kernel reached'
+TRACE_START = 'stubble-bench: trace '
+TRACE_END = 'stubble-bench: trace end'
+
+LOADER_GUID = uuid.UUID('4a67b082-0a4c-41cf-b6c7-440b29bb8c4f')
+# Larger than the stub's trace buffer, TRACE_BUFFER_SIZE in trace.c
+TRACE_SIZE_MAX = 0x10000
+
+# Where the kernel keeps its data, from the start of its .data section
+KERNEL_DATA = {
+    'trace_size': 0x0,
+    'guid': 0x10,
+    'name': 0x20,
+    'digits': 0x40,
+    'marker': 0x60,
+    'trace_start': 0x100,
+    'trace_end': 0x140,
+    'trace': 0x1000,
+    'hex': 0x1000 + TRACE_SIZE_MAX,
+}
+KERNEL_DATA_SIZE = KERNEL_DATA['hex'] + 4 * TRACE_SIZE_MAX + 2
+
+# What the fake machine reports in SMBIOS, CHID type 3 is derived from all of these
+SMBIOS = {
+    'Manufacturer': 'Stubble',
+    'Family': 'Bench',
+    'ProductName': 'Bench Machine',
+    'ProductSku': 'BENCH-SKU',
+    'BaseboardManufacturer': 'Stubble',
+    'BaseboardProduct': 'Bench Board',
+}
+
+CHID_NAMESPACE = uuid.UUID('70ffd812-4c7f-4c7d-0000-000000000000')
+
+ARCHES = {
+    'x86_64': {
+        'machine_type': 0x8664,
+        'efi_boot': 'BOOTX64.EFI',
+        'qemu': 'qemu-system-x86_64',
+        'qemu_machine': ['-machine', 'q35'],
+        'compatible': None,
+    },
+    'aarch64': {
+        'machine_type': 0xaa64,
+        'efi_boot': 'BOOTAA64.EFI',
+        'qemu': 'qemu-system-aarch64',
+        'qemu_machine': ['-machine', 'virt'],
+        'compatible': 'linux,dummy-virt',
+    },
+}
+
+
+def parse_size(s):
+    m = re.fullmatch(r'(\d+)([KMG]?)', s.strip(), re.IGNORECASE)
+    if not m:
+        raise argparse.ArgumentTypeError(f'invalid size: {s}')
+    return int(m.group(1)) * {'': 1, 'K': 1 << 10, 'M': 1 << 20, 'G': 1 << 30}[m.group(2).upper()]
+
+
+def parse_list(parse):
+    return lambda s: [parse(x) for x in s.split(',')]
+
+
+def chid(fields):
+    """CHID as calculated by fwupd and chid.c: a v5 UUID of the UTF-16LE fields joined by '&'."""
+    name = '&'.join(fields).encode('utf-16-le')
+    h = bytearray(hashlib.sha1(CHID_NAMESPACE.bytes + name).digest()[:16])
+    h[6] = (h[6] & 0x0f) | 0x50
+    h[8] = (h[8] & 0x3f) | 0x80
+    return uuid.UUID(bytes=bytes(h))
+
+
+def fdt(compatibles, model, size):
+    """A minimal flattened DT with the given root compatibles, padded to about 'size' bytes."""
+    strings = b'compatible\0model\0bench,padding\0'
+
+    def prop(name_offset, value):
+        return struct.pack('>III', 3, len(value), name_offset) + value + b'\0' * (-len(value) % 4)
+
+    structure = struct.pack('>I', 1) + b'\0' * 4
+    structure += prop(0, b''.join(c.encode() + b'\0' for c in compatibles))
+    structure += prop(11, model.encode() + b'\0')
+    padding = max(0, size - 40 - 16 - len(structure) - len(strings) - 32)
+    structure += struct.pack('>I', 1) + b'bench\0\0\0' + prop(17, os.urandom(padding)) + struct.pack('>I', 2)
+    structure += struct.pack('>II', 2, 9)
+
+    off_rsvmap = 40
+    off_struct = off_rsvmap + 16
+    off_strings = off_struct + len(structure)
+    total = off_strings + len(strings)
+    header = struct.pack('>10I', 0xd00dfeed, total, off_struct, off_strings, off_rsvmap, 17, 16, 0,
+                         len(strings), len(structure))
+    return header + b'\0' * 16 + structure + strings
+
+
+def kernel_code(arch):
+    """Prints KERNEL_MARKER on ConOut, then the StubbleTrace variable in hex between TRACE_START and TRACE_END,
+    and calls ResetSystem(EfiResetShutdown), never returns. Everything it uses is at KERNEL_DATA in .data,
+    which starts 0x1000 after the code."""
+
+    if arch == 'x86_64':
+        return bytes.fromhex(
+            '4883ec38'          # sub rsp, 0x38
+            '4889d3'            # mov rbx, rdx              ; SystemTable
+            '488d35f20f0000'    # lea rsi, [rip + 0xff2]    ; .data
+            '488b4b40'          # mov rcx, [rbx + 0x40]     ; ConOut
+            '488d5660'          # lea rdx, [rsi + 0x60]     ; marker
+            'ff5108'            # call [rcx + 0x08]         ; OutputString
+            '48c70600000100'    # mov qword [rsi], 0x10000  ; trace_size
+            '488d4e20'          # lea rcx, [rsi + 0x20]     ; name
+            '488d5610'          # lea rdx, [rsi + 0x10]     ; guid
+            '4531c0'            # xor r8d, r8d
+            '4989f1'            # mov r9, rsi               ; &trace_size
+            '488d8600100000'    # lea rax, [rsi + 0x1000]   ; trace
+            '4889442420'        # mov [rsp + 0x20], rax
+            '488b4358'          # mov rax, [rbx + 0x58]     ; RuntimeServices
+            'ff5048'            # call [rax + 0x48]         ; GetVariable
+            '4885c0'            # test rax, rax
+            '7407'              # jz 1f
+            '48c70600000000'    # mov qword [rsi], 0
+            '488b0e'            # 1: mov rcx, [rsi]
+            '488dbe00100000'    # lea rdi, [rsi + 0x1000]   ; trace
+            '488d9600100100'    # lea rdx, [rsi + 0x11000]  ; hex
+            '4885c9'            # 2: test rcx, rcx
+            '7429'              # jz 3f
+            '0fb607'            # movzx eax, byte [rdi]
+            'c1e804'            # shr eax, 4
+            '0fb6440640'        # movzx eax, byte [rsi + rax + 0x40]    ; digits
+            '668902'            # mov [rdx], ax
+            '0fb607'            # movzx eax, byte [rdi]
+            '83e00f'            # and eax, 15
+            '0fb6440640'        # movzx eax, byte [rsi + rax + 0x40]
+            '66894202'          # mov [rdx + 2], ax
+            '4883c204'          # add rdx, 4
+            '48ffc7'            # inc rdi
+            '48ffc9'            # dec rcx
+            'ebd2'              # jmp 2b
+            '66c7020000'        # 3: mov word [rdx], 0
+            '488b4b40'          # mov rcx, [rbx + 0x40]
+            '488d9600010000'    # lea rdx, [rsi + 0x100]    ; trace_start
+            'ff5108'            # call [rcx + 0x08]
+            '488b4b40'          # mov rcx, [rbx + 0x40]
+            '488d9600100100'    # lea rdx, [rsi + 0x11000]  ; hex
+            'ff5108'            # call [rcx + 0x08]
+            '488b4b40'          # mov rcx, [rbx + 0x40]
+            '488d9640010000'    # lea rdx, [rsi + 0x140]    ; trace_end
+            'ff5108'            # call [rcx + 0x08]
+            '488b4358'          # mov rax, [rbx + 0x58]     ; RuntimeServices
+            'b902000000'        # mov ecx, 2                ; EfiResetShutdown
+            '31d2'              # xor edx, edx
+            '4531c0'            # xor r8d, r8d
+            '4531c9'            # xor r9d, r9d
+            'ff5068'            # call [rax + 0x68]         ; ResetSystem
+            'ebfe')             # jmp .
+
+    insns = [
+        0xaa0103f3,         # mov x19, x1               ; SystemTable
+        0x10fffff4,         # adr x20, .-4              ; the code
+        0x91400694,         # add x20, x20, #0x1000     ; .data
+        0xf9402260,         # ldr x0, [x19, #64]        ; ConOut
+        0x91018281,         # add x1, x20, #0x60        ; marker
+        0xf9400402,         # ldr x2, [x0, #8]          ; OutputString
+        0xd63f0040,         # blr x2
+        0xd2a00020,         # mov x0, #0x10000
+        0xf9000280,         # str x0, [x20]             ; trace_size
+        0x91008280,         # add x0, x20, #0x20        ; name
+        0x91004281,         # add x1, x20, #0x10        ; guid
+        0xd2800002,         # mov x2, #0
+        0xaa1403e3,         # mov x3, x20               ; &trace_size
+        0x91400684,         # add x4, x20, #0x1000      ; trace
+        0xf9402e65,         # ldr x5, [x19, #88]        ; RuntimeServices
+        0xf94024a5,         # ldr x5, [x5, #72]         ; GetVariable
+        0xd63f00a0,         # blr x5
+        0xb4000040,         # cbz x0, 1f
+        0xf900029f,         # str xzr, [x20]
+        0xf9400286,         # 1: ldr x6, [x20]
+        0x91400687,         # add x7, x20, #0x1000      ; trace
+        0x91404688,         # add x8, x20, #0x11000     ; hex
+        0x91010289,         # add x9, x20, #0x40        ; digits
+        0xb4000146,         # 2: cbz x6, 3f
+        0x384014ea,         # ldrb w10, [x7], #1
+        0x53047d4b,         # lsr w11, w10, #4
+        0x386b492b,         # ldrb w11, [x9, w11, uxtw]
+        0x7800250b,         # strh w11, [x8], #2
+        0x12000d4a,         # and w10, w10, #15
+        0x386a492a,         # ldrb w10, [x9, w10, uxtw]
+        0x7800250a,         # strh w10, [x8], #2
+        0xd10004c6,         # sub x6, x6, #1
+        0x17fffff7,         # b 2b
+        0x7900011f,         # 3: strh wzr, [x8]
+        0xf9402260,         # ldr x0, [x19, #64]
+        0x91040281,         # add x1, x20, #0x100       ; trace_start
+        0xf9400402,         # ldr x2, [x0, #8]
+        0xd63f0040,         # blr x2
+        0xf9402260,         # ldr x0, [x19, #64]
+        0x91404681,         # add x1, x20, #0x11000     ; hex
+        0xf9400402,         # ldr x2, [x0, #8]
+        0xd63f0040,         # blr x2
+        0xf9402260,         # ldr x0, [x19, #64]
+        0x91050281,         # add x1, x20, #0x140       ; trace_end
+        0xf9400402,         # ldr x2, [x0, #8]
+        0xd63f0040,         # blr x2
+        0xf9402e63,         # ldr x3, [x19, #88]        ; RuntimeServices
+        0xf9403464,         # ldr x4, [x3, #104]        ; ResetSystem
+        0xd2800040,         # mov x0, #2                ; EfiResetShutdown
+        0xd2800001,         # mov x1, #0
+        0xd2800002,         # mov x2, #0
+        0xd2800003,         # mov x3, #0
+        0xd63f0080,         # blr x4
+        0x14000000,         # b .
+    ]
+    return struct.pack(f'<{len(insns)}I', *insns)
+
+
+def kernel_data(size):
+    """The .data section of the kernel, KERNEL_DATA filled in and padded with random data to 'size' bytes."""
+    def utf16(s):
+        return s.encode('utf-16-le') + b'\0\0'
+
+    data = bytearray(os.urandom(max(size, KERNEL_DATA_SIZE)))
+    for name, value in (('guid', LOADER_GUID.bytes_le),
+                        ('name', utf16('StubbleTrace')),
+                        ('digits', b'0123456789abcdef'),
+                        ('marker', utf16(KERNEL_MARKER + '\r\n')),
+                        ('trace_start', utf16(TRACE_START)),
+                        ('trace_end', utf16('\r\n' + TRACE_END + '\r\n'))):
+        data[KERNEL_DATA[name]:KERNEL_DATA[name] + len(value)] = value
+    return bytes(data)
+
+
+def kernel_image(arch, size):
+    """An EFI application passing the checks the stub makes on the inner kernel, padded to 'size' bytes."""
+    file_align = section_align = 0x1000
+    code = kernel_code(arch)
+    filler = kernel_data(size - 2 * section_align)
+
+    sections = [('.text', code, 0x60000020), ('.data', filler, 0xc0000040)]
+    headers_size = section_align
+    opt_size = 240
+
+    table = b''
+    body = b''
+    va = raw = headers_size
+    for name, data, flags in sections:
+        raw_size = -(-len(data) // file_align) * file_align
+        table += name.encode().ljust(8, b'\0') + struct.pack('<IIIIIIHHI', len(data), va, raw_size, raw,
+                                                             0, 0, 0, 0, flags)
+        body += data + b'\0' * (raw_size - len(data))
+        va += -(-max(len(data), 1) // section_align) * section_align
+        raw += raw_size
+
+    dos = b'MZ' + b'\0' * 58 + struct.pack('<I', 0x40)
+    coff = b'PE\0\0' + struct.pack('<HHIIIHH', ARCHES[arch]['machine_type'], len(sections), 0, 0, 0, opt_size,
+                                   0x0206)
+    opt = struct.pack('<HBBIIIII', 0x20b, 0, 0, len(code), len(filler), 0, headers_size, headers_size)
+    opt += struct.pack('<QIIHHHHHHIIIIHHQQQQII',
+                       0,                       # ImageBase
+                       section_align, file_align,
+                       0, 0,                    # OperatingSystemVersion
+                       1, 0,                    # ImageVersion, the stub wants >= 1 for initrd support
+                       0, 0,                    # SubsystemVersion
+                       0,                       # Win32VersionValue
+                       va,                      # SizeOfImage
+                       headers_size,
+                       0,                       # CheckSum
+                       10,                      # EFI application
+                       0,
+                       0x10000, 0x10000, 0, 0,  # Stack and heap
+                       0,                       # LoaderFlags
+                       16)
+    opt += b'\0' * (16 * 8)
+    assert len(opt) == opt_size
+
+    headers = dos + coff + opt + table
+    return headers + b'\0' * (headers_size - len(headers)) + body
+
+
+def build_uki(args, workdir, n_dtbs, initrd_size):
+    arch = ARCHES[args.arch]
+    smbios_chid = chid([SMBIOS[k] for k in ('Manufacturer', 'Family', 'ProductName', 'ProductSku',
+                                            'BaseboardManufacturer', 'BaseboardProduct')])
+
+    hwids_dir = os.path.join(workdir, 'hwids')
+    os.makedirs(hwids_dir)
+    dtbs = []
+    for i in range(n_dtbs):
+        last = i == n_dtbs - 1
+        compatibles = [f'bench,machine-{i}']
+        if last and arch['compatible']:
+            compatibles.append(arch['compatible'])
+
+        path = os.path.join(workdir, f'bench-{i}.dtb')
+        with open(path, 'wb') as f:
+            f.write(fdt(compatibles, f'Bench machine {i}', args.dtb_size))
+        dtbs.append(path)
+
+        hwids = [str(uuid.uuid4()) for _ in range(args.hwids_per_dtb - 1)]
+        hwids.append(str(smbios_chid) if last else str(uuid.uuid4()))
+        with open(os.path.join(hwids_dir, f'bench-{i}.json'), 'w') as f:
+            json.dump({'type': 'devicetree', 'name': f'Bench machine {i}', 'compatible': compatibles[0],
+                       'hwids': hwids}, f)
+
+    kernel = os.path.join(workdir, 'kernel.efi')
+    with open(kernel, 'wb') as f:
+        f.write(kernel_image(args.arch, args.kernel_size))
+
+    initrd = os.path.join(workdir, 'initrd')
+    with open(initrd, 'wb') as f:
+        f.write(os.urandom(initrd_size))
+
+    uki = os.path.join(workdir, 'esp', 'EFI', 'BOOT', arch['efi_boot'])
+    os.makedirs(os.path.dirname(uki))
+    cmd = [args.ukify, 'build',
+           f'--linux={kernel}',
+           f'--stub={args.stub}',
+           f'--hwids={hwids_dir}',
+           '--uname=0.0-bench',
+           f'--cmdline=stubble.trace {"stubble.mp=true " if args.mp else ""}{args.cmdline}'.strip(),
+           f'--output={uki}']
+    if initrd_size > 0:
+        cmd += [f'--initrd={initrd}']
+    cmd += [f'--dtbauto={d}' for d in dtbs]
+    subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL)
+
+    return os.path.join(workdir, 'esp')
+
+
+def qemu_command(args, workdir, esp):
+    arch = ARCHES[args.arch]
+    cmd = [args.qemu or arch['qemu'], *arch['qemu_machine'],
+           '-cpu', 'max', '-m', args.memory, '-smp', str(args.smp),
+           '-nographic', '-no-reboot',
+           '-drive', f'format=raw,file=fat:rw:{esp}',
+           '-smbios', 'type=1,manufacturer={Manufacturer},product={ProductName},family={Family},sku={ProductSku}'
+                      .format(**SMBIOS),
+           '-smbios', 'type=2,manufacturer={BaseboardManufacturer},product={BaseboardProduct}'.format(**SMBIOS)]
+
+    if args.arch == platform.machine() and os.access('/dev/kvm', os.R_OK | os.W_OK):
+        cmd += ['-accel', 'kvm']
+    else:
+        cmd += ['-accel', 'tcg']
+
+    if args.firmware_vars:
+        vars_copy = os.path.join(workdir, 'vars.fd')
+        shutil.copyfile(args.firmware_vars, vars_copy)
+        cmd += ['-drive', f'if=pflash,format=raw,unit=0,readonly=on,file={args.firmware}',
+                '-drive', f'if=pflash,format=raw,unit=1,file={vars_copy}']
+    else:
+        cmd += ['-bios', args.firmware]
+
+    return cmd
+
+
+PHASE_RE = re.compile(r'phase (\S+): (\d+) us')
+ESCAPE_RE = re.compile(r'\x1b\[[0-9;?]*[A-Za-z]')
+
+
+def load_trace_decoder():
+    spec = importlib.util.spec_from_file_location(
+        'stubble_trace', os.path.join(os.path.dirname(os.path.abspath(__file__)), 'stubble-trace.py'))
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module
+
+
+def trace_phases(decoder, image, trace):
+    """The phases recorded in the trace, in microseconds."""
+    magic, header_size, n_records, _, _, image_base = decoder.HEADER.unpack_from(trace)
+    if magic != decoder.TRACE_MAGIC:
+        raise ValueError('not a stubble trace')
+
+    phases = {}
+    off = header_size
+    for _ in range(n_records):
+        fmt_off, n_args, _, status = decoder.RECORD.unpack_from(trace, off)
+        args = struct.unpack_from(f'<{n_args}Q', trace, off + decoder.RECORD.size)
+        off += decoder.RECORD.size + n_args * 8
+
+        fmt = image.read(fmt_off)
+        m = PHASE_RE.search(decoder.format_record(image, image_base, fmt, status, args)) if fmt else None
+        if m:
+            phases[m.group(1)] = int(m.group(2))
+    return phases
+
+
+def boot(args, workdir, esp):
+    """Boots once, returns a dict of timings in microseconds, or None on timeout."""
+    timings = {}
+    start = time.monotonic()
+    proc = subprocess.Popen(qemu_command(args, workdir, esp), stdin=subprocess.DEVNULL,
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    log = []
+    dump = None
+
+    try:
+        deadline = start + args.timeout
+        for raw in proc.stdout:
+            now = time.monotonic()
+            line = raw.decode(errors='replace')
+            log.append(line)
+
+            if KERNEL_MARKER in line:
+                timings['kernel_reached'] = (now - start) * 1e6
+            if dump is None and TRACE_START in line:
+                dump = ''
+                line = line[line.index(TRACE_START) + len(TRACE_START):]
+            if dump is not None:
+                # The console may wrap the dump and add escape sequences, only the digits count
+                end = line.find(TRACE_END)
+                dump += re.sub(r'[^0-9a-f]', '', ESCAPE_RE.sub('', line if end < 0 else line[:end]))
+                if end >= 0:
+                    break
+            if now > deadline:
+                break
+    finally:
+        proc.kill()
+        proc.wait()
+
+    if 'kernel_reached' not in timings or not dump:
+        sys.stderr.write(''.join(log[-20:]))
+        if 'kernel_reached' in timings:
+            sys.stderr.write('The kernel found no trace.\n')
+        return None
+
+    phases = trace_phases(args.decoder, args.image, bytes.fromhex(dump))
+    timings.update(phases)
+    timings['stub_start'] = timings['kernel_reached'] - sum(phases.values())
+    return timings
+
+
+COLUMNS = ['stub_start', 'sections', 'measure', 'devicetree', 'kernel_copy', 'initrd', 'kernel_reached']
+
+
+def format_size(n):
+    for unit in ('', 'K', 'M'):
+        if n < 1024 or n % 1024:
+            return f'{n}{unit}'
+        n //= 1024
+    return f'{n}G'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--stub', default='stubble.efi', help='stubble.efi to benchmark')
+    parser.add_argument('--elf', default='stubble', help='the stubble ELF stubble.efi was built from')
+    parser.add_argument('--arch', default=platform.machine(), choices=ARCHES.keys())
+    parser.add_argument('--firmware', required=True, help='OVMF/AAVMF firmware (code) image')
+    parser.add_argument('--firmware-vars', help='Variable store template, if the firmware is split')
+    parser.add_argument('--qemu', help='QEMU binary (default: qemu-system-ARCH)')
+    parser.add_argument('--ukify', default='ukify')
+    parser.add_argument('--memory', default='2G')
+    parser.add_argument('--smp', type=int, default=4, help='Number of CPUs of the machine (default: 4)')
+    parser.add_argument('--mp', action='store_true',
+                        help='Copy the kernel on several CPUs, with stubble.mp=true')
+    parser.add_argument('--dtbs', type=parse_list(int), default=[1, 16, 128],
+                        help='Numbers of .dtbauto sections to sweep (default: 1,16,128)')
+    parser.add_argument('--initrd-sizes', type=parse_list(parse_size), default=[0, 64 << 20],
+                        help='Initrd sizes to sweep (default: 0,64M)')
+    parser.add_argument('--kernel-size', type=parse_size, default=16 << 20)
+    parser.add_argument('--dtb-size', type=parse_size, default=64 << 10)
+    parser.add_argument('--hwids-per-dtb', type=int, default=4)
+    parser.add_argument('--cmdline', default='', help='Additional kernel command line')
+    parser.add_argument('--runs', type=int, default=3, help='Boots per configuration, the median is shown')
+    parser.add_argument('--timeout', type=float, default=120)
+    parser.add_argument('--json', help='Also write all samples to this file')
+    args = parser.parse_args()
+
+    if args.hwids_per_dtb < 1:
+        parser.error('--hwids-per-dtb must be at least 1')
+    if args.smp < 1:
+        parser.error('--smp must be at least 1')
+
+    args.decoder = load_trace_decoder()
+    try:
+        args.image = args.decoder.Image(Path(args.elf))
+    except (ValueError, OSError) as e:
+        parser.error(f'--elf: {e}')
+
+    results = []
+    print(f'{"dtbs":>5} {"initrd":>7} ' + ' '.join(f'{c:>14}' for c in COLUMNS) + '   (us, median)')
+
+    for n_dtbs, initrd_size in itertools.product(args.dtbs, args.initrd_sizes):
+        with tempfile.TemporaryDirectory(prefix='stubble-bench-') as workdir:
+            esp = build_uki(args, workdir, n_dtbs, initrd_size)
+
+            samples = []
+            for _ in range(args.runs):
+                t = boot(args, workdir, esp)
+                if t is None:
+                    sys.exit(f'Boot with {n_dtbs} DTBs and a {format_size(initrd_size)} initrd did not reach '
+                             'the kernel.')
+                samples.append(t)
+
+        medians = {c: statistics.median(s.get(c, 0) for s in samples) for c in COLUMNS}
+        results.append({'dtbs': n_dtbs, 'initrd_size': initrd_size, 'samples': samples})
+        print(f'{n_dtbs:>5} {format_size(initrd_size):>7} ' +
+              ' '.join(f'{medians[c]:>14.0f}' for c in COLUMNS), flush=True)
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump({'arch': args.arch, 'kernel_size': args.kernel_size, 'dtb_size': args.dtb_size,
+                       'hwids_per_dtb': args.hwids_per_dtb, 'results': results}, f, indent=2)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,229 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* Times hashing a batch of CHID sized messages with the stub's sha1.c, built with the same flags as for the
+ * stub: one message after another through sha1_process_bytes() and sha1_finish_ctx() as chid.c used to, and
+ * all at once through sha1_batch(), both with the number of lanes the stub uses on this architecture and with
+ * two lanes forced, so that the interleaved code is checked on any host. If built against OpenSSL, which uses the SHA instructions of the CPU
+ * where it has them, that is timed as well. The digests of all variants are compared first. */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sha1.h"
+
+#if HAVE_OPENSSL
+#include <openssl/evp.h>
+#endif
+
+#define N_MESSAGES_MAX 64U
+/* A CHID message is a 16 byte namespace followed by a few UTF-16 strings */
+#define MESSAGE_SIZE_MIN 40U
+#define MESSAGE_SIZE_MAX 160U
+
+typedef struct Batch {
+        size_t n;
+        size_t sizes[N_MESSAGES_MAX];
+        uint8_t *messages[N_MESSAGES_MAX];
+        uint8_t digests[N_MESSAGES_MAX][SHA1_DIGEST_SIZE];
+} Batch;
+
+typedef void (*HashFunc)(Batch *b);
+
+/* sha1_batch() of sha1.c built with SHA1_LANES=2, see tools/Makefile */
+void sha1_batch_lanes2(
+                const uint8_t *const messages[],
+                const size_t n_blocks[],
+                size_t n,
+                uint8_t results[][SHA1_DIGEST_SIZE]);
+
+static void hash_sequential(Batch *b) {
+        for (size_t i = 0; i < b->n; i++) {
+                struct sha1_ctx ctx;
+
+                sha1_init_ctx(&ctx);
+                sha1_process_bytes(b->messages[i], b->sizes[i], &ctx);
+                sha1_finish_ctx(&ctx, b->digests[i]);
+        }
+}
+
+static void hash_batch(Batch *b) {
+        size_t n_blocks[N_MESSAGES_MAX];
+
+        /* Padding is part of the work chid_calculate() does, so time it too. The message buffers have room. */
+        for (size_t i = 0; i < b->n; i++)
+                n_blocks[i] = sha1_pad(b->messages[i], b->sizes[i]);
+
+        sha1_batch((const uint8_t *const *) b->messages, n_blocks, b->n, b->digests);
+}
+
+static void hash_batch_lanes2(Batch *b) {
+        size_t n_blocks[N_MESSAGES_MAX];
+
+        for (size_t i = 0; i < b->n; i++)
+                n_blocks[i] = sha1_pad(b->messages[i], b->sizes[i]);
+
+        sha1_batch_lanes2((const uint8_t *const *) b->messages, n_blocks, b->n, b->digests);
+}
+
+#if HAVE_OPENSSL
+static EVP_MD_CTX *evp_ctx;
+static const EVP_MD *evp_sha1;
+
+static void hash_openssl(Batch *b) {
+        for (size_t i = 0; i < b->n; i++) {
+                unsigned size;
+
+                if (EVP_DigestInit_ex(evp_ctx, evp_sha1, NULL) != 1 ||
+                    EVP_DigestUpdate(evp_ctx, b->messages[i], b->sizes[i]) != 1 ||
+                    EVP_DigestFinal_ex(evp_ctx, b->digests[i], &size) != 1) {
+                        fprintf(stderr, "OpenSSL SHA1 failed\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+}
+#endif
+
+static uint64_t now_ns(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+/* Best of 'rounds' rounds of 'iterations' batches, in nanoseconds per batch */
+static double time_hash(HashFunc f, Batch *b, unsigned rounds, unsigned iterations) {
+        double best = 0;
+
+        for (unsigned r = 0; r < rounds; r++) {
+                uint64_t start = now_ns();
+                for (unsigned i = 0; i < iterations; i++) {
+                        f(b);
+                        __asm__ volatile("" ::: "memory");
+                }
+                double t = (double) (now_ns() - start) / iterations;
+                if (r == 0 || t < best)
+                        best = t;
+        }
+
+        return best;
+}
+
+static void help(void) {
+        printf("Usage: bench-sha1 [OPTIONS]\n\n"
+               "  -n --messages=N     Messages per batch (default 15, the CHIDs chid_match() uses)\n"
+               "  -i --iterations=N   Batches per round (default 20000)\n"
+               "  -r --rounds=N       Rounds, the best one counts (default 10)\n"
+               "  -s --seed=N         Seed for the message sizes and contents\n");
+}
+
+int main(int argc, char *argv[]) {
+        static const struct option options[] = {
+                { "messages",   required_argument, NULL, 'n' },
+                { "iterations", required_argument, NULL, 'i' },
+                { "rounds",     required_argument, NULL, 'r' },
+                { "seed",       required_argument, NULL, 's' },
+                { "help",       no_argument,       NULL, 'h' },
+                {}
+        };
+        unsigned n = 15, iterations = 20000, rounds = 10, seed = 1;
+        int c;
+
+        while ((c = getopt_long(argc, argv, "n:i:r:s:h", options, NULL)) >= 0)
+                switch (c) {
+                case 'n':
+                        n = (unsigned) strtoul(optarg, NULL, 0);
+                        break;
+                case 'i':
+                        iterations = (unsigned) strtoul(optarg, NULL, 0);
+                        break;
+                case 'r':
+                        rounds = (unsigned) strtoul(optarg, NULL, 0);
+                        break;
+                case 's':
+                        seed = (unsigned) strtoul(optarg, NULL, 0);
+                        break;
+                case 'h':
+                        help();
+                        return EXIT_SUCCESS;
+                default:
+                        return EXIT_FAILURE;
+                }
+
+        if (n == 0 || n > N_MESSAGES_MAX || iterations == 0 || rounds == 0) {
+                fprintf(stderr, "Invalid arguments, the number of messages must be 1…%u.\n", N_MESSAGES_MAX);
+                return EXIT_FAILURE;
+        }
+
+        Batch batch = { .n = n };
+        size_t total = 0;
+        srand(seed);
+        for (size_t i = 0; i < n; i++) {
+                batch.sizes[i] = MESSAGE_SIZE_MIN + (size_t) rand() % (MESSAGE_SIZE_MAX - MESSAGE_SIZE_MIN + 1);
+                batch.messages[i] = malloc(SHA1_PADDED_SIZE(batch.sizes[i]));
+                if (!batch.messages[i]) {
+                        fprintf(stderr, "Out of memory.\n");
+                        return EXIT_FAILURE;
+                }
+                for (size_t j = 0; j < batch.sizes[i]; j++)
+                        batch.messages[i][j] = (uint8_t) rand();
+                total += batch.sizes[i];
+        }
+
+        struct {
+                const char *name;
+                HashFunc func;
+        } variants[] = {
+                { "sequential", hash_sequential   },
+                { "batch",      hash_batch        },
+                { "batch-2lane", hash_batch_lanes2 },
+#if HAVE_OPENSSL
+                { "openssl",    hash_openssl      },
+#endif
+        };
+        size_t n_variants = sizeof(variants) / sizeof(variants[0]);
+
+#if HAVE_OPENSSL
+        evp_ctx = EVP_MD_CTX_new();
+        evp_sha1 = EVP_sha1();
+        if (!evp_ctx || !evp_sha1) {
+                fprintf(stderr, "Failed to set up OpenSSL SHA1.\n");
+                return EXIT_FAILURE;
+        }
+#endif
+
+        uint8_t reference[N_MESSAGES_MAX][SHA1_DIGEST_SIZE];
+        hash_sequential(&batch);
+        memcpy(reference, batch.digests, sizeof(reference));
+
+        for (size_t v = 1; v < n_variants; v++) {
+                memset(batch.digests, 0, sizeof(batch.digests));
+                variants[v].func(&batch);
+                if (memcmp(reference, batch.digests, n * SHA1_DIGEST_SIZE) != 0) {
+                        fprintf(stderr, "%s: digests differ from sequential hashing.\n", variants[v].name);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        printf("%u messages, %zu bytes per batch\n", n, total);
+
+        double base = 0;
+        for (size_t v = 0; v < n_variants; v++) {
+                double t = time_hash(variants[v].func, &batch, rounds, iterations);
+                if (v == 0)
+                        base = t;
+
+                printf("%-12s %9.0f ns/batch %7.1f ns/message %6.2fx\n",
+                       variants[v].name, t, t / n, base / t);
+        }
+
+#if HAVE_OPENSSL
+        EVP_MD_CTX_free(evp_ctx);
+#endif
+        for (size_t i = 0; i < n; i++)
+                free(batch.messages[i]);
+
+        return EXIT_SUCCESS;
+}
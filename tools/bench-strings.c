@@ -0,0 +1,396 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* Checks the word at a time string functions of efi-string.c against plain one code unit at a time versions
+ * of them on lots of random input, at all alignments, and then times both on the kind of strings the stub
+ * handles: SMBIOS fields, command lines and log messages. Exits with 1 if they disagree on anything. */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <uchar.h>
+
+#include "bench-efi.h"
+
+/* From include/efi-string.h, which can't be included here as it is meant for freestanding builds only */
+size_t strnlen8(const char *s, size_t n);
+size_t strnlen16(const char16_t *s, size_t n);
+int strncmp16(const char16_t *s1, const char16_t *s2, size_t n);
+int strncasecmp16(const char16_t *s1, const char16_t *s2, size_t n);
+char16_t *strchr16(const char16_t *s, char16_t c);
+char16_t *xstrn8_to_16(const char *str8, size_t n);
+
+#define CMP(a, b) ((a) < (b) ? -1 : (a) > (b) ? 1 : 0)
+#define TOLOWER(c) ((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+
+/* The reference versions, as efi-string.c had them before it learned to go a word at a time */
+
+static size_t ref_strnlen8(const char *s, size_t n) {
+        size_t len = 0;
+
+        if (!s)
+                return 0;
+        while (len < n && s[len])
+                len++;
+        return len;
+}
+
+static size_t ref_strnlen16(const char16_t *s, size_t n) {
+        size_t len = 0;
+
+        if (!s)
+                return 0;
+        while (len < n && s[len])
+                len++;
+        return len;
+}
+
+static int ref_strncasecmp16_internal(const char16_t *s1, const char16_t *s2, size_t n, bool tolower) {
+        if (!s1 || !s2)
+                return CMP(s1, s2);
+
+        for (; n > 0; s1++, s2++, n--) {
+                char16_t c1 = *s1, c2 = *s2;
+                if (tolower) {
+                        c1 = TOLOWER(c1);
+                        c2 = TOLOWER(c2);
+                }
+                if (!c1 || c1 != c2)
+                        return CMP(c1, c2);
+        }
+
+        return 0;
+}
+
+static int ref_strncmp16(const char16_t *s1, const char16_t *s2, size_t n) {
+        return ref_strncasecmp16_internal(s1, s2, n, false);
+}
+
+static int ref_strncasecmp16(const char16_t *s1, const char16_t *s2, size_t n) {
+        return ref_strncasecmp16_internal(s1, s2, n, true);
+}
+
+static char16_t *ref_strchr16(const char16_t *s, char16_t c) {
+        if (!s)
+                return NULL;
+
+        for (; *s; s++)
+                if (*s == c)
+                        return (char16_t *) s;
+
+        return c ? NULL : (char16_t *) s;
+}
+
+static unsigned ref_utf8_to_unichar(const char *utf8, size_t n, char32_t *c) {
+        char32_t unichar;
+        unsigned len;
+
+        if (!(utf8[0] & 0x80)) {
+                *c = utf8[0];
+                return 1;
+        } else if ((utf8[0] & 0xe0) == 0xc0) {
+                len = 2;
+                unichar = utf8[0] & 0x1f;
+        } else if ((utf8[0] & 0xf0) == 0xe0) {
+                len = 3;
+                unichar = utf8[0] & 0x0f;
+        } else if ((utf8[0] & 0xf8) == 0xf0) {
+                len = 4;
+                unichar = utf8[0] & 0x07;
+        } else if ((utf8[0] & 0xfc) == 0xf8) {
+                len = 5;
+                unichar = utf8[0] & 0x03;
+        } else if ((utf8[0] & 0xfe) == 0xfc) {
+                len = 6;
+                unichar = utf8[0] & 0x01;
+        } else {
+                *c = UINT32_MAX;
+                return 1;
+        }
+
+        if (len > n) {
+                *c = UINT32_MAX;
+                return len;
+        }
+
+        for (unsigned i = 1; i < len; i++) {
+                if ((utf8[i] & 0xc0) != 0x80) {
+                        *c = UINT32_MAX;
+                        return len;
+                }
+                unichar <<= 6;
+                unichar |= utf8[i] & 0x3f;
+        }
+
+        *c = unichar;
+        return len;
+}
+
+static char16_t *ref_xstrn8_to_16(const char *str8, size_t n) {
+        if (n == SIZE_MAX)
+                n = ref_strnlen8(str8, SIZE_MAX);
+
+        size_t i = 0;
+        char16_t *str16 = malloc((n + 1) * sizeof(char16_t));
+        if (!str16)
+                abort();
+
+        while (n > 0 && *str8 != '\0') {
+                char32_t unichar;
+
+                size_t utf8len = ref_utf8_to_unichar(str8, n, &unichar);
+                str8 += utf8len;
+                n = n > utf8len ? n - utf8len : 0;
+
+                if (unichar <= 0xd7ffU || (unichar >= 0xe000U && unichar <= 0xffffU))
+                        str16[i++] = unichar;
+        }
+
+        str16[i] = u'\0';
+        return str16;
+}
+
+/* Differential checks */
+
+#define UNITS_MAX 512U
+
+static unsigned n_checks, n_failures;
+
+static void check(bool ok, const char *what, unsigned seed) {
+        n_checks++;
+        if (ok)
+                return;
+
+        if (n_failures++ < 20)
+                fprintf(stderr, "%s differs, iteration %u\n", what, seed);
+}
+
+static char16_t random_unit(unsigned alphabet) {
+        switch (alphabet) {
+        case 0: /* Only a few distinct letters, so that strings share prefixes and characters are found */
+                return u"abcAB"[rand() % 5];
+        case 1: /* Printable ASCII */
+                return (char16_t) (' ' + rand() % 95);
+        default: /* Anything, including units that look like sign bits or the terminator to SWAR tricks */
+                return (char16_t) (rand() % 3 == 0 ? 0x8000 | rand() : 1 + rand() % 0xfffe);
+        }
+}
+
+/* Fills a buffer at some arbitrary, possibly odd, byte offset with a random string, returns its start */
+static char16_t *random_string16(uint8_t *buf, size_t buf_size, size_t *ret_len) {
+        size_t offset = (size_t) rand() % 16;
+        size_t max_len = (buf_size - offset) / sizeof(char16_t) - 1;
+        size_t len = (size_t) rand() % (rand() % 4 == 0 ? max_len : 40);
+        unsigned alphabet = (unsigned) rand() % 3;
+
+        char16_t units[UNITS_MAX];
+        for (size_t i = 0; i < len; i++)
+                units[i] = random_unit(alphabet);
+        units[len] = 0;
+
+        memcpy(buf + offset, units, (len + 1) * sizeof(char16_t));
+        *ret_len = len;
+        return (char16_t *) (buf + offset);
+}
+
+static size_t random_n(size_t len) {
+        switch (rand() % 4) {
+        case 0:
+                return SIZE_MAX;
+        case 1:
+                return len;
+        default:
+                return (size_t) rand() % (len + 10);
+        }
+}
+
+static char random_utf8_byte(void) {
+        static const uint8_t bytes[] = { 0xc3, 0xa4, 0xe2, 0x82, 0xac, 0xf0, 0x9f, 0x98, 0x80, 0xed, 0xa0, 0xfe, 0x80 };
+
+        if (rand() % 4 != 0)
+                return (char) (' ' + rand() % 95);
+        return (char) bytes[rand() % sizeof(bytes)];
+}
+
+static void check_strings(unsigned iterations) {
+        static uint8_t buf1[UNITS_MAX * 2 + 16], buf2[UNITS_MAX * 2 + 16];
+
+        for (unsigned it = 0; it < iterations; it++) {
+                size_t len1, len2;
+                char16_t *s1 = random_string16(buf1, sizeof(buf1), &len1);
+                size_t n = random_n(len1);
+
+                check(strnlen16(s1, n) == ref_strnlen16(s1, n), "strnlen16", it);
+
+                /* The other string is either unrelated or a copy with a change somewhere */
+                char16_t *s2;
+                if (rand() % 4 == 0)
+                        s2 = random_string16(buf2, sizeof(buf2), &len2);
+                else {
+                        size_t offset = (size_t) rand() % 16;
+                        s2 = (char16_t *) (buf2 + offset);
+                        memmove(s2, s1, (len1 + 1) * sizeof(char16_t));
+                        if (len1 > 0 && rand() % 2 == 0)
+                                s2[rand() % len1] = rand() % 8 == 0 ? 0 : random_unit((unsigned) rand() % 3);
+                }
+                check(strncmp16(s1, s2, n) == ref_strncmp16(s1, s2, n), "strncmp16", it);
+                check(strncasecmp16(s1, s2, n) == ref_strncasecmp16(s1, s2, n), "strncasecmp16", it);
+
+                char16_t c = rand() % 8 == 0 ? 0 : len1 > 0 && rand() % 2 == 0 ? s1[rand() % len1] : random_unit(2);
+                check(strchr16(s1, c) == ref_strchr16(s1, c), "strchr16", it);
+
+                /* UTF-8, mostly ASCII with some valid and invalid multi-byte sequences mixed in */
+                char *s8 = (char *) buf1 + rand() % 16;
+                size_t len8 = (size_t) rand() % 200;
+                for (size_t i = 0; i < len8; i++)
+                        s8[i] = rand() % 64 == 0 ? '\0' : random_utf8_byte();
+                s8[len8] = '\0';
+
+                n = random_n(len8);
+                check(strnlen8(s8, n) == ref_strnlen8(s8, n), "strnlen8", it);
+
+                char16_t *a = xstrn8_to_16(s8, n), *b = ref_xstrn8_to_16(s8, n);
+                size_t la = ref_strnlen16(a, SIZE_MAX);
+                check(la == ref_strnlen16(b, SIZE_MAX) && memcmp(a, b, la * sizeof(char16_t)) == 0,
+                      "xstrn8_to_16", it);
+                free(a);
+                free(b);
+        }
+
+        check(strnlen16(NULL, 5) == 0 && strchr16(NULL, u'a') == NULL &&
+              strncmp16(NULL, u"a", 1) == ref_strncmp16(NULL, u"a", 1),
+              "NULL handling", 0);
+}
+
+/* Benchmarks */
+
+static uint64_t now_ns(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+static volatile size_t sink;
+
+#define TIME(result, iterations, expr)                                          \
+        do {                                                                    \
+                uint64_t _start = now_ns();                                     \
+                for (unsigned _i = 0; _i < (iterations); _i++) {                \
+                        sink += (size_t) (expr);                                \
+                        __asm__ volatile("" ::: "memory");                      \
+                }                                                               \
+                result = (double) (now_ns() - _start) / (iterations);           \
+        } while (0)
+
+static size_t convert_and_free(char16_t *(*f)(const char *, size_t), const char *s) {
+        char16_t *p = f(s, SIZE_MAX);
+        size_t r = (size_t) p[0];
+        free(p);
+        return r;
+}
+
+static void report(const char *name, double stub, double ref) {
+        printf("%-34s %8.1f ns %8.1f ns %6.2fx\n", name, ref, stub, ref / stub);
+}
+
+static void bench(unsigned iterations) {
+        /* What SMBIOS fields, a command line and a log line look like */
+        static const char smbios8[] = "ThinkPad T14s Gen 6 21N1CTO1WW";
+        static const char cmdline8[] =
+                "root=UUID=6b3bd1b1-0f34-4b5d-9e51-7a2c1ee5a2a4 ro quiet splash console=tty0 "
+                "console=ttyMSM0,115200n8 clk_ignore_unused pd_ignore_unused arm64.nopauth efi=noruntime "
+                "stubble.dtb_override=\\dtb\\x1e78100-lenovo-thinkpad-t14s.dtb systemd.show_status=auto "
+                "rd.luks.uuid=4c5b7e0a-6f8e-4b2a-9d1e-1d2c3b4a5f6e loglevel=3 vt.global_cursor_default=0";
+        double stub, ref;
+
+        char16_t *smbios = ref_xstrn8_to_16(smbios8, SIZE_MAX);
+        char16_t *cmdline = ref_xstrn8_to_16(cmdline8, SIZE_MAX);
+        char16_t *cmdline2 = ref_xstrn8_to_16(cmdline8, SIZE_MAX);
+
+        printf("%-34s %11s %11s %7s\n", "", "scalar", "word", "");
+
+        TIME(ref, iterations, convert_and_free(ref_xstrn8_to_16, smbios8));
+        TIME(stub, iterations, convert_and_free(xstrn8_to_16, smbios8));
+        report("xstrn8_to_16 (SMBIOS field)", stub, ref);
+
+        TIME(ref, iterations, convert_and_free(ref_xstrn8_to_16, cmdline8));
+        TIME(stub, iterations, convert_and_free(xstrn8_to_16, cmdline8));
+        report("xstrn8_to_16 (command line)", stub, ref);
+
+        TIME(ref, iterations, ref_strnlen16(smbios, SIZE_MAX));
+        TIME(stub, iterations, strnlen16(smbios, SIZE_MAX));
+        report("strlen16 (SMBIOS field)", stub, ref);
+
+        TIME(ref, iterations, ref_strnlen16(cmdline, SIZE_MAX));
+        TIME(stub, iterations, strnlen16(cmdline, SIZE_MAX));
+        report("strlen16 (command line)", stub, ref);
+
+        TIME(ref, iterations, ref_strncmp16(cmdline, cmdline2, SIZE_MAX));
+        TIME(stub, iterations, strncmp16(cmdline, cmdline2, SIZE_MAX));
+        report("strcmp16 (equal command lines)", stub, ref);
+
+        TIME(ref, iterations, ref_strchr16(cmdline, u'#'));
+        TIME(stub, iterations, strchr16(cmdline, u'#'));
+        report("strchr16 (not in command line)", stub, ref);
+
+        free(smbios);
+        free(cmdline);
+        free(cmdline2);
+}
+
+static void help(void) {
+        printf("Usage: bench-strings [OPTIONS]\n\n"
+               "  -c --checks=N       Random inputs to check (default 200000)\n"
+               "  -i --iterations=N   Calls per benchmark (default 2000000)\n"
+               "  -s --seed=N         Seed for the random inputs\n");
+}
+
+int main(int argc, char *argv[]) {
+        static const struct option options[] = {
+                { "checks",     required_argument, NULL, 'c' },
+                { "iterations", required_argument, NULL, 'i' },
+                { "seed",       required_argument, NULL, 's' },
+                { "help",       no_argument,       NULL, 'h' },
+                {}
+        };
+        unsigned checks = 200000, iterations = 2000000, seed = 1;
+        int c;
+
+        while ((c = getopt_long(argc, argv, "c:i:s:h", options, NULL)) >= 0)
+                switch (c) {
+                case 'c':
+                        checks = (unsigned) strtoul(optarg, NULL, 0);
+                        break;
+                case 'i':
+                        iterations = (unsigned) strtoul(optarg, NULL, 0);
+                        break;
+                case 's':
+                        seed = (unsigned) strtoul(optarg, NULL, 0);
+                        break;
+                case 'h':
+                        help();
+                        return EXIT_SUCCESS;
+                default:
+                        return EXIT_FAILURE;
+                }
+
+        if (iterations == 0) {
+                fprintf(stderr, "Invalid number of iterations.\n");
+                return EXIT_FAILURE;
+        }
+
+        bench_efi_init(malloc, free);
+
+        srand(seed);
+        check_strings(checks);
+        printf("%u checks, %u failed\n", n_checks, n_failures);
+        if (n_failures > 0)
+                return EXIT_FAILURE;
+
+        bench(iterations);
+        return EXIT_SUCCESS;
+}
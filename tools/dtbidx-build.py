@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: LGPL-2.1-or-later
+
+"""
+Builds the .dtbidx index of the .dtbauto sections of a UKI, which lets the
+stub score the candidates without looking at the DTs, grouped by SoC. See
+include/dtbidx.h.
+
+The DTBs have to be given in the same order as they end up in .dtbauto
+sections, i.e. as passed with --dtbauto to ukify. Alternatively --uki takes
+them from the .dtbauto sections of an existing UKI, e.g. to check an index.
+
+Example:
+
+  tools/dtbidx-build.py --output dtbidx.bin a.dtb b.dtb c.dtb
+  ukify build --linux=/boot/vmlinuz --stub=stubble.efi --hwids=hwids/json \\
+      --dtbauto=a.dtb --dtbauto=b.dtb --dtbauto=c.dtb --section=.dtbidx:@dtbidx.bin --output=vmlinuz.efi
+"""
+
+import argparse
+import struct
+import sys
+from pathlib import Path
+
+DTBIDX_MAGIC = 0x58444944
+
+HEADER = struct.Struct('<IIIIII')
+GROUP = struct.Struct('<III')
+ENTRY = struct.Struct('<III')
+
+FDT_MAGIC = 0xd00dfeed
+FDT_BEGIN_NODE = 1
+FDT_END_NODE = 2
+FDT_PROP = 3
+FDT_NOP = 4
+FDT_END = 9
+
+class DtbError(Exception):
+    pass
+
+def dtb_compatible(dtb: bytes) -> list[str]:
+    if len(dtb) < 40:
+        raise DtbError('too short for a DTB')
+    magic, total, off_struct, off_strings, _, _, _, _, size_strings, size_struct = struct.unpack_from('>10I', dtb)
+    if magic != FDT_MAGIC or total > len(dtb):
+        raise DtbError('not a DTB')
+
+    strings = dtb[off_strings:off_strings + size_strings]
+    pos, end = off_struct, off_struct + size_struct
+    depth = 0
+    while pos + 4 <= end:
+        token, = struct.unpack_from('>I', dtb, pos)
+        pos += 4
+        if token == FDT_BEGIN_NODE:
+            depth += 1
+            if depth > 1:
+                break
+            name_end = dtb.index(b'\0', pos)
+            pos = (name_end + 1 + 3) & ~3
+        elif token == FDT_PROP:
+            length, name_off = struct.unpack_from('>II', dtb, pos)
+            pos += 8
+            name = strings[name_off:strings.index(b'\0', name_off)]
+            if name == b'compatible' and depth == 1:
+                value = dtb[pos:pos + length]
+                compatible = [s.decode() for s in value.split(b'\0') if s]
+                if not compatible:
+                    raise DtbError('the compatible property of the root node is empty')
+                return compatible
+            pos = (pos + length + 3) & ~3
+        elif token == FDT_END_NODE:
+            depth -= 1
+        elif token == FDT_NOP:
+            continue
+        elif token == FDT_END:
+            break
+        else:
+            raise DtbError(f'bad DTB token {token:#x}')
+
+    raise DtbError('the root node has no compatible property')
+
+def uki_dtbauto(uki: bytes) -> list[bytes]:
+    if uki[:2] != b'MZ':
+        raise DtbError('not a PE image')
+    pe, = struct.unpack_from('<I', uki, 0x3c)
+    if uki[pe:pe + 4] != b'PE\0\0':
+        raise DtbError('not a PE image')
+    n_sections, = struct.unpack_from('<H', uki, pe + 6)
+    opt_size, = struct.unpack_from('<H', uki, pe + 20)
+    table = pe + 24 + opt_size
+
+    dtbs = []
+    for i in range(n_sections):
+        name, vsize, _, raw_size, raw_ptr = struct.unpack_from('<8sIIII', uki, table + 40 * i)
+        if name.rstrip(b'\0') == b'.dtbauto':
+            dtbs.append(uki[raw_ptr:raw_ptr + min(vsize, raw_size)])
+    return dtbs
+
+def build_index(compatibles: list[list[str]]) -> bytes:
+    strings = bytearray()
+    offsets: dict[str, int] = {}
+
+    def add_string(s: str) -> int:
+        if s not in offsets:
+            offsets[s] = len(strings)
+            strings.extend(s.encode() + b'\0')
+        return offsets[s]
+
+    # Grouped by SoC, the last compatible entry, in the order the SoCs first show up. Within a group the
+    # entries stay in section order, which the stub relies on for breaking ties.
+    groups: dict[str, list[int]] = {}
+    for i, compat in enumerate(compatibles):
+        groups.setdefault(compat[-1], []).append(i)
+
+    group_table = bytearray()
+    entry_table = bytearray()
+    n_entries = 0
+    for soc, members in groups.items():
+        group_table += GROUP.pack(add_string(soc), n_entries, len(members))
+        for i in members:
+            # A compatible list is one run of strings, it can't share them with others
+            blob = b''.join(s.encode() + b'\0' for s in compatibles[i])
+            entry_table += ENTRY.pack(i, len(strings), len(blob))
+            strings += blob
+        n_entries += len(members)
+
+    strings_offset = HEADER.size + len(group_table) + len(entry_table)
+    header = HEADER.pack(DTBIDX_MAGIC, HEADER.size, len(groups), n_entries, strings_offset, len(strings))
+    return header + group_table + entry_table + strings
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description='Build the .dtbidx index of the .dtbauto sections of a UKI',
+                                     formatter_class=argparse.RawDescriptionHelpFormatter,
+                                     epilog=__doc__)
+    parser.add_argument('--output', type=Path, required=True,
+                        help='where to write the .dtbidx section')
+    parser.add_argument('--uki', action='store_true',
+                        help='take the DTBs from the .dtbauto sections of the given UKI')
+    parser.add_argument('inputs', type=Path, nargs='+',
+                        help='the DTBs in .dtbauto section order, or a single UKI with --uki')
+    args = parser.parse_args()
+
+    if args.uki and len(args.inputs) != 1:
+        parser.error('--uki takes exactly one UKI')
+
+    try:
+        if args.uki:
+            dtbs = [(f'{args.inputs[0]} .dtbauto #{i}', d) for i, d in enumerate(uki_dtbauto(args.inputs[0].read_bytes()))]
+        else:
+            dtbs = [(str(p), p.read_bytes()) for p in args.inputs]
+
+        compatibles = []
+        for name, dtb in dtbs:
+            try:
+                compatibles.append(dtb_compatible(dtb))
+            except (DtbError, struct.error, ValueError) as e:
+                raise DtbError(f'{name}: {e}')
+
+        index = build_index(compatibles)
+        args.output.write_bytes(index)
+    except (OSError, DtbError, struct.error) as e:
+        print(f'error: {e}', file=sys.stderr)
+        return 1
+
+    n_socs = len({c[-1] for c in compatibles})
+    print(f'{len(compatibles)} DTBs for {n_socs} SoCs, {len(index)} bytes', file=sys.stderr)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
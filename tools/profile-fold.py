@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: LGPL-2.1-or-later
+
+"""
+Turns the call tree a PROFILE=1 build of the stub writes to
+\\stubble-profile.bin into folded stacks, one line per call path with the
+ticks spent in the innermost function itself, for flamegraph.pl. See
+include/profile.h.
+
+Function names are looked up with nm(1) in the stubble ELF of the same build.
+
+Example, with the ESP mounted at /boot/efi:
+
+  tools/profile-fold.py --elf stubble /boot/efi/stubble-profile.bin | flamegraph.pl > profile.svg
+"""
+
+import argparse
+import struct
+import subprocess
+import sys
+from pathlib import Path
+
+PROFILE_MAGIC = 0x464f5250
+
+HEADER = struct.Struct('<IIIIQ')
+NODE = struct.Struct('<IIQQ')
+
+def function_names(elf: Path) -> dict[int, str]:
+    out = subprocess.run(['nm', '--defined-only', str(elf)], check=True, capture_output=True, text=True).stdout
+
+    names = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1] in 'tTwW':
+            names.setdefault(int(fields[0], 16), fields[2])
+    return names
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description='Fold the call tree of a stubble profile for flamegraph.pl',
+                                     formatter_class=argparse.RawDescriptionHelpFormatter,
+                                     epilog=__doc__)
+    parser.add_argument('--elf', type=Path, required=True,
+                        help='the stubble ELF the stub was built from')
+    parser.add_argument('--usec', action='store_true',
+                        help='count microseconds rather than ticks')
+    parser.add_argument('--calls', action='store_true',
+                        help='count calls rather than time')
+    parser.add_argument('profile', type=Path,
+                        help='the stubble-profile.bin written by the stub')
+    args = parser.parse_args()
+
+    try:
+        names = function_names(args.elf)
+        data = args.profile.read_bytes()
+    except (OSError, subprocess.CalledProcessError) as e:
+        print(f'error: {e}', file=sys.stderr)
+        return 1
+
+    if len(data) < HEADER.size:
+        print('error: profile too short', file=sys.stderr)
+        return 1
+    magic, node_size, n_nodes, n_dropped, ticks_freq = HEADER.unpack_from(data)
+    if magic != PROFILE_MAGIC or node_size < NODE.size or len(data) < HEADER.size + n_nodes * node_size:
+        print('error: not a stubble profile', file=sys.stderr)
+        return 1
+    if args.usec and not ticks_freq:
+        print('error: the tick frequency is unknown, cannot convert to microseconds', file=sys.stderr)
+        return 1
+
+    nodes = [NODE.unpack_from(data, HEADER.size + i * node_size) for i in range(n_nodes)]
+
+    # Parents come before their children, so one pass each way is enough
+    paths = [''] * n_nodes
+    child_ticks = [0] * n_nodes
+    for i, (fn, parent, _, ticks) in enumerate(nodes):
+        if i == 0:
+            continue
+        name = names.get(fn, f'{fn:#x}')
+        paths[i] = f'{paths[parent]};{name}' if parent else name
+        child_ticks[parent] += ticks
+
+    for i, (_, _, calls, ticks) in enumerate(nodes):
+        if i == 0:
+            continue
+        if args.calls:
+            value = calls
+        else:
+            # The hooks themselves take time, which can make the callees add up to a bit more than the caller
+            value = max(ticks - child_ticks[i], 0)
+            if args.usec:
+                value = value * 1000000 // ticks_freq
+        if value:
+            print(f'{paths[i]} {value}')
+
+    if n_dropped:
+        print(f'{n_dropped} calls dropped, the call tree or stack was full', file=sys.stderr)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
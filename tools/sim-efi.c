@@ -0,0 +1,295 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* A fake firmware, just enough of it to run the .dtbauto selection of the stub on a host. Boot services
+ * allocate from the host heap, the configuration tables carry what was captured from a machine and ConOut
+ * writes into the result. Anything else is left NULL, calling it crashes the worker, which is reported. */
+
+#include "chid.h"
+#include "devicetree.h"
+#include "efi-log.h"
+#include "pe.h"
+#include "proto/dt-fixup.h"
+#include "proto/edid-discovered.h"
+#include "proto/simple-text-io.h"
+#include "stubble-sim.h"
+#include "util.h"
+
+#define SMBIOS_TABLE_GUID \
+        GUID_DEF(0xeb9d2d31, 0x2d88, 0x11d3, 0x9a, 0x16, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d)
+#define SMBIOS3_TABLE_GUID \
+        GUID_DEF(0xf2fd1544, 0x9794, 0x4a2c, 0x99, 0x2e, 0xe5, 0xbb, 0xcf, 0x20, 0xe3, 0x94)
+
+/* Stalls this long only happen in freeze(), i.e. after an assertion failed */
+#define FREEZE_STALL_USEC (60U * 1000U * 1000U)
+
+typedef struct {
+        uint8_t anchor_string[5];
+        uint8_t entry_point_structure_checksum;
+        uint8_t entry_point_length;
+        uint8_t major_version;
+        uint8_t minor_version;
+        uint8_t docrev;
+        uint8_t entry_point_revision;
+        uint8_t reserved;
+        uint32_t table_maximum_size;
+        uint64_t table_address;
+} _packed_ Smbios3EntryPoint;
+
+EFI_SYSTEM_TABLE *ST;
+EFI_BOOT_SERVICES *BS;
+EFI_RUNTIME_SERVICES *RT;
+
+static struct {
+        EFI_SYSTEM_TABLE st;
+        EFI_BOOT_SERVICES bs;
+        EFI_RUNTIME_SERVICES rt;
+        EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL con_out;
+        typeof(*((EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *) NULL)->Mode) con_out_mode;
+        typeof(*((EFI_SYSTEM_TABLE *) NULL)->ConfigurationTable) tables[3];
+        Smbios3EntryPoint smbios3;
+        EFI_EDID_DISCOVERED_PROTOCOL edid;
+        bool have_edid;
+        SimResult *result;
+} fw;
+
+static EFIAPI EFI_STATUS fake_allocate_pages(
+                EFI_ALLOCATE_TYPE type, EFI_MEMORY_TYPE memory_type, size_t n_pages, EFI_PHYSICAL_ADDRESS *memory) {
+
+        if (type != AllocateAnyPages)
+                return EFI_UNSUPPORTED;
+
+        void *p = sim_host_alloc(n_pages * EFI_PAGE_SIZE, EFI_PAGE_SIZE);
+        if (!p)
+                return EFI_OUT_OF_RESOURCES;
+
+        *memory = POINTER_TO_PHYSICAL_ADDRESS(p);
+        return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS fake_free_pages(EFI_PHYSICAL_ADDRESS memory, size_t n_pages) {
+        sim_host_free(PHYSICAL_ADDRESS_TO_POINTER(memory));
+        return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS fake_allocate_pool(EFI_MEMORY_TYPE pool_type, size_t size, void **buffer) {
+        void *p = sim_host_alloc(size, 8);
+        if (!p)
+                return EFI_OUT_OF_RESOURCES;
+
+        *buffer = p;
+        return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS fake_free_pool(void *buffer) {
+        sim_host_free(buffer);
+        return EFI_SUCCESS;
+}
+
+static EFIAPI void fake_copy_mem(void *dest, void *src, size_t length) {
+        __builtin_memmove(dest, src, length);
+}
+
+static EFIAPI void fake_set_mem(void *buffer, size_t size, uint8_t value) {
+        __builtin_memset(buffer, value, size);
+}
+
+static EFIAPI EFI_STATUS fake_stall(size_t microseconds) {
+        if (microseconds >= FREEZE_STALL_USEC)
+                sim_host_freeze();
+        return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS fake_locate_protocol(EFI_GUID *protocol, void *registration, void **interface) {
+        if (fw.have_edid && efi_guid_equal(protocol, MAKE_GUID_PTR(EFI_EDID_DISCOVERED_PROTOCOL))) {
+                *interface = &fw.edid;
+                return EFI_SUCCESS;
+        }
+
+        return EFI_NOT_FOUND;
+}
+
+static EFIAPI EFI_STATUS fake_handle_protocol(EFI_HANDLE handle, EFI_GUID *protocol, void **interface) {
+        return EFI_UNSUPPORTED;
+}
+
+static EFIAPI EFI_STATUS fake_output_string(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *this, char16_t *s) {
+        SimResult *r = fw.result;
+
+        /* Anything but ASCII is replaced, the log is for humans only */
+        for (; *s != '\0'; s++) {
+                if (*s == '\r')
+                        continue;
+                if (r->log_size >= sizeof(r->log) - 1)
+                        break;
+                r->log[r->log_size++] = *s < 0x80 ? (char) *s : '?';
+        }
+        r->log[r->log_size] = '\0';
+
+        return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS fake_set_attribute(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *this, size_t attribute) {
+        this->Mode->Attribute = attribute;
+        return EFI_SUCCESS;
+}
+
+static void fake_firmware_init(const SimMachine *machine, SimResult *result) {
+        size_t n_tables = 0;
+
+        fw.result = result;
+
+        fw.con_out_mode.MaxMode = 1;
+        fw.con_out = (EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL) {
+                .OutputString = fake_output_string,
+                .SetAttribute = fake_set_attribute,
+                .Mode = &fw.con_out_mode,
+        };
+
+        fw.bs = (EFI_BOOT_SERVICES) {
+                .AllocatePages = fake_allocate_pages,
+                .FreePages = fake_free_pages,
+                .AllocatePool = fake_allocate_pool,
+                .FreePool = fake_free_pool,
+                .CopyMem = fake_copy_mem,
+                .SetMem = fake_set_mem,
+                .Stall = fake_stall,
+                .LocateProtocol = fake_locate_protocol,
+                .HandleProtocol = fake_handle_protocol,
+        };
+
+        if (machine->smbios_table) {
+                /* The captured entry point is used as is if it is a 64-bit one, only pointed at our copy of
+                 * the table. A 32-bit one can't point into the host heap, replace it by an equivalent 64-bit
+                 * one. The stub parses the table the same way either way. */
+                const Smbios3EntryPoint *captured = machine->smbios_entry_point;
+                if (captured && machine->smbios_entry_point_size >= sizeof(fw.smbios3) &&
+                    __builtin_memcmp(captured->anchor_string, "_SM3_", 5) == 0)
+                        fw.smbios3 = *captured;
+                else
+                        fw.smbios3 = (Smbios3EntryPoint) {
+                                .anchor_string = "_SM3_",
+                                .entry_point_length = sizeof(fw.smbios3),
+                                .major_version = 3,
+                                .entry_point_revision = 1,
+                        };
+                fw.smbios3.table_maximum_size = machine->smbios_table_size;
+                fw.smbios3.table_address = POINTER_TO_PHYSICAL_ADDRESS(machine->smbios_table);
+
+                fw.tables[n_tables].VendorGuid = (EFI_GUID) SMBIOS3_TABLE_GUID;
+                fw.tables[n_tables++].VendorTable = &fw.smbios3;
+        }
+
+        if (machine->dtb) {
+                fw.tables[n_tables].VendorGuid = (EFI_GUID) EFI_DTB_TABLE_GUID;
+                fw.tables[n_tables++].VendorTable = (void *) machine->dtb;
+        }
+
+        if (machine->edid) {
+                fw.edid = (EFI_EDID_DISCOVERED_PROTOCOL) {
+                        .SizeOfEdid = machine->edid_size,
+                        .Edid = (uint8_t *) machine->edid,
+                };
+                fw.have_edid = true;
+        }
+
+        fw.st = (EFI_SYSTEM_TABLE) {
+                .ConOut = &fw.con_out,
+                .StdErr = &fw.con_out,
+                .BootServices = &fw.bs,
+                .RuntimeServices = &fw.rt,
+                .NumberOfTableEntries = n_tables,
+                .ConfigurationTable = fw.tables,
+        };
+
+        ST = &fw.st;
+        BS = &fw.bs;
+        RT = &fw.rt;
+}
+
+static void copy_string(char *dest, size_t size, const char *s) {
+        size_t n = 0;
+
+        if (s)
+                for (; n < size - 1 && s[n] != '\0'; n++)
+                        dest[n] = s[n];
+        dest[n] = '\0';
+}
+
+static uint64_t fnv1a(const void *p, size_t n) {
+        uint64_t h = UINT64_C(0xcbf29ce484222325);
+
+        for (const uint8_t *b = p; n > 0; b++, n--)
+                h = (h ^ *b) * UINT64_C(0x100000001b3);
+        return h;
+}
+
+void sim_evaluate(
+                const void *image_base,
+                const void *section_table,
+                size_t n_section_table,
+                const SimMachine *machine,
+                SimResult *ret) {
+
+        static const char *const dtbauto_section_names[] = { ".dtbauto", NULL };
+        static const char *const hwids_section_names[] = { ".hwids", NULL };
+        const PeSectionHeader *sections = section_table;
+        size_t base = PTR_TO_SIZE(image_base);
+
+        assert(image_base);
+        assert(machine);
+        assert(ret);
+
+        *ret = (SimResult) {
+                .section = -1,
+                .chid_type = -1,
+        };
+        fake_firmware_init(machine, ret);
+
+        /* This is exactly what the stub does */
+        PeSectionVector dtbauto[1] = {};
+        pe_locate_sections(sections, n_section_table, dtbauto_section_names, base, dtbauto);
+
+        /* And this only retraces it to be able to tell why */
+        DevicetreeMatchContext dt_match;
+        devicetree_match_context_init(&dt_match);
+        if (!dt_match.fw_dtb) {
+                PeSectionVector hwids[1] = {};
+                pe_locate_sections(sections, n_section_table, hwids_section_names, base, hwids);
+
+                const Device *device = NULL;
+                size_t chid_type = SIZE_MAX;
+                if (PE_SECTION_VECTOR_IS_SET(hwids) &&
+                    chid_match((const uint8_t *) image_base + hwids[0].memory_offset,
+                               hwids[0].memory_size,
+                               DEVICE_TYPE_DEVICETREE,
+                               &device,
+                               &chid_type) == EFI_SUCCESS)
+                        devicetree_match_context_set_device(
+                                        &dt_match,
+                                        (const uint8_t *) image_base + hwids[0].memory_offset,
+                                        device,
+                                        chid_type);
+        }
+
+        ret->source = (SimSource) dt_match.source;
+        if (dt_match.source == DEVICETREE_MATCH_HWID) {
+                ret->chid_type = dt_match.chid_type;
+                copy_string(ret->device, sizeof(ret->device), device_get_name(dt_match.hwids, dt_match.device));
+        }
+
+        if (!PE_SECTION_VECTOR_IS_SET(dtbauto))
+                return;
+
+        for (size_t i = 0; i < n_section_table; i++)
+                if (pe_section_name_equal((const char *) sections[i].Name, ".dtbauto") &&
+                    sections[i].VirtualAddress == dtbauto[0].memory_offset) {
+                        ret->section = i;
+                        break;
+                }
+
+        /* The section was scored successfully by the stub, hence the header is good */
+        const FdtHeader *dtb = (const FdtHeader *) ((const uint8_t *) image_base + dtbauto[0].memory_offset);
+        (void) devicetree_match_score(&dt_match, dtb, dtbauto[0].memory_size, &ret->score);
+        copy_string(ret->compatible, sizeof(ret->compatible), devicetree_get_compatible(dtb));
+        ret->dtb_hash = fnv1a(dtb, MIN((size_t) be32toh(dtb->total_size), dtbauto[0].memory_size));
+}
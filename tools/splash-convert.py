@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: LGPL-2.1-or-later
+
+"""
+Converts an image into the pre-converted .splash format of the stub, which
+it hands to GOP Blt() straight from the section, without decoding anything
+at boot. See include/splash.h.
+
+PNG (8 bits per channel, not interlaced) and uncompressed 24 or 32-bit BMP
+are read without further dependencies, anything else if Pillow is
+installed. Transparent pixels are blended onto the background colour.
+
+Example:
+
+  tools/splash-convert.py logo.png splash.bgrx
+  ukify build --linux=/boot/vmlinuz --stub=stubble.efi --splash=splash.bgrx --output=vmlinuz.efi
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+from pathlib import Path
+
+SPLASH_MAGIC = 0x58524742
+SPLASH_DIMENSION_MAX = 16384
+
+HEADER = struct.Struct('<IIII')
+
+class ImageError(Exception):
+    pass
+
+# Images are handled as (width, height, rows), each row a bytes object of RGBA
+
+def paeth(a: int, b: int, c: int) -> int:
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc:
+        return a
+    return b if pb <= pc else c
+
+def unfilter(data: bytes, width: int, height: int, bpp: int) -> list[bytearray]:
+    stride = width * bpp
+    rows = []
+    prev = bytearray(stride)
+    pos = 0
+    for _ in range(height):
+        kind = data[pos]
+        row = bytearray(data[pos + 1:pos + 1 + stride])
+        pos += 1 + stride
+        if len(row) != stride:
+            raise ImageError('PNG image data is truncated')
+        if kind == 1:
+            for i in range(bpp, stride):
+                row[i] = (row[i] + row[i - bpp]) & 0xff
+        elif kind == 2:
+            for i in range(stride):
+                row[i] = (row[i] + prev[i]) & 0xff
+        elif kind == 3:
+            for i in range(stride):
+                left = row[i - bpp] if i >= bpp else 0
+                row[i] = (row[i] + ((left + prev[i]) >> 1)) & 0xff
+        elif kind == 4:
+            for i in range(stride):
+                left = row[i - bpp] if i >= bpp else 0
+                up_left = prev[i - bpp] if i >= bpp else 0
+                row[i] = (row[i] + paeth(left, prev[i], up_left)) & 0xff
+        elif kind != 0:
+            raise ImageError(f'unknown PNG filter type {kind}')
+        rows.append(row)
+        prev = row
+    return rows
+
+def read_png(data: bytes) -> tuple[int, int, list[bytes]]:
+    pos = 8
+    header = None
+    palette = b''
+    transparency = b''
+    idat = []
+    while pos + 8 <= len(data):
+        length, kind = struct.unpack_from('>I4s', data, pos)
+        chunk = data[pos + 8:pos + 8 + length]
+        pos += 12 + length
+        if kind == b'IHDR':
+            header = struct.unpack('>IIBBBBB', chunk)
+        elif kind == b'PLTE':
+            palette = chunk
+        elif kind == b'tRNS':
+            transparency = chunk
+        elif kind == b'IDAT':
+            idat.append(chunk)
+        elif kind == b'IEND':
+            break
+    if not header:
+        raise ImageError('PNG lacks a header')
+
+    width, height, depth, color, _, _, interlace = header
+    channels = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}.get(color)
+    if depth != 8 or channels is None or interlace:
+        raise ImageError('only 8-bit, non-interlaced PNGs are supported without Pillow')
+
+    rows = unfilter(zlib.decompress(b''.join(idat)), width, height, channels)
+
+    out = []
+    for row in rows:
+        if color == 6:
+            out.append(bytes(row))
+            continue
+        rgba = bytearray(width * 4)
+        for x in range(width):
+            if color == 0:
+                g = row[x]
+                rgba[4 * x:4 * x + 4] = bytes((g, g, g, 255))
+            elif color == 4:
+                g, a = row[2 * x], row[2 * x + 1]
+                rgba[4 * x:4 * x + 4] = bytes((g, g, g, a))
+            elif color == 2:
+                rgba[4 * x:4 * x + 3] = row[3 * x:3 * x + 3]
+                rgba[4 * x + 3] = 255
+            else:
+                i = row[x]
+                if 3 * i + 3 > len(palette):
+                    raise ImageError('PNG palette index out of range')
+                rgba[4 * x:4 * x + 3] = palette[3 * i:3 * i + 3]
+                rgba[4 * x + 3] = transparency[i] if i < len(transparency) else 255
+        out.append(bytes(rgba))
+    return width, height, out
+
+def read_bmp(data: bytes) -> tuple[int, int, list[bytes]]:
+    if len(data) < 54:
+        raise ImageError('BMP is truncated')
+    offset, = struct.unpack_from('<I', data, 10)
+    _, width, height, planes, depth, compression = struct.unpack_from('<IiiHHI', data, 14)
+    if planes != 1 or depth not in (24, 32) or compression not in (0, 3):
+        raise ImageError('only uncompressed 24 or 32-bit BMPs are supported without Pillow')
+
+    top_down = height < 0
+    height = abs(height)
+    bpp = depth // 8
+    stride = (width * bpp + 3) & ~3
+    if offset + stride * height > len(data):
+        raise ImageError('BMP image data is truncated')
+
+    rows = []
+    for y in range(height):
+        start = offset + (y if top_down else height - 1 - y) * stride
+        row = data[start:start + width * bpp]
+        rgba = bytearray(width * 4)
+        for x in range(width):
+            b, g, r = row[bpp * x:bpp * x + 3]
+            rgba[4 * x:4 * x + 4] = bytes((r, g, b, 255))
+        rows.append(bytes(rgba))
+    return width, height, rows
+
+def read_pillow(path: Path) -> tuple[int, int, list[bytes]]:
+    try:
+        from PIL import Image
+    except ImportError:
+        raise ImageError('unknown image format, install Pillow to read it')
+
+    with Image.open(path) as image:
+        image = image.convert('RGBA')
+        data = image.tobytes()
+        width, height = image.size
+    return width, height, [data[y * width * 4:(y + 1) * width * 4] for y in range(height)]
+
+def read_image(path: Path) -> tuple[int, int, list[bytes]]:
+    data = path.read_bytes()
+    if data.startswith(b'\x89PNG\r\n\x1a\n'):
+        return read_png(data)
+    if data.startswith(b'BM'):
+        return read_bmp(data)
+    return read_pillow(path)
+
+def parse_color(s: str) -> tuple[int, int, int]:
+    s = s.removeprefix('#')
+    if len(s) != 6:
+        raise argparse.ArgumentTypeError(f'not an RRGGBB colour: {s}')
+    try:
+        v = int(s, 16)
+    except ValueError:
+        raise argparse.ArgumentTypeError(f'not an RRGGBB colour: {s}')
+    return (v >> 16) & 0xff, (v >> 8) & 0xff, v & 0xff
+
+def convert(width: int, height: int, rows: list[bytes], background: tuple[int, int, int]) -> bytes:
+    out = bytearray(HEADER.pack(SPLASH_MAGIC, HEADER.size, width, height))
+    br, bg, bb = background
+    for row in rows:
+        bgrx = bytearray(width * 4)
+        for x in range(width):
+            r, g, b, a = row[4 * x:4 * x + 4]
+            if a != 255:
+                r = (r * a + br * (255 - a) + 127) // 255
+                g = (g * a + bg * (255 - a) + 127) // 255
+                b = (b * a + bb * (255 - a) + 127) // 255
+            bgrx[4 * x:4 * x + 4] = bytes((b, g, r, 0))
+        out += bgrx
+    return bytes(out)
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description='Convert an image into the pre-converted .splash format',
+                                     formatter_class=argparse.RawDescriptionHelpFormatter,
+                                     epilog=__doc__)
+    parser.add_argument('--background', type=parse_color, default=(0, 0, 0),
+                        help='RRGGBB colour to blend transparent pixels onto, black by default')
+    parser.add_argument('image', type=Path,
+                        help='the image to convert')
+    parser.add_argument('output', type=Path,
+                        help='where to write the .splash section')
+    args = parser.parse_args()
+
+    try:
+        width, height, rows = read_image(args.image)
+        if not 0 < width <= SPLASH_DIMENSION_MAX or not 0 < height <= SPLASH_DIMENSION_MAX:
+            raise ImageError(f'{width}x{height} is not a sensible size for a splash')
+        args.output.write_bytes(convert(width, height, rows, args.background))
+    except (OSError, ImageError, zlib.error) as e:
+        print(f'error: {args.image}: {e}', file=sys.stderr)
+        return 1
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,678 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+/* Replays the .dtbauto selection of the stub for a fleet of machines on the host, using the very same chid.c,
+ * smbios.c, edid.c, pe.c and devicetree.c the stub is built from. Each machine is given as
+ *
+ *   - a capture file written by the stub with stubble.capture, or
+ *   - a raw SMBIOS table, e.g. a copy of /sys/firmware/dmi/tables/DMI, optionally accompanied by an EDID in a
+ *     file of the same name with ".edid" appended and a firmware DT with ".dtb" appended, or
+ *   - a copy of /sys/firmware/dmi/tables/, i.e. a directory with a DMI and a smbios_entry_point file, and
+ *     optionally an edid and a dtb file.
+ *
+ * Any other directory is searched (not recursively) for machines. Every machine is evaluated in a process of
+ * its own, as the stub caches what it learns about the firmware and may well assert on garbage input.
+ *
+ * With --baseline only machines that would get a different DT (or none) from the image than from the
+ * baseline image are listed, and the exit status is 1 if there are any. */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stubble-sim.h"
+
+/* See include/capture.h, which can't be included here as it is meant for freestanding builds only */
+#define CAPTURE_MAGIC "STBLCAP1"
+#define CAPTURE_HEADER_SIZE 16U
+#define CAPTURE_RECORD_HEADER_SIZE 8U
+#define CAPTURE_ALIGNMENT 8U
+
+enum {
+        CAPTURE_RECORD_SMBIOS_ENTRY_POINT = 1,
+        CAPTURE_RECORD_SMBIOS_TABLE       = 2,
+        CAPTURE_RECORD_EDID               = 3,
+        CAPTURE_RECORD_DTB                = 4,
+};
+
+typedef enum JobState {
+        JOB_PENDING,
+        JOB_DONE,
+        JOB_LOAD_FAILED,
+        JOB_ASSERTED,
+        JOB_CRASHED,
+} JobState;
+
+#define EXIT_ASSERTED 3
+
+typedef struct Image {
+        const char *path;
+        uint8_t *base;
+        size_t size;
+        const void *section_table;
+        size_t n_section_table;
+} Image;
+
+typedef struct Machine {
+        char *path;
+        bool sysfs_dir;
+} Machine;
+
+typedef struct Job {
+        JobState state;
+        SimResult result;
+} Job;
+
+static struct {
+        Machine *machines;
+        size_t n_machines;
+        unsigned n_jobs;
+        bool verbose;
+        const char *baseline;
+} arg;
+
+static void die(const char *format, ...) {
+        va_list ap;
+
+        va_start(ap, format);
+        fputs("stubble-sim: ", stderr);
+        vfprintf(stderr, format, ap);
+        fputc('\n', stderr);
+        va_end(ap);
+        exit(EXIT_FAILURE);
+}
+
+void *sim_host_alloc(size_t size, size_t alignment) {
+        void *p;
+
+        if (posix_memalign(&p, alignment, size > 0 ? size : 1) != 0)
+                return NULL;
+        return p;
+}
+
+void sim_host_free(void *p) {
+        free(p);
+}
+
+_Noreturn void sim_host_freeze(void) {
+        _exit(EXIT_ASSERTED);
+}
+
+static int read_file(const char *path, uint8_t **ret, size_t *ret_size) {
+        struct stat st;
+        int fd;
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0) {
+                int r = -errno;
+                close(fd);
+                return r;
+        }
+        if (!S_ISREG(st.st_mode)) {
+                close(fd);
+                return -EISDIR;
+        }
+
+        uint8_t *buf = malloc(st.st_size + 1);
+        if (!buf) {
+                close(fd);
+                return -ENOMEM;
+        }
+
+        size_t n = 0;
+        while (n < (size_t) st.st_size) {
+                ssize_t k = read(fd, buf + n, st.st_size - n);
+                if (k < 0 && errno == EINTR)
+                        continue;
+                if (k <= 0) {
+                        int r = k < 0 ? -errno : -EIO;
+                        free(buf);
+                        close(fd);
+                        return r;
+                }
+                n += k;
+        }
+        close(fd);
+
+        *ret = buf;
+        *ret_size = n;
+        return 0;
+}
+
+static uint16_t read_le16(const uint8_t *p) {
+        return p[0] | p[1] << 8;
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+        return (uint32_t) read_le16(p) | (uint32_t) read_le16(p + 2) << 16;
+}
+
+/* Lays the sections out as the firmware loader would, so that the stub finds them at their virtual
+ * addresses. Only what the stub itself relies on is checked, the machine type is deliberately not, so that
+ * images for other architectures can be checked too. */
+static void image_load(const char *path, Image *ret) {
+        uint8_t *file;
+        size_t size;
+        int r;
+
+        r = read_file(path, &file, &size);
+        if (r < 0)
+                die("Failed to read %s: %s", path, strerror(-r));
+
+        if (size < 0x40 || memcmp(file, "MZ", 2) != 0)
+                die("%s is not a PE image.", path);
+
+        size_t pe = read_le32(file + 0x3c);
+        if (pe > size || size - pe < 24 || memcmp(file + pe, "PE\0\0", 4) != 0)
+                die("%s is not a PE image.", path);
+
+        size_t n_sections = read_le16(file + pe + 6);
+        size_t opt = pe + 24, opt_size = read_le16(file + pe + 20);
+        size_t table = opt + opt_size;
+        if (opt_size < 60 || table > size || (size - table) / 40 < n_sections)
+                die("%s has a truncated PE header.", path);
+
+        size_t image_size = read_le32(file + opt + 56);
+        if (image_size < table + n_sections * 40)
+                die("%s has a bogus image size.", path);
+        uint8_t *base = mmap(NULL, image_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+                die("Failed to map %s: %m", path);
+
+        /* The headers, including the section table, are loaded too */
+        memcpy(base, file, table + n_sections * 40);
+
+        for (size_t i = 0; i < n_sections; i++) {
+                const uint8_t *s = file + table + i * 40;
+                uint32_t virtual_size = read_le32(s + 8), virtual_address = read_le32(s + 12);
+                uint32_t raw_size = read_le32(s + 16), raw_offset = read_le32(s + 20);
+                size_t n = raw_size < virtual_size ? raw_size : virtual_size;
+
+                if (raw_offset > size || size - raw_offset < n ||
+                    virtual_address > image_size || image_size - virtual_address < n)
+                        die("Section %zu of %s is out of bounds.", i, path);
+
+                memcpy(base + virtual_address, file + raw_offset, n);
+        }
+
+        free(file);
+
+        *ret = (Image) {
+                .path = path,
+                .base = base,
+                .size = image_size,
+                .section_table = base + table,
+                .n_section_table = n_sections,
+        };
+}
+
+static bool has_suffix(const char *s, const char *suffix) {
+        size_t n = strlen(s), m = strlen(suffix);
+
+        return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static char *path_join(const char *a, const char *b) {
+        char *p;
+
+        if (asprintf(&p, "%s/%s", a, b) < 0)
+                die("Out of memory.");
+        return p;
+}
+
+/* Missing companion files are fine, anything else is not */
+static int read_optional_file(const char *path, uint8_t **ret, size_t *ret_size) {
+        int r = read_file(path, ret, ret_size);
+        if (r == -ENOENT) {
+                *ret = NULL;
+                *ret_size = 0;
+                return 0;
+        }
+        return r;
+}
+
+static int capture_parse(const uint8_t *buf, size_t size, SimMachine *ret) {
+        if (size < CAPTURE_HEADER_SIZE || memcmp(buf, CAPTURE_MAGIC, 8) != 0)
+                return -EBADMSG;
+
+        uint32_t n_records = read_le32(buf + 8);
+        size_t offset = CAPTURE_HEADER_SIZE;
+
+        for (uint32_t i = 0; i < n_records; i++) {
+                if (size - offset < CAPTURE_RECORD_HEADER_SIZE)
+                        return -EBADMSG;
+
+                uint32_t type = read_le32(buf + offset), record_size = read_le32(buf + offset + 4);
+                const uint8_t *payload = buf + offset + CAPTURE_RECORD_HEADER_SIZE;
+                offset += CAPTURE_RECORD_HEADER_SIZE;
+                if (size - offset < record_size)
+                        return -EBADMSG;
+
+                switch (type) {
+                case CAPTURE_RECORD_SMBIOS_ENTRY_POINT:
+                        ret->smbios_entry_point = payload;
+                        ret->smbios_entry_point_size = record_size;
+                        break;
+                case CAPTURE_RECORD_SMBIOS_TABLE:
+                        ret->smbios_table = payload;
+                        ret->smbios_table_size = record_size;
+                        break;
+                case CAPTURE_RECORD_EDID:
+                        ret->edid = payload;
+                        ret->edid_size = record_size;
+                        break;
+                case CAPTURE_RECORD_DTB:
+                        ret->dtb = payload;
+                        ret->dtb_size = record_size;
+                        break;
+                default:
+                        /* The CHIDs the stub calculated are not needed, we calculate them again */
+                        break;
+                }
+
+                size_t padded = (record_size + CAPTURE_ALIGNMENT - 1) / CAPTURE_ALIGNMENT * CAPTURE_ALIGNMENT;
+                offset += padded < size - offset ? padded : size - offset;
+        }
+
+        return 0;
+}
+
+/* Loads the firmware provided data of a machine. The buffers are never freed, this runs in a worker that
+ * exits right after. */
+static int machine_load(const Machine *m, SimMachine *ret) {
+        uint8_t *buf, *extra;
+        size_t size, extra_size;
+        char *p;
+        int r;
+
+        *ret = (SimMachine) {};
+
+        if (m->sysfs_dir) {
+                p = path_join(m->path, "DMI");
+                r = read_file(p, &buf, &size);
+                if (r < 0)
+                        return r;
+                ret->smbios_table = buf;
+                ret->smbios_table_size = size;
+
+                p = path_join(m->path, "smbios_entry_point");
+                r = read_optional_file(p, &extra, &extra_size);
+                if (r < 0)
+                        return r;
+                ret->smbios_entry_point = extra;
+                ret->smbios_entry_point_size = extra_size;
+
+                p = path_join(m->path, "edid");
+                r = read_optional_file(p, &extra, &extra_size);
+                if (r < 0)
+                        return r;
+                ret->edid = extra;
+                ret->edid_size = extra_size;
+
+                p = path_join(m->path, "dtb");
+                r = read_optional_file(p, &extra, &extra_size);
+                if (r < 0)
+                        return r;
+                ret->dtb = extra;
+                ret->dtb_size = extra_size;
+                return 0;
+        }
+
+        r = read_file(m->path, &buf, &size);
+        if (r < 0)
+                return r;
+
+        if (size >= 8 && memcmp(buf, CAPTURE_MAGIC, 8) == 0)
+                return capture_parse(buf, size, ret);
+
+        ret->smbios_table = buf;
+        ret->smbios_table_size = size;
+
+        if (asprintf(&p, "%s.edid", m->path) < 0)
+                return -ENOMEM;
+        r = read_optional_file(p, &extra, &extra_size);
+        if (r < 0)
+                return r;
+        ret->edid = extra;
+        ret->edid_size = extra_size;
+
+        if (asprintf(&p, "%s.dtb", m->path) < 0)
+                return -ENOMEM;
+        r = read_optional_file(p, &extra, &extra_size);
+        if (r < 0)
+                return r;
+        ret->dtb = extra;
+        ret->dtb_size = extra_size;
+        return 0;
+}
+
+static void machine_add(const char *path, bool sysfs_dir) {
+        Machine *m = realloc(arg.machines, (arg.n_machines + 1) * sizeof(Machine));
+        if (!m)
+                die("Out of memory.");
+
+        arg.machines = m;
+        arg.machines[arg.n_machines++] = (Machine) {
+                .path = strdup(path),
+                .sysfs_dir = sysfs_dir,
+        };
+}
+
+static bool is_sysfs_dir(const char *path) {
+        char *p = path_join(path, "DMI");
+        bool r = access(p, F_OK) == 0;
+
+        free(p);
+        return r;
+}
+
+static int compare_machines(const void *a, const void *b) {
+        return strcmp(((const Machine *) a)->path, ((const Machine *) b)->path);
+}
+
+static void machines_collect(const char *path) {
+        struct stat st;
+
+        if (stat(path, &st) < 0)
+                die("Failed to stat %s: %m", path);
+
+        if (!S_ISDIR(st.st_mode)) {
+                machine_add(path, /* sysfs_dir= */ false);
+                return;
+        }
+
+        if (is_sysfs_dir(path)) {
+                machine_add(path, /* sysfs_dir= */ true);
+                return;
+        }
+
+        DIR *d = opendir(path);
+        if (!d)
+                die("Failed to open %s: %m", path);
+
+        size_t first = arg.n_machines;
+        for (struct dirent *de; (de = readdir(d));) {
+                if (de->d_name[0] == '.')
+                        continue;
+                /* Companions of a raw SMBIOS table */
+                if (has_suffix(de->d_name, ".edid") || has_suffix(de->d_name, ".dtb"))
+                        continue;
+
+                char *p = path_join(path, de->d_name);
+                if (stat(p, &st) < 0)
+                        die("Failed to stat %s: %m", p);
+                if (S_ISREG(st.st_mode))
+                        machine_add(p, /* sysfs_dir= */ false);
+                else if (S_ISDIR(st.st_mode) && is_sysfs_dir(p))
+                        machine_add(p, /* sysfs_dir= */ true);
+                free(p);
+        }
+        closedir(d);
+
+        /* Keep the output stable, readdir() order is arbitrary */
+        qsort(arg.machines + first, arg.n_machines - first, sizeof(Machine), compare_machines);
+}
+
+static void job_run(const Image *image, const Machine *m, Job *job) {
+        SimMachine machine;
+        int r;
+
+        r = machine_load(m, &machine);
+        if (r < 0) {
+                snprintf(job->result.log, sizeof(job->result.log), "Failed to load: %s", strerror(-r));
+                job->state = JOB_LOAD_FAILED;
+                return;
+        }
+
+        sim_evaluate(image->base, image->section_table, image->n_section_table, &machine, &job->result);
+        job->state = JOB_DONE;
+}
+
+/* Evaluates each machine against each image in a forked worker, at most arg.n_jobs at a time. Jobs are
+ * laid out machine major, i.e. jobs[i * n_images + j] is machine i with image j. */
+static Job *jobs_run(const Image *images, size_t n_images) {
+        size_t n = arg.n_machines * n_images, next = 0, running = 0;
+
+        /* Shared with the workers, they write their result right into it */
+        Job *jobs = mmap(NULL, n * sizeof(Job) ?: 1, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (jobs == MAP_FAILED)
+                die("Failed to allocate results: %m");
+
+        pid_t *pids = calloc(arg.n_jobs, sizeof(pid_t));
+        size_t *slots = calloc(arg.n_jobs, sizeof(size_t));
+        if (!pids || !slots)
+                die("Out of memory.");
+
+        fflush(NULL);
+
+        while (next < n || running > 0) {
+                while (next < n && running < arg.n_jobs) {
+                        size_t slot = 0;
+                        while (pids[slot] != 0)
+                                slot++;
+
+                        pid_t pid = fork();
+                        if (pid < 0)
+                                die("Failed to fork: %m");
+                        if (pid == 0) {
+                                job_run(images + next % n_images, arg.machines + next / n_images, jobs + next);
+                                _exit(EXIT_SUCCESS);
+                        }
+
+                        pids[slot] = pid;
+                        slots[slot] = next++;
+                        running++;
+                }
+
+                int status;
+                pid_t pid = wait(&status);
+                if (pid < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        die("Failed to wait for workers: %m");
+                }
+
+                size_t slot = 0;
+                while (slot < arg.n_jobs && pids[slot] != pid)
+                        slot++;
+                if (slot >= arg.n_jobs)
+                        continue;
+
+                Job *job = jobs + slots[slot];
+                if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_ASSERTED)
+                        job->state = JOB_ASSERTED;
+                else if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS || job->state == JOB_PENDING)
+                        job->state = JOB_CRASHED;
+
+                pids[slot] = 0;
+                running--;
+        }
+
+        free(pids);
+        free(slots);
+        return jobs;
+}
+
+static void job_describe(const Job *job, char *buf, size_t size) {
+        const SimResult *r = &job->result;
+
+        switch (job->state) {
+        case JOB_LOAD_FAILED:
+                snprintf(buf, size, "error (%.256s)", r->log);
+                return;
+        case JOB_ASSERTED:
+                snprintf(buf, size, "error (assertion failed in the stub)");
+                return;
+        case JOB_CRASHED:
+                snprintf(buf, size, "error (the stub crashed)");
+                return;
+        default:
+                break;
+        }
+
+        if (r->section < 0) {
+                switch (r->source) {
+                case SIM_SOURCE_NONE:
+                        snprintf(buf, size, "none (no firmware DT and no .hwids match)");
+                        break;
+                case SIM_SOURCE_FIRMWARE:
+                        snprintf(buf, size, "none (keeping the firmware DT, no .dtbauto is compatible)");
+                        break;
+                case SIM_SOURCE_HWID:
+                        snprintf(buf, size, "none (HWID of %s, CHID type %d, but no .dtbauto is compatible)",
+                                 r->device[0] ? r->device : "unknown device", r->chid_type);
+                        break;
+                }
+                return;
+        }
+
+        if (r->source == SIM_SOURCE_HWID)
+                snprintf(buf, size, "section %d: %s (HWID of %s, CHID type %d, score 0x%" PRIx32 ")",
+                         r->section, r->compatible, r->device[0] ? r->device : "unknown device",
+                         r->chid_type, r->score);
+        else
+                snprintf(buf, size, "section %d: %s (firmware DT compatible, score 0x%" PRIx32 ")",
+                         r->section, r->compatible, r->score);
+}
+
+static bool job_same_dtb(const Job *a, const Job *b) {
+        if (a->state != JOB_DONE || b->state != JOB_DONE)
+                return a->state == b->state;
+        if ((a->result.section < 0) != (b->result.section < 0))
+                return false;
+        return a->result.section < 0 || a->result.dtb_hash == b->result.dtb_hash;
+}
+
+static void help(void) {
+        printf("Usage: stubble-sim [OPTIONS...] UKI MACHINE...\n\n"
+               "Shows the .dtbauto section the stub in UKI picks for each machine.\n\n"
+               "  -h --help               Show this help\n"
+               "  -j --jobs=N             Evaluate N machines in parallel (default: number of CPUs)\n"
+               "  -b --baseline=UKI       Only list machines that get a different DT than with UKI\n"
+               "  -v --verbose            Show what the stub logged\n\n"
+               "A MACHINE is a capture file written with stubble.capture, a raw SMBIOS table (with\n"
+               "optional .edid and .dtb companion files), a copy of /sys/firmware/dmi/tables/, or a\n"
+               "directory of any of these.\n");
+}
+
+static void parse_argv(int argc, char *argv[], const char **ret_image) {
+        static const struct option options[] = {
+                { "help",     no_argument,       NULL, 'h' },
+                { "jobs",     required_argument, NULL, 'j' },
+                { "baseline", required_argument, NULL, 'b' },
+                { "verbose",  no_argument,       NULL, 'v' },
+                {}
+        };
+        int c;
+
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        arg.n_jobs = n_cpus > 0 ? n_cpus : 1;
+
+        while ((c = getopt_long(argc, argv, "hj:b:v", options, NULL)) >= 0)
+                switch (c) {
+                case 'h':
+                        help();
+                        exit(EXIT_SUCCESS);
+                case 'j': {
+                        char *e;
+                        unsigned long n = strtoul(optarg, &e, 10);
+                        if (*e != '\0' || n == 0 || n > 4096)
+                                die("Invalid number of jobs: %s", optarg);
+                        arg.n_jobs = n;
+                        break;
+                }
+                case 'b':
+                        arg.baseline = optarg;
+                        break;
+                case 'v':
+                        arg.verbose = true;
+                        break;
+                default:
+                        exit(EXIT_FAILURE);
+                }
+
+        if (argc - optind < 2)
+                die("Expected an image and at least one machine, see --help.");
+
+        *ret_image = argv[optind];
+        for (int i = optind + 1; i < argc; i++)
+                machines_collect(argv[i]);
+}
+
+static void print_log(const Job *job) {
+        if (!arg.verbose || job->state != JOB_DONE || job->result.log_size == 0)
+                return;
+
+        for (const char *l = job->result.log, *e; *l != '\0'; l = *e != '\0' ? e + 1 : e) {
+                e = strchrnul(l, '\n');
+                if (e > l)
+                        printf("    %.*s\n", (int) (e - l), l);
+        }
+}
+
+int main(int argc, char *argv[]) {
+        const char *image_path;
+        Image images[2];
+        size_t n_images = 1, n_selected = 0, n_failed = 0, n_changed = 0;
+        struct timespec start, end;
+        char a[512], b[512];
+
+        parse_argv(argc, argv, &image_path);
+
+        image_load(image_path, images);
+        if (arg.baseline)
+                image_load(arg.baseline, images + n_images++);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        Job *jobs = jobs_run(images, n_images);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        for (size_t i = 0; i < arg.n_machines; i++) {
+                const Job *job = jobs + i * n_images;
+
+                if (job->state != JOB_DONE)
+                        n_failed++;
+                else if (job->result.section >= 0)
+                        n_selected++;
+
+                job_describe(job, a, sizeof(a));
+
+                if (!arg.baseline) {
+                        printf("%s: %s\n", arg.machines[i].path, a);
+                        print_log(job);
+                        continue;
+                }
+
+                if (job_same_dtb(job, job + 1))
+                        continue;
+
+                n_changed++;
+                job_describe(job + 1, b, sizeof(b));
+                printf("%s:\n  baseline: %s\n  new:      %s\n", arg.machines[i].path, b, a);
+                if (strcmp(a, b) == 0)
+                        printf("  (same section and compatible, but the DT itself differs)\n");
+                print_log(job);
+        }
+
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "%zu machines, %zu with a .dtbauto, %zu without, %zu failed",
+                arg.n_machines, n_selected, arg.n_machines - n_selected - n_failed, n_failed);
+        if (arg.baseline)
+                fprintf(stderr, ", %zu changed", n_changed);
+        fprintf(stderr, " (%.2fs, %u jobs)\n", elapsed, arg.n_jobs);
+
+        return n_changed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
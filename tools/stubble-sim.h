@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+#pragma once
+
+/* Interface between the two halves of stubble-sim: the CLI, built against libc, and the stubble sources plus
+ * a fake firmware, built freestanding against the EFI headers. Hence only plain C types here. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* What the firmware of one machine provides, all optional */
+typedef struct SimMachine {
+        const void *smbios_entry_point;         /* "_SM_" or "_SM3_" entry point, synthesized if NULL */
+        size_t smbios_entry_point_size;
+        const void *smbios_table;
+        size_t smbios_table_size;
+        const void *edid;
+        size_t edid_size;
+        const void *dtb;                        /* DT installed by the firmware */
+        size_t dtb_size;
+} SimMachine;
+
+typedef enum SimSource {
+        SIM_SOURCE_NONE,                        /* Nothing to match against, the firmware DT (if any) is kept */
+        SIM_SOURCE_FIRMWARE,                    /* Matched against the compatible of the firmware DT */
+        SIM_SOURCE_HWID,                        /* Matched against the .hwids entry of the machine */
+} SimSource;
+
+typedef struct SimResult {
+        SimSource source;
+        int section;                            /* Section table index of the selected .dtbauto, -1 if none */
+        uint32_t score;
+        int chid_type;                          /* Only for SIM_SOURCE_HWID */
+        char device[128];                       /* Only for SIM_SOURCE_HWID */
+        char compatible[128];                   /* First compatible of the selected DT */
+        uint64_t dtb_hash;                      /* FNV-1a of the selected DT, to compare across images */
+        size_t log_size;
+        char log[2048];                         /* Whatever stubble logged, truncated */
+} SimResult;
+
+/* Implemented by the fake firmware. Runs the .dtbauto selection of the stub for one machine against an image
+ * whose sections have been loaded at 'image_base'. Must be called at most once per process, as the stub
+ * caches what it learns about the firmware. */
+void sim_evaluate(
+                const void *image_base,
+                const void *section_table,
+                size_t n_section_table,
+                const SimMachine *machine,
+                SimResult *ret);
+
+/* Implemented by the CLI, for the fake firmware */
+void *sim_host_alloc(size_t size, size_t alignment);
+void sim_host_free(void *p);
+_Noreturn void sim_host_freeze(void);
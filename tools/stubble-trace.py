@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: LGPL-2.1-or-later
+
+"""
+Decodes the binary trace log the stub records with stubble.trace, see
+include/trace.h.
+
+The stub only stores the offset of each format string, a timestamp and the raw
+argument words. The format strings, and any string arguments that point into
+the image, are read back from the stubble ELF the stub was built from. That
+must be the exact build that ran, otherwise the output is garbage.
+
+Example, on the booted system:
+
+  tools/stubble-trace.py --elf stubble
+"""
+
+import argparse
+import re
+import struct
+import sys
+from pathlib import Path
+
+TRACE_VARIABLE = Path('/sys/firmware/efi/efivars/StubbleTrace-4a67b082-0a4c-41cf-b6c7-440b29bb8c4f')
+TRACE_MAGIC = 0x43525453
+
+HEADER = struct.Struct('<IIIIQQ')
+RECORD = struct.Struct('<IIQQ')
+
+# Like handle_format_specifier() in efi-string.c, which also defines what consumes an argument
+SPECIFIER = re.compile(r'%([-+ #0]*)(\*|[0-9]+)?(?:\.(\*|[0-9]*))?(hh|h|ll|l|z|j|t)?([diuxXcspm%])')
+
+EFI_ERROR_MASK = 1 << 63
+
+WARNINGS = ['Success', 'Unknown glyph', 'Delete failure', 'Write failure', 'Buffer too small',
+            'Stale data', 'File system', 'Reset required']
+ERRORS = ['Error', 'Load error', 'Invalid parameter', 'Unsupported', 'Bad buffer size', 'Buffer too small',
+          'Not ready', 'Device error', 'Write protected', 'Out of resources', 'Volume corrupt', 'Volume full',
+          'No media', 'Media changed', 'Not found', 'Access denied', 'No response', 'No mapping', 'Time out',
+          'Not started', 'Already started', 'Aborted', 'ICMP error', 'TFTP error', 'Protocol error',
+          'Incompatible version', 'Security violation', 'CRC error', 'End of media', 'Reserved (29)',
+          'Reserved (30)', 'End of file', 'Invalid language', 'Compromised data', 'IP address conflict',
+          'HTTP error']
+
+class Image:
+    """The loadable segments of an ELF file, addressed by virtual address"""
+
+    def __init__(self, path: Path):
+        data = path.read_bytes()
+        if data[:4] != b'\x7fELF' or data[5] != 1:
+            raise ValueError(f'{path}: not a little endian ELF file')
+
+        if data[4] == 2:
+            phoff, = struct.unpack_from('<Q', data, 0x20)
+            phentsize, phnum = struct.unpack_from('<HH', data, 0x36)
+            phdr = '<IIQQQQQQ'
+        else:
+            phoff, = struct.unpack_from('<I', data, 0x1c)
+            phentsize, phnum = struct.unpack_from('<HH', data, 0x2a)
+            phdr = '<IIIIIIII'
+
+        self.segments = []
+        for i in range(phnum):
+            fields = struct.unpack_from(phdr, data, phoff + i * phentsize)
+            if data[4] == 2:
+                p_type, _, p_offset, p_vaddr, _, p_filesz, _, _ = fields
+            else:
+                p_type, p_offset, p_vaddr, _, p_filesz, _, _, _ = fields
+            if p_type == 1:  # PT_LOAD
+                self.segments.append((p_vaddr, data[p_offset:p_offset + p_filesz]))
+
+    def read(self, vaddr: int, width: int = 1) -> str | None:
+        """The NUL terminated string of 'width' byte characters at vaddr, or None if outside of the image"""
+        for start, data in self.segments:
+            if start <= vaddr < start + len(data):
+                off = vaddr - start
+                end = off
+                while end + width <= len(data) and data[end:end + width] != bytes(width):
+                    end += width
+                return data[off:end].decode('utf-16-le' if width == 2 else 'utf-8', errors='replace')
+        return None
+
+def status_to_string(status: int) -> str:
+    if status < len(WARNINGS):
+        return WARNINGS[status]
+    if status & EFI_ERROR_MASK and status & ~EFI_ERROR_MASK < len(ERRORS):
+        return ERRORS[status & ~EFI_ERROR_MASK]
+    return f'{status:#x}'
+
+def format_record(image: Image, image_base: int, fmt: str, status: int, args: list[int]) -> str:
+    args = list(args)
+
+    def pop() -> int | None:
+        return args.pop(0) if args else None
+
+    def spec(m: re.Match) -> str:
+        flags, width, precision, length, conv = m.groups()
+        if conv == '%':
+            return '%'
+        if conv == 'm':
+            return status_to_string(status)
+
+        if width == '*':
+            w = pop()
+            width = str(w - (1 << 64) if w is not None and w >= 1 << 63 else w or 0)
+        if precision == '*':
+            p = pop()
+            precision = str(p) if p is not None and p < 1 << 63 else None
+        pyfmt = '%' + flags + (width or '') + (f'.{precision or 0}' if precision is not None else '')
+
+        v = pop()
+        if v is None:
+            return '<missing>'
+
+        if conv in 'di':
+            return (pyfmt + 'd') % (v - (1 << 64) if v >= 1 << 63 else v)
+        if conv == 'u':
+            return (pyfmt + 'd') % v
+        if conv in 'xX':
+            return (pyfmt + conv) % v
+        if conv == 'c':
+            return (pyfmt + 's') % chr(v & 0xffff)
+        if conv == 'p':
+            return (pyfmt + 's') % (f'{v:#x}' if v else '(null)')
+
+        # %s and %ls
+        if v == 0:
+            s = '(null)'
+        else:
+            s = image.read(v - image_base, 2 if length == 'l' else 1)
+            if s is None:
+                s = f'<{v:#x}>'
+        return (pyfmt + 's') % s
+
+    return SPECIFIER.sub(spec, fmt)
+
+def decode(trace: bytes, image: Image) -> int:
+    # efivarfs prefixes the contents with the variable attributes
+    if len(trace) >= 8 and struct.unpack_from('<I', trace)[0] != TRACE_MAGIC:
+        trace = trace[4:]
+
+    if len(trace) < HEADER.size:
+        print('error: trace too short', file=sys.stderr)
+        return 1
+    magic, header_size, n_records, n_dropped, ticks_freq, image_base = HEADER.unpack_from(trace)
+    if magic != TRACE_MAGIC:
+        print('error: not a stubble trace', file=sys.stderr)
+        return 1
+
+    off = header_size
+    first = None
+    for _ in range(n_records):
+        fmt_off, n_args, ticks, status = RECORD.unpack_from(trace, off)
+        args = struct.unpack_from(f'<{n_args}Q', trace, off + RECORD.size)
+        off += RECORD.size + n_args * 8
+
+        if first is None:
+            first = ticks
+        if ticks_freq:
+            stamp = f'{(ticks - first) * 1000000 / ticks_freq:12.1f} us'
+        else:
+            stamp = f'{ticks - first:12d} ticks'
+
+        fmt = image.read(fmt_off)
+        if fmt is None:
+            print(f'[{stamp}] <format string at {fmt_off:#x} not in the ELF>')
+            continue
+        print(f'[{stamp}] {format_record(image, image_base, fmt, status, args)}')
+
+    if n_dropped:
+        print(f'{n_dropped} records dropped, the trace buffer was full', file=sys.stderr)
+    return 0
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description='Decode the binary trace log of stubble',
+                                     formatter_class=argparse.RawDescriptionHelpFormatter,
+                                     epilog=__doc__)
+    parser.add_argument('--elf', type=Path, required=True,
+                        help='the stubble ELF the stub was built from')
+    parser.add_argument('trace', type=Path, nargs='?', default=TRACE_VARIABLE,
+                        help=f'the exported trace (default: {TRACE_VARIABLE})')
+    args = parser.parse_args()
+
+    try:
+        image = Image(args.elf)
+        trace = args.trace.read_bytes()
+    except (ValueError, OSError) as e:
+        print(f'error: {e}', file=sys.stderr)
+        return 1
+
+    return decode(trace, image)
+
+if __name__ == '__main__':
+    sys.exit(main())
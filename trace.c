@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+
+#include "efi-efivars.h"
+#include "efi-log.h"
+#include "ticks.h"
+#include "trace.h"
+#include "util.h"
+
+/* Enough for a few hundred records while staying below the variable size limits of common firmware */
+#define TRACE_BUFFER_SIZE (16U * 1024U)
+#define TRACE_RECORD_SIZE_MAX (sizeof(TraceRecord) + TRACE_ARGS_MAX * sizeof(uint64_t))
+
+bool log_istrace = false;
+
+static struct {
+        uint8_t *buf;
+        size_t used;
+        uint32_t n_records;
+        uint32_t n_dropped;
+} trace;
+
+void trace_init(void) {
+        if (trace.buf)
+                return;
+
+        trace.buf = xmalloc(TRACE_BUFFER_SIZE);
+        trace.used = sizeof(TraceHeader);
+        log_istrace = true;
+}
+
+static size_t trace_args(const char *format, va_list ap, uint64_t args[static TRACE_ARGS_MAX]) {
+        size_t n = 0;
+
+        /* Walks the conversions the way vprintf_status() would, to know the type of each argument. Nothing
+         * is formatted and strings are not looked at. Argument types shorter than a long long are passed as
+         * int, see handle_format_specifier(). */
+        assert_cc(sizeof(long) == sizeof(int) || sizeof(long) == sizeof(long long));
+
+        for (const char *f = format; (f = strchr8(f, '%')) && n < TRACE_ARGS_MAX; f++) {
+                size_t size = sizeof(int);
+
+                for (f++; *f != '\0'; f++) {
+                        switch (*f) {
+                        case '#': case '-': case '+': case ' ': case '.':
+                        case '0' ... '9':
+                        case 'h':
+                                continue;
+                        case '*':
+                                args[n++] = (uint64_t) va_arg(ap, int);
+                                if (n >= TRACE_ARGS_MAX)
+                                        return n;
+                                continue;
+                        case 'l':
+                                if (f[1] == 'l') {
+                                        f++;
+                                        size = sizeof(long long);
+                                } else
+                                        size = sizeof(long);
+                                continue;
+                        case 'z':
+                                size = sizeof(size_t);
+                                continue;
+                        case 'j':
+                                size = sizeof(intmax_t);
+                                continue;
+                        case 't':
+                                size = sizeof(ptrdiff_t);
+                                continue;
+                        case 'd':
+                        case 'i':
+                                args[n++] = size == sizeof(long long) ? (uint64_t) va_arg(ap, long long) :
+                                                                        (uint64_t) va_arg(ap, int);
+                                break;
+                        case 'u':
+                        case 'x':
+                        case 'X':
+                        case 'c':
+                                args[n++] = size == sizeof(long long) ? va_arg(ap, unsigned long long) :
+                                                                        va_arg(ap, unsigned);
+                                break;
+                        case 's':
+                        case 'p':
+                                args[n++] = (uintptr_t) va_arg(ap, const void *);
+                                break;
+                        }
+
+                        /* %%, %m or something unknown: no argument */
+                        break;
+                }
+
+                if (*f == '\0')
+                        break;
+        }
+
+        return n;
+}
+
+void trace_record(EFI_STATUS status, const char *format, va_list ap) {
+        uint64_t ticks = ticks_read();
+
+        assert(format);
+
+        if (!trace.buf)
+                return;
+
+        if (trace.used + TRACE_RECORD_SIZE_MAX > TRACE_BUFFER_SIZE) {
+                trace.n_dropped++;
+                return;
+        }
+
+        /* No struct assignments, so that recording doesn't end up in memcpy() and the firmware */
+        TraceRecord *r = (TraceRecord *) (trace.buf + trace.used);
+        r->format = (uint32_t) ((const uint8_t *) format - __executable_start);
+        r->ticks = ticks;
+        r->status = status;
+        r->n_args = trace_args(format, ap, r->args);
+
+        trace.used += sizeof(TraceRecord) + r->n_args * sizeof(uint64_t);
+        trace.n_records++;
+}
+
+void trace_log(EFI_STATUS status, const char *format, ...) {
+        va_list ap;
+
+        va_start(ap, format);
+        trace_record(status, format, ap);
+        va_end(ap);
+}
+
+void trace_export(void) {
+        if (!trace.buf)
+                return;
+
+        /* Anything logged from here on, like a failure to export, goes to the console only */
+        log_istrace = false;
+
+        TraceHeader *h = (TraceHeader *) trace.buf;
+        *h = (TraceHeader) {
+                .magic = TRACE_MAGIC,
+                .header_size = sizeof(TraceHeader),
+                .n_records = trace.n_records,
+                .n_dropped = trace.n_dropped,
+                .ticks_freq = ticks_freq(),
+                .image_base = (uintptr_t) __executable_start,
+        };
+
+        EFI_STATUS err = efivar_set_raw(MAKE_GUID_PTR(LOADER), u"StubbleTrace", trace.buf, trace.used, 0);
+        if (err != EFI_SUCCESS)
+                log_warning_status(err, "Failed to export trace, ignoring: %m");
+
+        trace.buf = mfree(trace.buf);
+}
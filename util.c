@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 
+#include "arena.h"
 #include "util.h"
 #include "version.h"
 
@@ -7,6 +8,9 @@ void free(void *p) {
         if (!p)
                 return;
 
+        if (arena_free(p))
+                return;
+
         /* Debugging an invalid free requires trace logging to find the call site or a debugger attached. For
          * release builds it is not worth the bother to even warn when we cannot even print a call stack. */
 #ifdef EFI_DEBUG
@@ -16,6 +20,47 @@ void free(void *p) {
 #endif
 }
 
+EFI_STATUS allocate_aligned_pages(
+                EFI_ALLOCATE_TYPE type,
+                EFI_MEMORY_TYPE memory_type,
+                size_t n_pages,
+                size_t alignment,
+                EFI_PHYSICAL_ADDRESS addr,
+                Pages *ret_pages) {
+
+        EFI_STATUS err;
+
+        assert(ISPOWEROF2(alignment));
+        assert(type != AllocateAddress || addr % MAX(alignment, (size_t) EFI_PAGE_SIZE) == 0);
+        assert(ret_pages);
+
+        /* The firmware only guarantees page alignment. Allocate enough slack to find an aligned start
+         * within the allocation and hand the unused head and tail back right away. */
+        size_t n_slack = type == AllocateAddress ? 0 : EFI_SIZE_TO_PAGES(alignment) - 1;
+        size_t n_total;
+        if (!ADD_SAFE(&n_total, n_pages, n_slack))
+                return EFI_OUT_OF_RESOURCES;
+
+        err = BS->AllocatePages(type, memory_type, n_total, &addr);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        EFI_PHYSICAL_ADDRESS aligned = ALIGN_TO_U64(addr, alignment);
+        size_t n_head = (aligned - addr) / EFI_PAGE_SIZE;
+        size_t n_tail = n_slack - n_head;
+
+        if (n_head > 0)
+                (void) BS->FreePages(addr, n_head);
+        if (n_tail > 0)
+                (void) BS->FreePages(aligned + n_pages * EFI_PAGE_SIZE, n_tail);
+
+        *ret_pages = (Pages) {
+                .addr = aligned,
+                .n_pages = n_pages,
+        };
+        return EFI_SUCCESS;
+}
+
 static bool shall_be_whitespace(char16_t c) {
         return c <= 0x20U || c == 0x7FU; /* All control characters + space */
 }
@@ -66,16 +111,132 @@ __attribute__((noinline)) void notify_debugger(const char *identity, volatile bo
 #endif
 }
 
-void *find_configuration_table(const EFI_GUID *guid) {
+/* The same few tables (DTB, SMBIOS, ...) are looked up over and over again. Remember the slot each GUID was
+ * found in and check that it still holds that GUID before using it, as the firmware is free to rearrange
+ * the table whenever a table is installed. Misses are only remembered for as long as the table looks
+ * unchanged, and install_configuration_table() forgets everything. */
+static struct {
+        EFI_GUID guid;
+        size_t index;                   /* SIZE_MAX for a miss */
+        size_t n_entries;               /* State of the table at the time of a miss */
+        const void *table;
+} config_table_cache[8];
+static size_t config_table_cache_n = 0;
+
+static size_t config_table_scan(const EFI_GUID *guid) {
         for (size_t i = 0; i < ST->NumberOfTableEntries; i++)
                 if (efi_guid_equal(&ST->ConfigurationTable[i].VendorGuid, guid))
-                        return ST->ConfigurationTable[i].VendorTable;
+                        return i;
+
+        return SIZE_MAX;
+}
+
+static void *config_table_cache_lookup(const EFI_GUID *guid, bool *ret_hit) {
+        size_t slot;
+
+        for (slot = 0; slot < config_table_cache_n; slot++)
+                if (efi_guid_equal(&config_table_cache[slot].guid, guid))
+                        break;
+
+        if (slot < config_table_cache_n) {
+                size_t index = config_table_cache[slot].index;
 
-        return NULL;
+                if (index == SIZE_MAX) {
+                        if (config_table_cache[slot].n_entries == ST->NumberOfTableEntries &&
+                            config_table_cache[slot].table == ST->ConfigurationTable) {
+                                *ret_hit = true;
+                                return NULL;
+                        }
+                } else if (index < ST->NumberOfTableEntries &&
+                           efi_guid_equal(&ST->ConfigurationTable[index].VendorGuid, guid)) {
+                        *ret_hit = true;
+                        return ST->ConfigurationTable[index].VendorTable;
+                }
+        } else if (config_table_cache_n < ELEMENTSOF(config_table_cache))
+                slot = config_table_cache_n++;
+        else
+                slot = ELEMENTSOF(config_table_cache) - 1;
+
+        size_t index = config_table_scan(guid);
+        config_table_cache[slot].guid = *guid;
+        config_table_cache[slot].index = index;
+        config_table_cache[slot].n_entries = ST->NumberOfTableEntries;
+        config_table_cache[slot].table = ST->ConfigurationTable;
+
+        *ret_hit = false;
+        return index == SIZE_MAX ? NULL : ST->ConfigurationTable[index].VendorTable;
+}
+
+void *find_configuration_table(const EFI_GUID *guid) {
+        bool hit = false;
+        void *table;
+
+        assert(guid);
+
+        BS_STATS_TRACK(hit ? BS_STATS_CONFIGURATION_TABLE_HIT : BS_STATS_CONFIGURATION_TABLE_MISS,
+                       0,
+                       table = config_table_cache_lookup(guid, &hit));
+        return table;
+}
+
+EFI_STATUS install_configuration_table(const EFI_GUID *guid, void *table) {
+        assert(guid);
+
+        config_table_cache_n = 0;
+        return BS->InstallConfigurationTable((EFI_GUID *) guid, table);
+}
+
+EFI_STATUS open_volume(EFI_HANDLE device, EFI_FILE **ret_file) {
+        EFI_STATUS err;
+        EFI_FILE *file;
+        EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *volume;
+
+        assert(ret_file);
+
+        err = BS->HandleProtocol(device, MAKE_GUID_PTR(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL), (void **) &volume);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        err = volume->OpenVolume(volume, &file);
+        if (err != EFI_SUCCESS)
+                return err;
+
+        *ret_file = file;
+        return EFI_SUCCESS;
+}
+
+EFI_STATUS file_write_all(EFI_FILE *handle, const void *buf, size_t size) {
+        EFI_STATUS err;
+
+        for (const uint8_t *p = buf; size > 0;) {
+                size_t n = size;
+
+                err = handle->Write(handle, &n, (void *) p);
+                if (err != EFI_SUCCESS)
+                        return err;
+                if (n == 0)
+                        return EFI_DEVICE_ERROR;
+
+                p += n;
+                size -= n;
+        }
+
+        return EFI_SUCCESS;
 }
 
 void *xmalloc(size_t size) {
         void *p = NULL;
+        BS_STATS_FORWARD_CALLER();
+        assert_se(BS->AllocatePool(EfiLoaderData, size, &p) == EFI_SUCCESS);
+        return p;
+}
+
+void *xmalloc_scratch(size_t size) {
+        void *p = arena_alloc(size);
+        if (p)
+                return p;
+
+        BS_STATS_FORWARD_CALLER();
         assert_se(BS->AllocatePool(EfiLoaderData, size, &p) == EFI_SUCCESS);
         return p;
 }